@@ -0,0 +1,431 @@
+//
+//  batch.cpp
+//  iPad-SimEnergy
+//
+//  Headless batch deformation of images: every job drags handles on the grid
+//  mesh of an image along a scripted trajectory and writes the deformed image.
+//  The jobs run on a WorkStealingPool, one job per thread at a time. Jobs with
+//  the same image size, grid, mode and handles share their factorization:
+//  they are queued together on one worker, which keeps the engines of its
+//  last topologies and only resets their meshes to the rest pose.
+//
+//  usage: simenergy_batch jobs.txt [--threads N] [--backend LDLT|LU|Cholesky|Multigrid|BandedLAPACK|MatrixFreeCG|BlockLDLT]
+//
+//  jobs.txt has one job per line ('#' starts a comment):
+//      input.ppm output.pam grid Sim|ARAP iterations trajectory.txt
+//  Images are binary PPM (P6) or PAM (P7, RGB or RGB_ALPHA) with 8 bits per
+//  channel; a .pam output keeps the transparency of the uncovered pixels.
+//  Relative paths are taken from the directory of jobs.txt. A trajectory is
+//      handle u v        (one line per handle, fractions of the image from the lower left)
+//      frame dx dy ...   (one line per frame, the offset of every handle in fractions of the image)
+//  Each handle is snapped to the nearest grid vertex; the last frame is the output.
+//
+
+#include "GridMesh.h"
+#include "ImageRasterizer.h"
+#include "WorkStealingPool.h"
+
+#include <algorithm>
+#include <cctype>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <map>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <tuple>
+
+static void usage(const char *program){
+    std::fprintf(stderr, "usage: %s jobs.txt [--threads N] [--backend LDLT|LU|Cholesky|Multigrid|BandedLAPACK|MatrixFreeCG|BlockLDLT]\n", program);
+    std::exit(1);
+}
+
+static double elapsed(std::chrono::steady_clock::time_point start){
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+// RGBA, 8 bits per channel, top row first
+struct Image {
+    int width = 0, height = 0;
+    std::vector<uint8_t> pixels;
+};
+
+// next header token of a PNM file, skipping comments
+static bool headerToken(FILE *file, std::string &token){
+    token.clear();
+    int c = std::fgetc(file);
+    while(c!=EOF && (std::isspace(c) || c=='#')){
+        if(c=='#') while(c!=EOF && c!='\n') c = std::fgetc(file);
+        c = std::fgetc(file);
+    }
+    while(c!=EOF && !std::isspace(c)){
+        token += (char)c;
+        c = std::fgetc(file);
+    }
+    return !token.empty();
+}
+
+// binary PPM (P6) or PAM (P7) with maxval 255
+static bool readImage(const std::string &path, Image &image, std::string &error){
+    FILE *file = std::fopen(path.c_str(), "rb");
+    if(!file){
+        error = "cannot open " + path;
+        return false;
+    }
+    std::string magic, token;
+    int channels = 0, maxval = 0;
+    image.width = image.height = 0;
+    headerToken(file, magic);
+    if(magic=="P6"){
+        channels = 3;
+        if(headerToken(file, token)) image.width = std::atoi(token.c_str());
+        if(headerToken(file, token)) image.height = std::atoi(token.c_str());
+        if(headerToken(file, token)) maxval = std::atoi(token.c_str());
+    }else if(magic=="P7"){
+        while(headerToken(file, token) && token!="ENDHDR"){
+            std::string value;
+            headerToken(file, value);
+            if(token=="WIDTH") image.width = std::atoi(value.c_str());
+            else if(token=="HEIGHT") image.height = std::atoi(value.c_str());
+            else if(token=="DEPTH") channels = std::atoi(value.c_str());
+            else if(token=="MAXVAL") maxval = std::atoi(value.c_str());
+        }
+    }
+    if(image.width<=0 || image.height<=0 || maxval!=255 || (channels!=3 && channels!=4)){
+        std::fclose(file);
+        error = path + ": not an 8-bit RGB(A) PPM or PAM image";
+        return false;
+    }
+    size_t count = (size_t)image.width*image.height;
+    image.pixels.resize(4*count);
+    size_t read = std::fread(image.pixels.data(), channels, count, file);
+    std::fclose(file);
+    if(read!=count){
+        error = path + ": truncated";
+        return false;
+    }
+    // spread RGB to RGBA in place, from the end
+    if(channels==3){
+        for(size_t i=count;i-->0;){
+            image.pixels[4*i+3] = 255;
+            for(int ch=2;ch>=0;ch--) image.pixels[4*i+ch] = image.pixels[3*i+ch];
+        }
+    }
+    return true;
+}
+
+// streams the rows of the rasterizer to a PAM (RGBA) or, for any other extension, a PPM (alpha dropped)
+static bool writeImage(const std::string &path, const ImageRasterizer &rasterizer, std::string &error){
+    FILE *file = std::fopen(path.c_str(), "wb");
+    if(!file){
+        error = "cannot write " + path;
+        return false;
+    }
+    int width = rasterizer.getWidth(), height = rasterizer.getHeight();
+    bool pam = path.size()>=4 && path.compare(path.size()-4, 4, ".pam")==0;
+    if(pam){
+        std::fprintf(file, "P7\nWIDTH %d\nHEIGHT %d\nDEPTH 4\nMAXVAL 255\nTUPLTYPE RGB_ALPHA\nENDHDR\n", width, height);
+    }else{
+        std::fprintf(file, "P6\n%d %d\n255\n", width, height);
+    }
+    std::vector<uint8_t> rgb(pam ? 0 : 3*(size_t)width);
+    bool ok = true;
+    rasterizer.rasterize([&](int, int rows, const uint8_t *pixels, size_t stride){
+        for(int r=0;r<rows && ok;r++){
+            const uint8_t *line = pixels + r*stride;
+            if(pam){
+                ok = std::fwrite(line, 4, width, file)==(size_t)width;
+                continue;
+            }
+            for(int i=0;i<width;i++) std::memcpy(&rgb[3*i], line+4*i, 3);
+            ok = std::fwrite(rgb.data(), 3, width, file)==(size_t)width;
+        }
+    });
+    if(std::fclose(file)!=0) ok = false;
+    if(!ok) error = "cannot write " + path;
+    return ok;
+}
+
+// handles and their offsets per frame, in fractions of the image
+struct Trajectory {
+    std::vector<float> u, v;
+    // frame f moves handle h by (dx, dy) = offsets[f][2*h], offsets[f][2*h+1]
+    std::vector<std::vector<float>> offsets;
+};
+
+static bool readTrajectory(const std::string &path, Trajectory &trajectory, std::string &error){
+    std::ifstream in(path);
+    if(!in){
+        error = "cannot open " + path;
+        return false;
+    }
+    std::string line;
+    int number = 0;
+    while(std::getline(in, line)){
+        number++;
+        line = line.substr(0, line.find('#'));
+        std::istringstream words(line);
+        std::string keyword;
+        if(!(words >> keyword)) continue;
+        if(keyword=="handle"){
+            float u, v;
+            if(!(words >> u >> v) || !trajectory.offsets.empty()){
+                error = path + ":" + std::to_string(number) + ": expected 'handle u v' before the frames";
+                return false;
+            }
+            trajectory.u.push_back(u);
+            trajectory.v.push_back(v);
+        }else if(keyword=="frame"){
+            std::vector<float> offsets(2*trajectory.u.size());
+            for(float &o : offsets){
+                if(!(words >> o)){
+                    error = path + ":" + std::to_string(number) + ": expected an offset for every handle";
+                    return false;
+                }
+            }
+            trajectory.offsets.push_back(offsets);
+        }else{
+            error = path + ":" + std::to_string(number) + ": unknown keyword " + keyword;
+            return false;
+        }
+    }
+    if(trajectory.u.empty() || trajectory.offsets.empty()){
+        error = path + ": no handles or no frames";
+        return false;
+    }
+    return true;
+}
+
+struct Job {
+    std::string input, output;
+    int grid = 0, mode = DeformationEngine::Sim, iterations = 1;
+    int trajectory = 0;
+};
+
+// what a factorization depends on: the rest pose (image size and grid), the energy and the handles
+struct Topology {
+    int width = 0, height = 0, grid = 0, mode = 0;
+    std::vector<int> handles;
+    bool operator<(const Topology &o) const {
+        return std::tie(width, height, grid, mode, handles) < std::tie(o.width, o.height, o.grid, o.mode, o.handles);
+    }
+    bool operator==(const Topology &o) const { return !(*this<o) && !(o<*this); }
+};
+
+// handle vertices of a trajectory on the grid
+static std::vector<int> snapHandles(const Trajectory &trajectory, int grid){
+    std::vector<int> handles;
+    for(size_t h=0;h<trajectory.u.size();h++){
+        int i = std::min(std::max((int)std::lround(trajectory.u[h]*grid), 0), grid);
+        int j = std::min(std::max((int)std::lround(trajectory.v[h]*grid), 0), grid);
+        handles.push_back(j*(grid+1)+i);
+    }
+    return handles;
+}
+
+// a mesh and its engine, factorised for one topology
+struct Session {
+    Topology topology;
+    std::unique_ptr<GridMesh> mesh;
+    DeformationEngine engine;
+    std::vector<float> u, v;
+};
+
+// the sessions of one worker, most recently used first
+struct Worker {
+    static const int CACHED_SESSIONS = 4;
+    std::vector<std::unique_ptr<Session>> sessions;
+    int factorizations = 0, reused = 0, failed = 0;
+    double load = 0, solve = 0, write = 0;
+};
+
+static std::string resolve(const std::string &directory, const std::string &path){
+    return path.empty() || path[0]=='/' ? path : directory + path;
+}
+
+int main(int argc, char **argv){
+    const char *path = nullptr;
+    int threads = parallelConcurrency();
+    SolverBackend::Kind kind = SolverBackend::LDLT;
+    for(int a=1;a<argc;a++){
+        if(!std::strcmp(argv[a], "--threads") && a+1<argc){
+            threads = std::max(1, std::atoi(argv[++a]));
+        }else if(!std::strcmp(argv[a], "--backend") && a+1<argc){
+            if(!SolverBackend::parse(argv[++a], kind)) usage(argv[0]);
+        }else if(argv[a][0]!='-' && !path){
+            path = argv[a];
+        }else{
+            usage(argv[0]);
+        }
+    }
+    if(!path) usage(argv[0]);
+    std::string directory(path);
+    directory = directory.find('/')==std::string::npos ? "" : directory.substr(0, directory.rfind('/')+1);
+
+    // the job list, with every trajectory read once
+    std::ifstream in(path);
+    if(!in){
+        std::fprintf(stderr, "cannot open %s\n", path);
+        return 1;
+    }
+    std::vector<Job> jobs;
+    std::vector<Trajectory> trajectories;
+    std::map<std::string, int> trajectoryIndex;
+    std::string line;
+    int number = 0;
+    while(std::getline(in, line)){
+        number++;
+        line = line.substr(0, line.find('#'));
+        std::istringstream words(line);
+        Job job;
+        std::string mode, trajectory;
+        if(!(words >> job.input)) continue;
+        if(!(words >> job.output >> job.grid >> mode >> job.iterations >> trajectory) || job.grid<1 || (mode!="Sim" && mode!="ARAP")){
+            std::fprintf(stderr, "%s:%d: expected 'input output grid Sim|ARAP iterations trajectory'\n", path, number);
+            return 1;
+        }
+        job.input = resolve(directory, job.input);
+        job.output = resolve(directory, job.output);
+        job.mode = mode=="Sim" ? DeformationEngine::Sim : DeformationEngine::ARAP;
+        trajectory = resolve(directory, trajectory);
+        auto found = trajectoryIndex.find(trajectory);
+        if(found==trajectoryIndex.end()){
+            Trajectory t;
+            std::string error;
+            if(!readTrajectory(trajectory, t, error)){
+                std::fprintf(stderr, "%s\n", error.c_str());
+                return 1;
+            }
+            found = trajectoryIndex.emplace(trajectory, (int)trajectories.size()).first;
+            trajectories.push_back(t);
+        }
+        job.trajectory = found->second;
+        jobs.push_back(job);
+    }
+
+    // jobs of the same grid, mode and trajectory go to the same worker, the largest groups first to the least loaded one.
+    // (The image size completes the topology only once the image is read; images of a group usually share it.)
+    WorkStealingPool pool(threads);
+    std::map<std::tuple<int, int, int>, std::vector<int>> groups;
+    for(int k=0;k<(int)jobs.size();k++) groups[std::make_tuple(jobs[k].grid, jobs[k].mode, jobs[k].trajectory)].push_back(k);
+    std::vector<const std::vector<int> *> order;
+    for(const auto &group : groups) order.push_back(&group.second);
+    std::stable_sort(order.begin(), order.end(), [](const std::vector<int> *a, const std::vector<int> *b){ return a->size()>b->size(); });
+    std::vector<size_t> load(pool.size(), 0);
+    std::vector<Worker> workers(pool.size());
+
+    for(const std::vector<int> *group : order){
+        int w = (int)(std::min_element(load.begin(), load.end())-load.begin());
+        load[w] += group->size();
+        for(int k : *group){
+            pool.push(w, [&, k](int worker){
+                const Job &job = jobs[k];
+                const Trajectory &trajectory = trajectories[job.trajectory];
+                Worker &self = workers[worker];
+                std::string error;
+                auto start = std::chrono::steady_clock::now();
+                Image image;
+                if(!readImage(job.input, image, error)){
+                    std::fprintf(stderr, "%s\n", error.c_str());
+                    self.failed++;
+                    return;
+                }
+                self.load += elapsed(start);
+
+                start = std::chrono::steady_clock::now();
+                Topology topology;
+                topology.width = image.width;
+                topology.height = image.height;
+                topology.grid = job.grid;
+                topology.mode = job.mode;
+                topology.handles = snapHandles(trajectory, job.grid);
+                auto cached = std::find_if(self.sessions.begin(), self.sessions.end(),
+                                           [&](const std::unique_ptr<Session> &s){ return s->topology==topology; });
+                std::unique_ptr<Session> session;
+                if(cached!=self.sessions.end()){
+                    session = std::move(*cached);
+                    self.sessions.erase(cached);
+                }
+                GridMesh *mesh;
+                if(session){
+                    // the factorization is that of the rest pose with these handles
+                    mesh = session->mesh.get();
+                    mesh->initialize();
+                    // (within the reserved capacity, so the engine's view of the selection stays valid)
+                    mesh->selected.insert(mesh->selected.end(), topology.handles.begin(), topology.handles.end());
+                    self.reused++;
+                }else{
+                    session.reset(new Session);
+                    session->topology = topology;
+                    session->mesh.reset(new GridMesh((float)image.width, (float)image.height, job.grid, job.grid));
+                    mesh = session->mesh.get();
+                    mesh->selected.insert(mesh->selected.end(), topology.handles.begin(), topology.handles.end());
+                    session->u.resize(mesh->numVertices);
+                    session->v.resize(mesh->numVertices);
+                    ImageRasterizer::gridTextureCoordinates(job.grid, job.grid, session->u.data(), session->v.data());
+                    session->engine.mode = job.mode;
+                    session->engine.setSolverBackend(kind);
+                    session->engine.setMesh(mesh->view());
+                    session->engine.formEnergy();
+                    self.factorizations++;
+                }
+                DeformationEngine &engine = session->engine;
+                engine.iteration = job.iterations;
+                size_t handles = topology.handles.size();
+                for(const std::vector<float> &offsets : trajectory.offsets){
+                    for(size_t h=0;h<handles;h++){
+                        int i = topology.handles[h];
+                        mesh->x[i] = mesh->ix[i] + offsets[2*h]*image.width;
+                        mesh->y[i] = mesh->iy[i] + offsets[2*h+1]*image.height;
+                    }
+                    engine.solve();
+                }
+                self.solve += elapsed(start);
+
+                start = std::chrono::steady_clock::now();
+                ImageRasterizer::Image source;
+                source.pixels = image.pixels.data();
+                source.width = image.width;
+                source.height = image.height;
+                source.stride = 4*(size_t)image.width;
+                ImageRasterizer rasterizer;
+                rasterizer.setup(source, mesh->numVertices, mesh->numTriangles, mesh->x.data(), mesh->y.data(),
+                                 session->u.data(), session->v.data(), mesh->triangles.data(),
+                                 image.width, image.height, -mesh->width/2, mesh->width/2, -mesh->height/2, mesh->height/2);
+                if(!writeImage(job.output, rasterizer, error)){
+                    std::fprintf(stderr, "%s\n", error.c_str());
+                    self.failed++;
+                }
+                self.write += elapsed(start);
+
+                self.sessions.insert(self.sessions.begin(), std::move(session));
+                if((int)self.sessions.size()>Worker::CACHED_SESSIONS) self.sessions.pop_back();
+            });
+        }
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    pool.run();
+    double wall = elapsed(start);
+
+    Worker total;
+    for(const Worker &w : workers){
+        total.factorizations += w.factorizations;
+        total.reused += w.reused;
+        total.failed += w.failed;
+        total.load += w.load;
+        total.solve += w.solve;
+        total.write += w.write;
+    }
+    int written = (int)jobs.size()-total.failed;
+    std::printf("%d jobs on %d threads (%s): %d written, %d failed\n", (int)jobs.size(), pool.size(),
+                SolverBackend::create(kind)->name(), written, total.failed);
+    std::printf("factorizations %d, reused %d, jobs stolen %d\n", total.factorizations, total.reused, pool.numSteals());
+    std::printf("thread time: read %.1f ms, deform %.1f ms, rasterize and write %.1f ms\n", total.load, total.solve, total.write);
+    std::printf("wall %.1f ms, %.2f images/s\n", wall, wall>0 ? 1000.0*written/wall : 0.0);
+    return total.failed>0 ? 1 : 0;
+}
@@ -0,0 +1,823 @@
+//
+//  benchmark.cpp
+//  iPad-SimEnergy
+//
+//  Headless benchmark of the deformation core: scripted two-handle drags on
+//  regular grids, timing the assembly, the factorization, the per-frame
+//  solve and the ARAP local step for every backend. With --interpolate K it
+//  also times K in-between frames from the rest pose to a twisted pose, and
+//  with --scaling 1,2,4 the ARAP local step and right-hand side on that many
+//  threads. --adaptive 4,32 compares the content-adaptive mesh of a test
+//  sprite (cells of 4 to 32 pixels) with the uniform grid of its finest cells.
+//  --orderings compares the factor size and the solve and product times of
+//  the split x/y layout (SparseLU with COLAMD, SimplicialLDLT with AMD) with
+//  the interleaved 2x2 blocks of BlockLDLT under RCM and nested dissection.
+//  --prefactored compares a change of the handle set (a third finger put
+//  down and lifted) with the rest pose factorised once and the handles
+//  imposed through a Schur complement, against a full refactorization.
+//  --kernels times the batched per-triangle Sim kernel of SimAssembly.h and
+//  the expanded Maple expressions it replaces, in float and double, and
+//  checks both against the expanded expressions in long double.
+//
+//  usage: simenergy_benchmark [--grids 15,31,63] [--modes Sim,ARAP]
+//             [--backends LDLT,LU,Cholesky,Multigrid,BandedLAPACK,MatrixFreeCG,BlockLDLT]
+//             [--frames 20] [--iterations 4] [--max-direct 511]
+//             [--max-banded 70000] [--refinement 0] [--interpolate 0] [--handle-basis]
+//             [--arap-budget 0] [--scaling 1,2,4,8] [--adaptive 4,32] [--orderings]
+//             [--ordering ND] [--prefactored] [--kernels] [--csv]
+//
+
+#include "GridMesh.h"
+#include "AdaptiveMesh.h"
+#include "ShapeInterpolator.h"
+
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+
+struct Options {
+    std::vector<int> grids = {15, 31, 63, 127, 255, 511, 1000};
+    std::vector<int> modes = {DeformationEngine::Sim, DeformationEngine::ARAP};
+    std::vector<SolverBackend::Kind> backends = {SolverBackend::LDLT, SolverBackend::Multigrid, SolverBackend::BandedLAPACK};
+    int frames = 20;
+    int iterations = 4;
+    // larger grids are only run with the iterative backends
+    int maxDirect = 511;
+    // largest system (DOFs) for the banded backend, whose storage grows as DOFs^1.5
+    int maxBanded = 70000;
+    // mixed-precision refinement steps per solve
+    int refinement = 0;
+    // in-between frames of the shape interpolation (0: not run)
+    int interpolate = 0;
+    // Sim drags as products with the precomputed handle basis
+    bool handleBasis = false;
+    // ARAP rounds per frame limited by time (milliseconds) and convergence instead of --iterations
+    double arapBudget = 0;
+    // thread counts of the ARAP scaling table (empty: not run)
+    std::vector<int> scaling;
+    // finest and coarsest cell of the adaptive mesh in pixels (empty: not run)
+    std::vector<int> adaptive;
+    // layout and ordering comparison of the direct factorizations
+    bool orderings = false;
+    // vertex ordering of the BlockLDLT backend
+    BlockLDLTBackend::Ordering blockOrdering = BlockLDLTBackend::NestedDissection;
+    // handle changes with the prefactored rest pose against refactorization
+    bool prefactored = false;
+    // comparison of the Sim triangle kernels
+    bool kernels = false;
+    bool csv = false;
+};
+
+static std::vector<std::string> split(const char *list){
+    std::vector<std::string> items;
+    std::string s(list);
+    size_t start = 0;
+    while(start<=s.size()){
+        size_t end = s.find(',', start);
+        if(end==std::string::npos) end = s.size();
+        if(end>start) items.push_back(s.substr(start, end-start));
+        start = end+1;
+    }
+    return items;
+}
+
+static void usage(const char *program){
+    std::fprintf(stderr, "usage: %s [--grids 15,31,63] [--modes Sim,ARAP]\n"
+                 "       [--backends LDLT,LU,Cholesky,Multigrid,BandedLAPACK,MatrixFreeCG,BlockLDLT]\n"
+                 "       [--frames 20] [--iterations 4] [--max-direct 511] [--max-banded 70000] [--refinement 0] [--interpolate 0]\n"
+                 "       [--handle-basis] [--arap-budget 0] [--scaling 1,2,4,8] [--adaptive 4,32] [--orderings] [--ordering RCM|ND]\n"
+                 "       [--prefactored] [--kernels] [--csv]\n", program);
+    std::exit(1);
+}
+
+static Options parseOptions(int argc, char **argv){
+    Options options;
+    for(int a=1;a<argc;a++){
+        const char *arg = argv[a];
+        if(!std::strcmp(arg, "--csv")){
+            options.csv = true;
+            continue;
+        }
+        if(!std::strcmp(arg, "--handle-basis")){
+            options.handleBasis = true;
+            continue;
+        }
+        if(!std::strcmp(arg, "--orderings")){
+            options.orderings = true;
+            continue;
+        }
+        if(!std::strcmp(arg, "--prefactored")){
+            options.prefactored = true;
+            continue;
+        }
+        if(!std::strcmp(arg, "--kernels")){
+            options.kernels = true;
+            continue;
+        }
+        if(a+1>=argc) usage(argv[0]);
+        const char *value = argv[++a];
+        if(!std::strcmp(arg, "--grids")){
+            options.grids.clear();
+            for(const std::string &g : split(value)) options.grids.push_back(std::atoi(g.c_str()));
+        }else if(!std::strcmp(arg, "--modes")){
+            options.modes.clear();
+            for(const std::string &m : split(value)){
+                if(m=="Sim") options.modes.push_back(DeformationEngine::Sim);
+                else if(m=="ARAP") options.modes.push_back(DeformationEngine::ARAP);
+                else usage(argv[0]);
+            }
+        }else if(!std::strcmp(arg, "--backends")){
+            options.backends.clear();
+            for(const std::string &b : split(value)){
+                SolverBackend::Kind kind;
+                if(!SolverBackend::parse(b.c_str(), kind)) usage(argv[0]);
+                options.backends.push_back(kind);
+            }
+        }else if(!std::strcmp(arg, "--frames")){
+            options.frames = std::atoi(value);
+        }else if(!std::strcmp(arg, "--iterations")){
+            options.iterations = std::atoi(value);
+        }else if(!std::strcmp(arg, "--max-direct")){
+            options.maxDirect = std::atoi(value);
+        }else if(!std::strcmp(arg, "--max-banded")){
+            options.maxBanded = std::atoi(value);
+        }else if(!std::strcmp(arg, "--refinement")){
+            options.refinement = std::atoi(value);
+        }else if(!std::strcmp(arg, "--interpolate")){
+            options.interpolate = std::atoi(value);
+        }else if(!std::strcmp(arg, "--arap-budget")){
+            options.arapBudget = std::atof(value);
+        }else if(!std::strcmp(arg, "--scaling")){
+            options.scaling.clear();
+            for(const std::string &t : split(value)) options.scaling.push_back(std::max(1, std::atoi(t.c_str())));
+        }else if(!std::strcmp(arg, "--ordering")){
+            if(!std::strcmp(value, "RCM")) options.blockOrdering = BlockLDLTBackend::ReverseCuthillMcKee;
+            else if(!std::strcmp(value, "ND")) options.blockOrdering = BlockLDLTBackend::NestedDissection;
+            else usage(argv[0]);
+        }else if(!std::strcmp(arg, "--adaptive")){
+            options.adaptive.clear();
+            for(const std::string &c : split(value)) options.adaptive.push_back(std::max(1, std::atoi(c.c_str())));
+            if(options.adaptive.size()!=2) usage(argv[0]);
+        }else{
+            usage(argv[0]);
+        }
+    }
+    return options;
+}
+
+struct Result {
+    int dofs = 0;
+    double assembly = 0, factorize = 0, frame = 0, maxFrame = 0, solve = 0, localStep = 0;
+    // the drag ends where it started, so the exact last frame is the rest pose
+    double restError = 0;
+    // largest error bound reported by the refinement over the drag
+    double refinementBound = 0;
+    // ARAP: rounds per frame, and the energy of the last frame
+    double arapIterations = 0, arapEnergy = 0;
+    // MatrixFreeCG: iterations per solve (worst column)
+    double cgIterations = 0;
+    bool succeeded = true;
+};
+
+static double elapsed(std::chrono::steady_clock::time_point start){
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+// touch down the selected vertices and drag the second one once around a circle
+template <class Mesh>
+static Result drag(Mesh &mesh, int mode, SolverBackend::Kind kind, const Options &options){
+    DeformationEngine engine;
+    engine.mode = mode;
+    engine.iteration = options.iterations;
+    engine.refinementSteps = options.refinement;
+    engine.handleBasis = options.handleBasis;
+    engine.arapBudget = options.arapBudget;
+    engine.blockOrdering = options.blockOrdering;
+    engine.setSolverBackend(kind);
+    engine.setMesh(mesh.view());
+
+    Result result;
+    result.dofs = (mode==DeformationEngine::Sim ? 2 : 1)*mesh.numVertices;
+    engine.formEnergy();
+    result.succeeded = engine.backend().succeeded();
+    result.assembly = engine.assemblyTime;
+    // the basis solves are part of the touch down
+    result.factorize = engine.backend().factorizeTime + engine.basisTime;
+
+    int handle = mesh.selected[1];
+    float cx = mesh.ix[handle], cy = mesh.iy[handle];
+    float radius = 0.1f*mesh.width;
+    for(int f=1;f<=options.frames;f++){
+        float angle = 6.2831853f*f/options.frames;
+        mesh.x[handle] = cx + radius*std::sin(angle);
+        mesh.y[handle] = cy + radius*(1.0f-std::cos(angle));
+        auto start = std::chrono::steady_clock::now();
+        engine.solve();
+        double t = elapsed(start);
+        result.frame += t;
+        result.maxFrame = std::max(result.maxFrame, t);
+        result.refinementBound = std::max(result.refinementBound, engine.refinement().errorBound);
+        result.arapIterations += engine.arapProgress().iterations;
+        result.arapEnergy = engine.arapProgress().energy;
+    }
+    SolverBackend &backend = engine.backend();
+    result.frame /= std::max(options.frames, 1);
+    result.arapIterations = mode==DeformationEngine::ARAP ? result.arapIterations/std::max(options.frames, 1) : 0;
+    result.solve = backend.numSolves>0 ? backend.solveTime/backend.numSolves : 0;
+    result.localStep = engine.numLocalSteps>0 ? engine.localStepTime/engine.numLocalSteps : 0;
+    if(MatrixFreeCGBackend *cg = dynamic_cast<MatrixFreeCGBackend *>(&backend)){
+        // the touch down does not solve, so these are the solves of the drag
+        result.cgIterations = cg->numSolves>0 ? (double)cg->totalIterations/cg->numSolves : 0;
+    }
+    for(int i=0;i<mesh.numVertices;i++){
+        result.restError = std::max(result.restError, (double)std::hypot(mesh.x[i]-mesh.ix[i], mesh.y[i]-mesh.iy[i]));
+    }
+    return result;
+}
+
+// the two handles on the middle row of the grid
+static Result run(int grid, int mode, SolverBackend::Kind kind, const Options &options){
+    GridMesh mesh(400.0f, 300.0f, grid, grid);
+    mesh.selected.push_back(mesh.vertex(grid/4, grid/2));
+    mesh.selected.push_back(mesh.vertex(3*grid/4, grid/2));
+    return drag(mesh, mode, kind, options);
+}
+
+struct HandleChangeResult {
+    // first touch down, and putting down or lifting a third finger (mean of both)
+    double touchDown = 0, handleChange = 0, frame = 0;
+    bool succeeded = true;
+};
+
+// two fingers down and half a circle of drag, then a third finger put down and lifted;
+// x and y receive the vertices at the end of the drag
+static HandleChangeResult handleChanges(int grid, int mode, SolverBackend::Kind kind, bool prefactored, const Options &options,
+                                        std::vector<float> &x, std::vector<float> &y){
+    GridMesh mesh(400.0f, 300.0f, grid, grid);
+    mesh.selected.push_back(mesh.vertex(grid/4, grid/2));
+    mesh.selected.push_back(mesh.vertex(3*grid/4, grid/2));
+    DeformationEngine engine;
+    engine.mode = mode;
+    engine.iteration = options.iterations;
+    engine.prefactored = prefactored;
+    engine.refinementSteps = options.refinement;
+    engine.blockOrdering = options.blockOrdering;
+    engine.setSolverBackend(kind);
+    engine.setMesh(mesh.view());
+
+    HandleChangeResult result;
+    auto start = std::chrono::steady_clock::now();
+    engine.formEnergy();
+    result.touchDown = elapsed(start);
+    int handle = mesh.selected[1];
+    float cx = mesh.ix[handle], cy = mesh.iy[handle];
+    float radius = 0.1f*mesh.width;
+    for(int f=1;f<=options.frames;f++){
+        float angle = 3.1415927f*f/options.frames;
+        mesh.x[handle] = cx + radius*std::sin(angle);
+        mesh.y[handle] = cy + radius*(1.0f-std::cos(angle));
+        start = std::chrono::steady_clock::now();
+        engine.solve();
+        result.frame += elapsed(start);
+    }
+    result.frame /= std::max(options.frames, 1);
+    result.succeeded = engine.backend().succeeded();
+    x = mesh.x;
+    y = mesh.y;
+    // the storage of selected was reserved, so the engine's pointer stays valid
+    mesh.selected.push_back(mesh.vertex(grid/2, 3*grid/4));
+    engine.setNumSelected(3);
+    start = std::chrono::steady_clock::now();
+    engine.formEnergy();
+    result.handleChange = elapsed(start);
+    mesh.selected.pop_back();
+    engine.setNumSelected(2);
+    start = std::chrono::steady_clock::now();
+    engine.formEnergy();
+    result.handleChange = (result.handleChange + elapsed(start))/2;
+    result.succeeded = result.succeeded && engine.backend().succeeded();
+    return result;
+}
+
+// vertex of the rest pose nearest to (px, py), other than the reserved vertex 0
+template <class Mesh>
+static int nearestVertex(const Mesh &mesh, float px, float py){
+    int best = 1;
+    for(int i=2;i<mesh.numVertices;i++){
+        if(std::hypot(mesh.ix[i]-px, mesh.iy[i]-py)<std::hypot(mesh.ix[best]-px, mesh.iy[best]-py)) best = i;
+    }
+    return best;
+}
+
+struct OrderingResult {
+    // entries (scalars) and bytes of the factors, with their indices
+    long entries = 0;
+    double kib = 0;
+    double factorize = 0, solve = 0, product = 0;
+    // relative residual of a solve, as a check
+    double residual = 0;
+    bool succeeded = true;
+};
+
+// the energy of the grid with the two handles of run() eliminated, factorised with the given layout:
+// 0 split x/y with SparseLU (COLAMD), 1 split with SimplicialLDLT (AMD), 2 and 3 BlockLDLT with RCM and ND
+static OrderingResult compareOrdering(int grid, int mode, int layout){
+    GridMesh mesh(400.0f, 300.0f, grid, grid);
+    int nv = mesh.numVertices;
+    std::vector<int> handles = {mesh.vertex(grid/4, grid/2), mesh.vertex(3*grid/4, grid/2)};
+    SpMat K;
+    if(mode==DeformationEngine::Sim){
+        SimAssembly assembly;
+        assembly.analyze(nv, mesh.numTriangles, mesh.triangles.data());
+        assembly.assemble(mesh.ix.data(), mesh.iy.data());
+        K = assembly.matrix();
+        handles.push_back(handles[0]+nv);
+        handles.push_back(handles[1]+nv);
+    }else{
+        ArapWorkspace arap;
+        arap.resize(nv, mesh.numTriangles);
+        arap.computePinv(mesh.ix.data(), mesh.iy.data(), mesh.triangles.data());
+        std::vector<T> triplets;
+        arap.energyTriplets(mesh.triangles.data(), triplets);
+        K.resize(nv, nv);
+        K.setFromTriplets(triplets.begin(), triplets.end());
+    }
+    int n = (int)K.rows();
+    std::vector<bool> isFixed(n, false);
+    for(int h : handles) isFixed[h] = true;
+    SpMat G = eliminateConstraints(K, isFixed);
+    Eigen::MatrixXf b = Eigen::MatrixXf::Random(n, 1), x(n, 1);
+    for(int h : handles) b(h) = 0;
+    const int repeats = 10;
+    OrderingResult result;
+    auto start = std::chrono::steady_clock::now();
+    if(layout==0){
+        Eigen::SparseLU<SpMat, Eigen::COLAMDOrdering<int>> lu;
+        lu.compute(G);
+        result.factorize = elapsed(start);
+        result.succeeded = lu.info()==Eigen::Success;
+        result.entries = (long)(lu.nnzL() + lu.nnzU());
+        result.kib = result.entries*(sizeof(float)+sizeof(int))/1024.0;
+        start = std::chrono::steady_clock::now();
+        for(int r=0;r<repeats;r++) x = lu.solve(b);
+        result.solve = elapsed(start)/repeats;
+    }else if(layout==1){
+        Eigen::SimplicialLDLT<SpMat> ldlt;
+        ldlt.compute(G);
+        result.factorize = elapsed(start);
+        result.succeeded = ldlt.info()==Eigen::Success;
+        result.entries = (long)ldlt.matrixL().nestedExpression().nonZeros() + n;
+        result.kib = (result.entries*(sizeof(float)+sizeof(int)) + (n+1)*sizeof(int))/1024.0;
+        start = std::chrono::steady_clock::now();
+        for(int r=0;r<repeats;r++) x = ldlt.solve(b);
+        result.solve = elapsed(start)/repeats;
+    }else{
+        BlockLDLTBackend block;
+        block.ordering = layout==2 ? BlockLDLTBackend::ReverseCuthillMcKee : BlockLDLTBackend::NestedDissection;
+        block.setTriangles(nv, mesh.numTriangles, mesh.triangles.data(), mesh.ix.data(), mesh.iy.data());
+        block.compute(G);
+        result.factorize = elapsed(start);
+        result.succeeded = block.succeeded();
+        int bs = block.blockSize();
+        result.entries = (long)(block.factorBlocks() + n/bs)*bs*bs;
+        result.kib = block.factorBytes()/1024.0;
+        start = std::chrono::steady_clock::now();
+        for(int r=0;r<repeats;r++) block.solve(b, x);
+        result.solve = elapsed(start)/repeats;
+        // the product in block numbering
+        std::vector<float> z(n), w(n);
+        block.permute(b.data(), z.data());
+        start = std::chrono::steady_clock::now();
+        for(int r=0;r<100;r++) block.multiplyBlocks(z.data(), w.data());
+        result.product = elapsed(start)/100;
+    }
+    if(layout<2){
+        // the product of the split layout (compressed columns of the symmetric matrix)
+        Eigen::VectorXf w(n);
+        start = std::chrono::steady_clock::now();
+        for(int r=0;r<100;r++) w.noalias() = G*b.col(0);
+        result.product = elapsed(start)/100;
+    }
+    result.residual = (G*x - b).norm()/b.norm();
+    return result;
+}
+
+// RGBA test image: an opaque ellipse with hard vertical stripes on a transparent background
+static std::vector<uint8_t> testSprite(int width, int height){
+    std::vector<uint8_t> pixels(4*(size_t)width*height, 0);
+    for(int py=0;py<height;py++){
+        for(int px=0;px<width;px++){
+            float ex = (px+0.5f-width/2.0f)/(0.425f*width), ey = (py+0.5f-height/2.0f)/(0.4f*height);
+            if(ex*ex+ey*ey>=1) continue;
+            uint8_t *p = &pixels[4*((size_t)py*width+px)];
+            p[0] = p[1] = p[2] = (px/(width/10))%2 ? 180 : 60;
+            p[3] = 255;
+        }
+    }
+    return pixels;
+}
+
+struct InterpolationResult {
+    double precompute = 0, factorize = 0, total = 0, perFrame = 0;
+    // deviation of the frames at t=0 and t=1 from the source and target poses
+    double endpointError = 0;
+    bool succeeded = true;
+};
+
+// from the rest pose to the grid twisted by up to half a turn around its centre
+static InterpolationResult interpolate(int grid, int frames){
+    GridMesh mesh(400.0f, 300.0f, grid, grid);
+    std::vector<float> tx(mesh.numVertices), ty(mesh.numVertices);
+    for(int i=0;i<mesh.numVertices;i++){
+        float angle = 3.1415927f*(mesh.ix[i]/mesh.width+0.5f);
+        tx[i] = std::cos(angle)*mesh.ix[i] - std::sin(angle)*mesh.iy[i];
+        ty[i] = std::sin(angle)*mesh.ix[i] + std::cos(angle)*mesh.iy[i];
+    }
+    ShapeInterpolator interpolator;
+    InterpolationResult result;
+    auto start = std::chrono::steady_clock::now();
+    result.succeeded = interpolator.setPoses(mesh.numVertices, mesh.numTriangles, mesh.triangles.data(),
+                                             mesh.ix.data(), mesh.iy.data(), tx.data(), ty.data());
+    result.factorize = interpolator.factorizeTime;
+    result.precompute = elapsed(start) - result.factorize;
+    std::vector<float> x((size_t)frames*mesh.numVertices), y((size_t)frames*mesh.numVertices);
+    start = std::chrono::steady_clock::now();
+    interpolator.frames(frames, x.data(), y.data());
+    result.total = elapsed(start);
+    result.perFrame = result.total/std::max(frames, 1);
+    interpolator.frame(0.0f, mesh.x.data(), mesh.y.data());
+    for(int i=0;i<mesh.numVertices;i++){
+        result.endpointError = std::max(result.endpointError, (double)std::hypot(mesh.x[i]-mesh.ix[i], mesh.y[i]-mesh.iy[i]));
+    }
+    interpolator.frame(1.0f, mesh.x.data(), mesh.y.data());
+    for(int i=0;i<mesh.numVertices;i++){
+        result.endpointError = std::max(result.endpointError, (double)std::hypot(mesh.x[i]-tx[i], mesh.y[i]-ty[i]));
+    }
+    return result;
+}
+
+struct ScalingResult {
+    double localStep = 0, rhs = 0;
+    // the rotations and the right-hand side equal the single-threaded ones bit for bit
+    bool identical = true;
+};
+
+// ARAP local step and right-hand side for the grid twisted as in interpolate(), on the given number of threads
+static ScalingResult arapScaling(int grid, int threads){
+    GridMesh mesh(400.0f, 300.0f, grid, grid);
+    mesh.selected.push_back(mesh.vertex(grid/4, grid/2));
+    mesh.selected.push_back(mesh.vertex(3*grid/4, grid/2));
+    for(int i=0;i<mesh.numVertices;i++){
+        float angle = 3.1415927f*(mesh.ix[i]/mesh.width+0.5f);
+        mesh.x[i] = std::cos(angle)*mesh.ix[i] - std::sin(angle)*mesh.iy[i];
+        mesh.y[i] = std::sin(angle)*mesh.ix[i] + std::cos(angle)*mesh.iy[i];
+    }
+    ArapWorkspace arap;
+    arap.resize(mesh.numVertices, mesh.numTriangles);
+    arap.computePinv(mesh.ix.data(), mesh.iy.data(), mesh.triangles.data());
+    for(int i=0;i<mesh.numVertices;i++) arap.Sol.row(i) << mesh.x[i], mesh.y[i];
+    auto evaluate = [&](int t, double &localStep, double &rhs){
+        parallelConcurrencyLimit() = t;
+        // about 10^7 triangles per timing
+        int repeats = std::max(3, 10000000/mesh.numTriangles);
+        auto start = std::chrono::steady_clock::now();
+        for(int r=0;r<repeats;r++) arap.fitRotations(mesh.triangles.data());
+        localStep = elapsed(start)/repeats;
+        start = std::chrono::steady_clock::now();
+        for(int r=0;r<repeats;r++) arap.formRHS(mesh.triangles.data(), mesh.selected.data(), 2, mesh.x.data(), mesh.y.data());
+        rhs = elapsed(start)/repeats;
+        parallelConcurrencyLimit() = 0;
+    };
+    ScalingResult result;
+    double unused;
+    evaluate(1, unused, unused);
+    std::vector<float> R[4];
+    for(int k=0;k<4;k++) R[k] = arap.R[k];
+    Eigen::MatrixXf U = arap.U;
+    evaluate(threads, result.localStep, result.rhs);
+    for(int k=0;k<4;k++) result.identical = result.identical && R[k]==arap.R[k];
+    result.identical = result.identical && U==arap.U;
+    return result;
+}
+
+// the 30 entries of the Sim energy of a triangle as expanded by Maple, before SimAssembly.h took out the
+// common subexpressions; the reference of --kernels
+template <class S>
+static void expandedSimEnergyEntries(S a, S b, S c, S d, S e, S f, S *v){
+    S detA2 = (a*d-a*f-b*c+b*e+c*f-d*e)*(a*d-a*f-b*c+b*e+c*f-d*e);
+    v[0] = (c*c-2*c*e+d*d-2*d*f+e*e+f*f)/detA2;
+    v[1] = (-a*c+a*e-b*d+b*f+c*e+d*f-e*e-f*f)/detA2;
+    v[2] = (-a*d+a*f+b*c-b*e-c*f+d*e)/detA2;
+    v[3] = (a*c-a*e+b*d-b*f-c*c+c*e-d*d+d*f)/detA2;
+    v[4] = (a*d-a*f-b*c+b*e+c*f-d*e)/detA2;
+    v[5] = (c*c-2*c*e+d*d-2*d*f+e*e+f*f)/detA2;
+    v[6] = (a*d-a*f-b*c+b*e+c*f-d*e)/detA2;
+    v[7] = (-a*c+a*e-b*d+b*f+c*e+d*f-e*e-f*f)/detA2;
+    v[8] = (-a*d+a*f+b*c-b*e-c*f+d*e)/detA2;
+    v[9] = (a*c-a*e+b*d-b*f-c*c+c*e-d*d+d*f)/detA2;
+    v[10] = (-a*c+a*e-b*d+b*f+c*e+d*f-e*e-f*f)/detA2;
+    v[11] = (a*d-a*f-b*c+b*e+c*f-d*e)/detA2;
+    v[12] = (a*a-2*a*e+b*b-2*b*f+e*e+f*f)/detA2;
+    v[13] = (-a*a+a*c+a*e-b*b+b*d+b*f-c*e-d*f)/detA2;
+    v[14] = (-a*d+a*f+b*c-b*e-c*f+d*e)/detA2;
+    v[15] = (-a*d+a*f+b*c-b*e-c*f+d*e)/detA2;
+    v[16] = (-a*c+a*e-b*d+b*f+c*e+d*f-e*e-f*f)/detA2;
+    v[17] = (a*a-2*a*e+b*b-2*b*f+e*e+f*f)/detA2;
+    v[18] = (a*d-a*f-b*c+b*e+c*f-d*e)/detA2;
+    v[19] = (-a*a+a*c+a*e-b*b+b*d+b*f-c*e-d*f)/detA2;
+    v[20] = (a*c-a*e+b*d-b*f-c*c+c*e-d*d+d*f)/detA2;
+    v[21] = (-a*d+a*f+b*c-b*e-c*f+d*e)/detA2;
+    v[22] = (-a*a+a*c+a*e-b*b+b*d+b*f-c*e-d*f)/detA2;
+    v[23] = (a*d-a*f-b*c+b*e+c*f-d*e)/detA2;
+    v[24] = (a*a-2*a*c+b*b-2*b*d+c*c+d*d)/detA2;
+    v[25] = (a*d-a*f-b*c+b*e+c*f-d*e)/detA2;
+    v[26] = (a*c-a*e+b*d-b*f-c*c+c*e-d*d+d*f)/detA2;
+    v[27] = (-a*d+a*f+b*c-b*e-c*f+d*e)/detA2;
+    v[28] = (-a*a+a*c+a*e-b*b+b*d+b*f-c*e-d*f)/detA2;
+    v[29] = (a*a-2*a*c+b*b-2*b*d+c*c+d*d)/detA2;
+}
+
+struct KernelResult {
+    double nsPerTriangle = 0;
+    // largest difference from the expanded expressions in long double, relative to the largest entry of the triangle
+    double maxError = 0;
+};
+
+// the Sim entries of the triangles of the grid, jittered and moved off the origin; width 0 is the expanded form
+template <class S, int W>
+static KernelResult simKernel(int grid, double offset){
+    GridMesh mesh(400.0f, 300.0f, grid, grid);
+    int nt = mesh.numTriangles;
+    std::vector<S> a(nt), b(nt), c(nt), d(nt), e(nt), f(nt);
+    std::vector<long double> reference(30*(size_t)nt);
+    unsigned seed = 12345;
+    auto jitter = [&](){ seed = seed*1664525u + 1013904223u; return ((seed>>8)/16777216.0 - 0.5)*0.6; };
+    std::vector<double> px(mesh.numVertices), py(mesh.numVertices);
+    for(int i=0;i<mesh.numVertices;i++){
+        px[i] = (S)(offset + mesh.ix[i] + jitter()*mesh.width/grid);
+        py[i] = (S)(offset + mesh.iy[i] + jitter()*mesh.height/grid);
+    }
+    for(int i=0;i<nt;i++){
+        const int *t = &mesh.triangles[3*i];
+        a[i] = (S)px[t[0]]; b[i] = (S)py[t[0]];
+        c[i] = (S)px[t[1]]; d[i] = (S)py[t[1]];
+        e[i] = (S)px[t[2]]; f[i] = (S)py[t[2]];
+        expandedSimEnergyEntries<long double>(a[i], b[i], c[i], d[i], e[i], f[i], &reference[30*(size_t)i]);
+    }
+    std::vector<S> v(30*(size_t)nt);
+    KernelResult result;
+    int repeats = std::max(3, 2000000/nt);
+    auto start = std::chrono::steady_clock::now();
+    for(int r=0;r<repeats;r++){
+        if(W==0){
+            for(int i=0;i<nt;i++) expandedSimEnergyEntries<S>(a[i], b[i], c[i], d[i], e[i], f[i], &v[30*(size_t)i]);
+        }else{
+            const int B = W>0 ? W : 1;
+            int i = 0;
+            for(; i+B<=nt; i+=B) simEnergyBatch<S, B>(&a[i], &b[i], &c[i], &d[i], &e[i], &f[i], &v[30*(size_t)i]);
+            for(; i<nt; i++) simEnergyEntries<S>(a[i], b[i], c[i], d[i], e[i], f[i], &v[30*(size_t)i]);
+        }
+    }
+    result.nsPerTriangle = 1e6*elapsed(start)/repeats/nt;
+    for(int i=0;i<nt;i++){
+        double scale = 0, error = 0;
+        for(int k=0;k<30;k++){
+            scale = std::max(scale, (double)std::abs(reference[30*(size_t)i+k]));
+            error = std::max(error, (double)std::abs(v[30*(size_t)i+k] - reference[30*(size_t)i+k]));
+        }
+        result.maxError = std::max(result.maxError, error/scale);
+    }
+    return result;
+}
+
+int main(int argc, char **argv){
+    Options options = parseOptions(argc, argv);
+    if(options.csv){
+        std::printf("grid,mode,backend,dofs,assembly_ms,factorize_ms,frame_ms,max_frame_ms,solve_ms,local_step_ms,rest_error,refinement_bound,arap_iterations,arap_energy,cg_iterations\n");
+    }else{
+        std::printf("%6s %5s %-16s %9s %12s %13s %10s %10s %10s %12s %10s %10s %8s %10s %7s\n",
+                    "grid", "mode", "backend", "DOFs", "assembly ms", "factorize ms", "frame ms", "max ms", "solve ms", "local ms/it", "rest err", "ref bound",
+                    "ARAP it", "energy", "CG it");
+    }
+    for(int grid : options.grids){
+        for(int mode : options.modes){
+            for(SolverBackend::Kind kind : options.backends){
+                int dofs = (mode==DeformationEngine::Sim ? 2 : 1)*(grid+1)*(grid+1);
+                if(kind==SolverBackend::BandedLAPACK && dofs>options.maxBanded) continue;
+                if(kind!=SolverBackend::Multigrid && kind!=SolverBackend::MatrixFreeCG && grid>options.maxDirect) continue;
+                Result r = run(grid, mode, kind, options);
+                const char *modeName = mode==DeformationEngine::Sim ? "Sim" : "ARAP";
+                const char *backendName = SolverBackend::create(kind)->name();
+                if(options.csv){
+                    std::printf("%d,%s,%s,%d,%.4f,%.4f,%.4f,%.4f,%.4f,%.4f,%.6g,%.6g,%.3f,%.6g,%.2f\n", grid, modeName, backendName, r.dofs,
+                                r.assembly, r.factorize, r.frame, r.maxFrame, r.solve, r.localStep, r.restError, r.refinementBound,
+                                r.arapIterations, r.arapEnergy, r.cgIterations);
+                }else{
+                    std::printf("%6d %5s %-16s %9d %12.3f %13.3f %10.3f %10.3f %10.3f %12.3f %10.3g %10.3g %8.2f %10.4g %7.1f%s\n", grid, modeName, backendName, r.dofs,
+                                r.assembly, r.factorize, r.frame, r.maxFrame, r.solve, r.localStep, r.restError, r.refinementBound,
+                                r.arapIterations, r.arapEnergy, r.cgIterations, r.succeeded ? "" : "  (factorization failed)");
+                }
+                std::fflush(stdout);
+            }
+        }
+    }
+    if(!options.scaling.empty()){
+        if(options.csv){
+            std::printf("grid,threads,local_step_ms,rhs_ms,speedup,identical\n");
+        }else{
+            std::printf("\nARAP local step and right-hand side (%d hardware threads)\n", std::max(1u, std::thread::hardware_concurrency()));
+            std::printf("%6s %8s %12s %10s %8s %10s\n", "grid", "threads", "local ms", "rhs ms", "speedup", "identical");
+        }
+        for(int grid : options.grids){
+            double base = 0;
+            for(int threads : options.scaling){
+                ScalingResult r = arapScaling(grid, threads);
+                if(base==0) base = r.localStep + r.rhs;
+                double speedup = base/(r.localStep + r.rhs);
+                if(options.csv){
+                    std::printf("%d,%d,%.4f,%.4f,%.3f,%d\n", grid, threads, r.localStep, r.rhs, speedup, r.identical ? 1 : 0);
+                }else{
+                    std::printf("%6d %8d %12.3f %10.3f %8.2f %10s\n", grid, threads, r.localStep, r.rhs, speedup, r.identical ? "yes" : "NO");
+                }
+                std::fflush(stdout);
+            }
+        }
+    }
+    if(!options.adaptive.empty()){
+        // the same drag, with handles at the same places, on both meshes of a 400x300 pixel sprite
+        int minCell = options.adaptive[0], maxCell = options.adaptive[1];
+        std::vector<uint8_t> pixels = testSprite(400, 300);
+        ImageRasterizer::Image image;
+        image.pixels = pixels.data();
+        image.width = 400;
+        image.height = 300;
+        image.stride = 4*400;
+        AdaptiveMesh::Options meshOptions;
+        meshOptions.minCell = minCell;
+        meshOptions.maxCell = maxCell;
+        auto start = std::chrono::steady_clock::now();
+        AdaptiveMesh adaptive(image, 400.0f, 300.0f, meshOptions);
+        double build = elapsed(start);
+        GridMesh uniform(400.0f, 300.0f, 300/minCell, 400/minCell);
+        if(options.csv){
+            std::printf("mesh,mode,backend,vertices,dofs,factorize_ms,frame_ms,rest_error\n");
+        }else{
+            std::printf("\nadaptive mesh of a 400x300 sprite, cells of %d to %d pixels: %d vertices, built in %.1f ms;"
+                        " uniform grid of %d-pixel cells: %d vertices (%.1fx)\n", minCell, maxCell, adaptive.numVertices, build,
+                        minCell, uniform.numVertices, (double)uniform.numVertices/std::max(adaptive.numVertices, 1));
+            std::printf("%9s %5s %-16s %9s %13s %10s %10s\n", "mesh", "mode", "backend", "DOFs", "factorize ms", "frame ms", "rest err");
+        }
+        for(int mode : options.modes){
+            for(SolverBackend::Kind kind : options.backends){
+                for(int k=0;k<2;k++){
+                    const char *meshName = k==0 ? "uniform" : "adaptive";
+                    Result r;
+                    int numVertices;
+                    if(k==0){
+                        uniform.initialize();
+                        uniform.selected = {nearestVertex(uniform, -100.0f, 0.0f), nearestVertex(uniform, 100.0f, 0.0f)};
+                        if(kind==SolverBackend::BandedLAPACK && (mode==DeformationEngine::Sim ? 2 : 1)*uniform.numVertices>options.maxBanded) continue;
+                        r = drag(uniform, mode, kind, options);
+                        numVertices = uniform.numVertices;
+                    }else{
+                        adaptive.initialize();
+                        adaptive.selected = {nearestVertex(adaptive, -100.0f, 0.0f), nearestVertex(adaptive, 100.0f, 0.0f)};
+                        if(kind==SolverBackend::BandedLAPACK && (mode==DeformationEngine::Sim ? 2 : 1)*adaptive.numVertices>options.maxBanded) continue;
+                        r = drag(adaptive, mode, kind, options);
+                        numVertices = adaptive.numVertices;
+                    }
+                    const char *modeName = mode==DeformationEngine::Sim ? "Sim" : "ARAP";
+                    const char *backendName = SolverBackend::create(kind)->name();
+                    if(options.csv){
+                        std::printf("%s,%s,%s,%d,%d,%.4f,%.4f,%.6g\n", meshName, modeName, backendName, numVertices, r.dofs,
+                                    r.factorize, r.frame, r.restError);
+                    }else{
+                        std::printf("%9s %5s %-16s %9d %13.3f %10.3f %10.3g%s\n", meshName, modeName, backendName, r.dofs,
+                                    r.factorize, r.frame, r.restError, r.succeeded ? "" : "  (factorization failed)");
+                    }
+                    std::fflush(stdout);
+                }
+            }
+        }
+    }
+    if(options.orderings){
+        static const char *layoutNames[] = {"split COLAMD LU", "split AMD LDLT", "2x2 RCM", "2x2 ND"};
+        if(options.csv){
+            std::printf("grid,mode,layout,dofs,factor_entries,factor_kib,factorize_ms,solve_ms,product_ms,residual\n");
+        }else{
+            std::printf("\nfactor size and times by DOF layout and ordering (two handles eliminated)\n");
+            std::printf("%6s %5s %-16s %9s %13s %11s %13s %10s %11s %10s\n", "grid", "mode", "layout", "DOFs", "factor nnz",
+                        "factor KiB", "factorize ms", "solve ms", "product ms", "residual");
+        }
+        for(int grid : options.grids){
+            if(grid>options.maxDirect) continue;
+            for(int mode : options.modes){
+                for(int layout=0;layout<4;layout++){
+                    OrderingResult r = compareOrdering(grid, mode, layout);
+                    const char *modeName = mode==DeformationEngine::Sim ? "Sim" : "ARAP";
+                    int dofs = (mode==DeformationEngine::Sim ? 2 : 1)*(grid+1)*(grid+1);
+                    if(options.csv){
+                        std::printf("%d,%s,%s,%d,%ld,%.1f,%.4f,%.4f,%.4f,%.3g\n", grid, modeName, layoutNames[layout], dofs, r.entries,
+                                    r.kib, r.factorize, r.solve, r.product, r.residual);
+                    }else{
+                        std::printf("%6d %5s %-16s %9d %13ld %11.1f %13.3f %10.3f %11.4f %10.2g%s\n", grid, modeName, layoutNames[layout], dofs,
+                                    r.entries, r.kib, r.factorize, r.solve, r.product, r.residual, r.succeeded ? "" : "  (factorization failed)");
+                    }
+                    std::fflush(stdout);
+                }
+            }
+        }
+    }
+    if(options.prefactored){
+        if(options.csv){
+            std::printf("grid,mode,backend,path,touch_down_ms,handle_change_ms,frame_ms,max_deviation\n");
+        }else{
+            std::printf("\nhandle changes: rest pose factorised once (Schur complement) against refactorization per touch\n");
+            std::printf("%6s %5s %-16s %-13s %14s %16s %10s %10s\n", "grid", "mode", "backend", "path", "touch down ms",
+                        "handle change ms", "frame ms", "max dev");
+        }
+        for(int grid : options.grids){
+            if(grid>options.maxDirect) continue;
+            for(int mode : options.modes){
+                for(SolverBackend::Kind kind : options.backends){
+                    int dofs = (mode==DeformationEngine::Sim ? 2 : 1)*(grid+1)*(grid+1);
+                    if(kind==SolverBackend::BandedLAPACK && dofs>options.maxBanded) continue;
+                    // the same drag on both paths; the deviation is that of the prefactored vertices from the refactorised ones
+                    std::vector<float> x[2], y[2];
+                    for(int path=0;path<2;path++){
+                        HandleChangeResult r = handleChanges(grid, mode, kind, path==1, options, x[path], y[path]);
+                        double deviation = 0;
+                        for(size_t i=0;path==1 && i<x[1].size();i++){
+                            deviation = std::max(deviation, (double)std::hypot(x[1][i]-x[0][i], y[1][i]-y[0][i]));
+                        }
+                        const char *modeName = mode==DeformationEngine::Sim ? "Sim" : "ARAP";
+                        const char *pathName = path==1 ? "prefactored" : "refactorize";
+                        const char *backendName = SolverBackend::create(kind)->name();
+                        if(options.csv){
+                            std::printf("%d,%s,%s,%s,%.4f,%.4f,%.4f,%.6g\n", grid, modeName, backendName, pathName,
+                                        r.touchDown, r.handleChange, r.frame, deviation);
+                        }else{
+                            std::printf("%6d %5s %-16s %-13s %14.3f %16.3f %10.3f %10.3g%s\n", grid, modeName, backendName, pathName,
+                                        r.touchDown, r.handleChange, r.frame, deviation, r.succeeded ? "" : "  (factorization failed)");
+                        }
+                        std::fflush(stdout);
+                    }
+                }
+            }
+        }
+    }
+    if(options.kernels){
+        static const char *kernelNames[] = {"expanded", "batch 1", "batch 4", "batch 8"};
+        if(options.csv){
+            std::printf("grid,offset,kernel,scalar,ns_per_triangle,max_relative_error\n");
+        }else{
+            std::printf("\nSim triangle kernels against the expanded expressions in long double (jittered grid, offset from the origin)\n");
+            std::printf("%6s %8s %-10s %7s %8s %12s\n", "grid", "offset", "kernel", "scalar", "ns/tri", "max rel err");
+        }
+        for(int grid : options.grids){
+            if(grid>options.maxDirect) continue;
+            for(double offset : {0.0, 10000.0}){
+                for(int scalar=0;scalar<2;scalar++){
+                    for(int k=0;k<4;k++){
+                        KernelResult r;
+                        if(scalar==0){
+                            r = k==0 ? simKernel<float, 0>(grid, offset) : k==1 ? simKernel<float, 1>(grid, offset)
+                              : k==2 ? simKernel<float, 4>(grid, offset) : simKernel<float, 8>(grid, offset);
+                        }else{
+                            r = k==0 ? simKernel<double, 0>(grid, offset) : k==1 ? simKernel<double, 1>(grid, offset)
+                              : k==2 ? simKernel<double, 4>(grid, offset) : simKernel<double, 8>(grid, offset);
+                        }
+                        const char *scalarName = scalar==0 ? "float" : "double";
+                        if(options.csv){
+                            std::printf("%d,%g,%s,%s,%.3f,%.3g\n", grid, offset, kernelNames[k], scalarName, r.nsPerTriangle, r.maxError);
+                        }else{
+                            std::printf("%6d %8g %-10s %7s %8.2f %12.3g\n", grid, offset, kernelNames[k], scalarName, r.nsPerTriangle, r.maxError);
+                        }
+                        std::fflush(stdout);
+                    }
+                }
+            }
+        }
+    }
+    if(options.interpolate<=0) return 0;
+    if(options.csv){
+        std::printf("grid,frames,precompute_ms,factorize_ms,total_ms,frame_ms,endpoint_error\n");
+    }else{
+        std::printf("\nshape interpolation, %d in-between frames on %d threads\n", options.interpolate, parallelConcurrency());
+        std::printf("%6s %14s %13s %10s %10s %10s\n", "grid", "precompute ms", "factorize ms", "total ms", "frame ms", "end err");
+    }
+    for(int grid : options.grids){
+        if(grid>options.maxDirect) continue;
+        InterpolationResult r = interpolate(grid, options.interpolate);
+        if(options.csv){
+            std::printf("%d,%d,%.4f,%.4f,%.4f,%.4f,%.6g\n", grid, options.interpolate, r.precompute, r.factorize, r.total, r.perFrame, r.endpointError);
+        }else{
+            std::printf("%6d %14.3f %13.3f %10.3f %10.3f %10.3g%s\n", grid, r.precompute, r.factorize, r.total, r.perFrame, r.endpointError,
+                        r.succeeded ? "" : "  (factorization failed)");
+        }
+        std::fflush(stdout);
+    }
+    return 0;
+}
@@ -0,0 +1,229 @@
+//
+//  replay.cpp
+//  iPad-SimEnergy
+//
+//  Headless replay of a touch trace recorded by AsyncSolver (see TouchTrace.h).
+//  The requests go through the same worker and engine code as in the app, one
+//  at a time, either as fast as possible or at the recorded times. Reports the
+//  latency of the drag frames and of the touch down/up rebuilds, and compares
+//  the vertices with every checkpoint of the trace bit for bit.
+//
+//  usage: simenergy_replay trace.setr [--realtime] [--backend LDLT|LU|Cholesky|Multigrid|BandedLAPACK|MatrixFreeCG|BlockLDLT]
+//             [--profile frames.json]
+//
+//  With --backend the recorded backend changes are overridden; the vertices
+//  then differ from the checkpoints, which are only reported. --profile
+//  (built with PROFILE_FRAMES) writes the stages of the replayed frames as a
+//  Chrome trace and prints their latencies (see FrameProfiler.h).
+//
+
+#include "AsyncSolver.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <thread>
+
+static void usage(const char *program){
+    std::fprintf(stderr, "usage: %s trace.setr [--realtime] [--backend LDLT|LU|Cholesky|Multigrid|BandedLAPACK|MatrixFreeCG|BlockLDLT]\n"
+                 "       [--profile frames.json]\n", program);
+    std::exit(1);
+}
+
+// latencies in milliseconds, with power-of-two buckets from 1/8 ms
+class Histogram {
+public:
+    void add(double ms){ samples.push_back(ms); }
+
+    void print(const char *title){
+        if(samples.empty()) return;
+        std::sort(samples.begin(), samples.end());
+        double sum = 0;
+        for(double s : samples) sum += s;
+        std::printf("%s: %zu, mean %.3f ms, p50 %.3f, p95 %.3f, p99 %.3f, max %.3f ms\n", title, samples.size(),
+                    sum/samples.size(), percentile(0.5), percentile(0.95), percentile(0.99), samples.back());
+        const int BUCKETS = 14;
+        size_t counts[BUCKETS] = {};
+        for(double s : samples){
+            int b = s<=0.125 ? 0 : std::min(BUCKETS-1, (int)std::ceil(std::log2(s/0.125)));
+            counts[b]++;
+        }
+        size_t most = *std::max_element(counts, counts+BUCKETS);
+        for(int b=0;b<BUCKETS;b++){
+            if(counts[b]==0) continue;
+            std::printf("  %s %9.3f ms %7zu  %s\n", b<BUCKETS-1 ? "<=" : "> ", 0.125*std::ldexp(1.0, b<BUCKETS-1 ? b : b-1), counts[b],
+                        std::string((size_t)std::ceil(40.0*counts[b]/most), '#').c_str());
+        }
+    }
+
+private:
+    double percentile(double p) const { return samples[std::min(samples.size()-1, (size_t)(p*samples.size()))]; }
+    std::vector<double> samples;
+};
+
+int main(int argc, char **argv){
+    const char *path = nullptr;
+    // set by --profile, which only builds with PROFILE_FRAMES accept
+    [[maybe_unused]] const char *profilePath = nullptr;
+    bool realtime = false, overrideBackend = false;
+    SolverBackend::Kind backend = SolverBackend::LDLT;
+    for(int a=1;a<argc;a++){
+        if(!std::strcmp(argv[a], "--realtime")){
+            realtime = true;
+        }else if(!std::strcmp(argv[a], "--backend") && a+1<argc){
+            if(!SolverBackend::parse(argv[++a], backend)) usage(argv[0]);
+            overrideBackend = true;
+        }else if(!std::strcmp(argv[a], "--profile") && a+1<argc){
+            profilePath = argv[++a];
+#ifndef PROFILE_FRAMES
+            std::fprintf(stderr, "--profile: built without PROFILE_FRAMES (configure with -DSIMENERGY_PROFILE=ON)\n");
+            return 1;
+#endif
+        }else if(argv[a][0]!='-' && !path){
+            path = argv[a];
+        }else{
+            usage(argv[0]);
+        }
+    }
+    if(!path) usage(argv[0]);
+    TouchTrace::Reader reader;
+    if(!reader.open(path)){
+        std::fprintf(stderr, "%s: not a touch trace\n", path);
+        return 1;
+    }
+
+    AsyncSolver solver;
+    // the mesh of the session; drags read the handle positions from x and y
+    DeformationMesh mesh;
+    std::vector<float> x, y, ix, iy;
+    std::vector<int> triangles, selected;
+    Histogram drags, rebuilds;
+    int records = 0, checkpoints = 0, mismatches = 0;
+    auto start = std::chrono::steady_clock::now();
+    TouchTrace::Record record;
+    while(reader.next(record)){
+        records++;
+        if(realtime){
+            std::this_thread::sleep_until(start + std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double>(record.time)));
+        }
+        switch(record.type){
+            case TouchTrace::Mesh: {
+                mesh.horizontalDivisions = record.nextInt();
+                mesh.verticalDivisions = record.nextInt();
+                int nv = record.nextInt(), nt = record.nextInt();
+                const float *px = record.nextFloats(nv), *py = record.nextFloats(nv);
+                const float *pix = record.nextFloats(nv), *piy = record.nextFloats(nv);
+                const int *pt = record.nextInts(3*(size_t)nt);
+                if(!pt) break;
+                x.assign(px, px+nv); y.assign(py, py+nv);
+                ix.assign(pix, pix+nv); iy.assign(piy, piy+nv);
+                triangles.assign(pt, pt+3*nt);
+                selected.assign(nv, 0);
+                mesh.numVertices = nv;
+                mesh.numTriangles = nt;
+                mesh.x = x.data(); mesh.y = y.data();
+                mesh.ix = ix.data(); mesh.iy = iy.data();
+                mesh.triangles = triangles.data();
+                mesh.selected = selected.data();
+                solver.setMesh(mesh);
+                if(overrideBackend) solver.setSolverBackend(backend, 20);
+                std::printf("mesh: %d x %d grid, %d vertices\n", mesh.horizontalDivisions, mesh.verticalDivisions, nv);
+                break;
+            }
+            case TouchTrace::Reset: {
+                int nv = record.nextInt();
+                const float *px = record.nextFloats(nv), *py = record.nextFloats(nv);
+                const float *pix = record.nextFloats(nv), *piy = record.nextFloats(nv);
+                if(!piy || nv!=mesh.numVertices) break;
+                std::copy(px, px+nv, x.begin()); std::copy(py, py+nv, y.begin());
+                std::copy(pix, pix+nv, ix.begin()); std::copy(piy, piy+nv, iy.begin());
+                solver.reset(mesh);
+                break;
+            }
+            case TouchTrace::Backend: {
+                int kind = record.nextInt(), cycles = record.nextInt(), refinement = record.nextInt();
+                bool handleBasis = record.nextInt()!=0;
+                solver.setSolverBackend(overrideBackend ? backend : (SolverBackend::Kind)kind, cycles, refinement, handleBasis);
+                double arapBudget = record.nextDouble(), arapTolerance = record.nextDouble();
+                solver.setArapBudget(arapBudget, arapTolerance>0 ? arapTolerance : 1e-4);
+                break;
+            }
+            case TouchTrace::Structural:
+            case TouchTrace::Drag: {
+                AsyncSolver::Settings settings;
+                settings.mode = record.nextInt();
+                settings.iteration = record.nextInt();
+                settings.prefactored = record.nextInt()!=0;
+                bool structural = record.type==TouchTrace::Structural;
+                bool invalidate = structural && record.nextInt()!=0;
+                int n = record.nextInt();
+                const int *ps = record.nextInts(n);
+                const float *hx = structural ? nullptr : record.nextFloats(n);
+                const float *hy = structural ? nullptr : record.nextFloats(n);
+                if(!ps || n>mesh.numVertices || (!structural && !hy)) break;
+                if(!structural){
+                    // the rounds the recorded frame took within its budget; a frame that converged stops at the
+                    // tolerance again, so it only needs a bound it does not reach
+                    int rounds = record.nextInt();
+                    bool converged = record.nextInt()!=0;
+                    settings.arapRounds = converged ? rounds+1 : rounds;
+                }
+                std::copy(ps, ps+n, selected.begin());
+                if(structural){
+                    solver.postStructural(settings, selected.data(), n, invalidate);
+                }else{
+                    for(int k=0;k<n;k++){
+                        x[ps[k]] = hx[k];
+                        y[ps[k]] = hy[k];
+                    }
+                    solver.post(settings, selected.data(), n, x.data(), y.data());
+                }
+                // one request at a time, so that none is superseded
+                solver.finish();
+                (structural ? rebuilds : drags).add(solver.statistics().latency);
+                break;
+            }
+            case TouchTrace::Checkpoint: {
+                int nv = record.nextInt();
+                const float *px = record.nextFloats(nv), *py = record.nextFloats(nv);
+                if(!py || nv!=mesh.numVertices) break;
+                solver.acquire();
+                const AsyncSolver::Frame &frame = solver.frame();
+                checkpoints++;
+                if(std::memcmp(px, frame.x.data(), nv*sizeof(float)) || std::memcmp(py, frame.y.data(), nv*sizeof(float))){
+                    float diff = 0;
+                    for(int i=0;i<nv;i++){
+                        diff = std::max(diff, std::max(std::abs(px[i]-frame.x[i]), std::abs(py[i]-frame.y[i])));
+                    }
+                    std::printf("checkpoint %d at %.3f s differs: max deviation %g\n", checkpoints, record.time, diff);
+                    mismatches++;
+                }
+                break;
+            }
+            default:
+                break;
+        }
+    }
+    double total = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    AsyncSolver::Statistics stats = solver.statistics();
+    std::printf("%d records replayed in %.3f s (%s), backend %s\n", records, total, realtime ? "real time" : "as fast as possible", stats.backend);
+    drags.print("drag frames");
+    rebuilds.print("touch down/up");
+#ifdef PROFILE_FRAMES
+    if(profilePath){
+        FrameProfiler::printSummary(stdout);
+        if(!FrameProfiler::writeChromeTrace(profilePath)) std::fprintf(stderr, "%s: cannot write the profile\n", profilePath);
+    }
+#endif
+    if(checkpoints==0){
+        std::printf("no checkpoints in the trace\n");
+    }else if(mismatches==0){
+        std::printf("all %d checkpoints bit-identical\n", checkpoints);
+    }else{
+        std::printf("%d of %d checkpoints differ%s\n", mismatches, checkpoints, overrideBackend ? " (backend overridden)" : "");
+    }
+    return mismatches>0 && !overrideBackend ? 2 : 0;
+}
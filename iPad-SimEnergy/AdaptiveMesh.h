@@ -0,0 +1,318 @@
+//
+//  AdaptiveMesh.h
+//  iPad-SimEnergy
+//
+//  A triangulation that follows the content of the image, as an alternative
+//  to the uniform grid of ImageMesh: it covers only the foreground (alpha)
+//  and is dense along the outline and the edges of the picture, sparse in
+//  flat areas, so the solvers see far fewer DOFs for the same detail.
+//
+//  The image is cut into cells of about maxCell pixels, which are split as a
+//  quadtree down to minCell pixels while they straddle the outline or hold
+//  edges (the luminance gradient above a noise floor, summed over the cell
+//  per pixel of its side, exceeds detailThreshold). Cells without foreground are dropped. The tree
+//  is balanced so that neighbouring cells differ by one level at most; a cell
+//  is then two triangles, or a fan around its centre when a finer neighbour
+//  puts a vertex on its side, so the triangulation is conforming. Only the
+//  largest edge-connected piece is kept, since the energies of pieces
+//  without a handle would be singular.
+//
+//  The arrays have the layout of GridMesh (vertex 0 is the lower left one),
+//  with no grid structure (horizontalDivisions = verticalDivisions = 0) and
+//  the texture coordinates of every vertex in u and v (origin at the lower left).
+//
+
+#ifndef AdaptiveMesh_h
+#define AdaptiveMesh_h
+
+#include "DeformationEngine.h"
+#include "ImageRasterizer.h"
+#include <algorithm>
+#include <cmath>
+#include <unordered_map>
+#include <unordered_set>
+
+class AdaptiveMesh {
+public:
+    struct Options {
+        // edge lengths of the cells in pixels of the image: in flat areas, and along the outline and edges
+        int maxCell = 32, minCell = 4;
+        // alpha (0-255) above which a pixel is foreground
+        int alphaThreshold = 8;
+        // per-pixel luminance gradient (|dx|+|dy|, 0-510) below which a pixel counts as flat (noise, shading)
+        int gradientFloor = 16;
+        // a cell is split while the gradient above the floor, summed and divided by its side in pixels, exceeds this
+        float detailThreshold = 32;
+    };
+
+    int horizontalDivisions = 0, verticalDivisions = 0;
+    int numVertices = 0, numTriangles = 0;
+    float width, height;
+    // longest edge of a cell in mesh coordinates (for picking)
+    float maxEdge = 0;
+    std::vector<float> x, y, ix, iy, u, v;
+    std::vector<int> triangles, selected;
+
+    // the mesh spans width x height centred at the origin, as ImageMesh, over the whole image
+    AdaptiveMesh(const ImageRasterizer::Image &image, float width, float height, const Options &options)
+    : width(width), height(height){
+        build(image, options);
+        x.resize(numVertices);
+        y.resize(numVertices);
+        ix.resize(numVertices);
+        iy.resize(numVertices);
+        selected.reserve(numVertices);
+        initialize();
+    }
+    AdaptiveMesh(const ImageRasterizer::Image &image, float width, float height)
+    : AdaptiveMesh(image, width, height, Options()){}
+
+    // rest pose centred at the origin; no vertex is selected
+    void initialize(){
+        for(int k=0;k<numVertices;k++){
+            x[k] = ix[k] = u[k]*width - width/2;
+            y[k] = iy[k] = v[k]*height - height/2;
+        }
+        selected.clear();
+    }
+
+    // arrays for DeformationEngine::setMesh; valid while the mesh lives and selected is not reallocated
+    DeformationMesh view(){
+        DeformationMesh m;
+        m.horizontalDivisions = 0;
+        m.verticalDivisions = 0;
+        m.numVertices = numVertices;
+        m.numTriangles = numTriangles;
+        m.x = x.data();
+        m.y = y.data();
+        m.ix = ix.data();
+        m.iy = iy.data();
+        m.triangles = triangles.data();
+        m.selected = selected.data();
+        m.numSelected = (int)selected.size();
+        return m;
+    }
+
+private:
+    // a quadtree cell: level 0 is a root cell, (i, j) counts cells of its level from the top left
+    struct Cell {
+        int level, i, j;
+    };
+
+    // lattice of the finest cells: NX x NY cells, roots of 2^depth x 2^depth lattice cells
+    int NX = 0, NY = 0, depth = 0;
+    // summed-area tables of the foreground pixels and of the gradient, (pw+1) x (ph+1)
+    int pw = 0, ph = 0;
+    std::vector<int> foreground;
+    std::vector<double> gradient;
+
+    static long long cellKey(int level, int i, int j){
+        return ((long long)level<<48) | ((long long)j<<24) | i;
+    }
+    long long pointKey(int i, int j) const { return (long long)j*(NX+1)+i; }
+
+    template <class V>
+    V area(const std::vector<V> &table, int x0, int y0, int x1, int y1) const{
+        return table[y1*(pw+1)+x1] - table[y0*(pw+1)+x1] - table[y1*(pw+1)+x0] + table[y0*(pw+1)+x0];
+    }
+
+    void computeTables(const ImageRasterizer::Image &image, int alphaThreshold, int gradientFloor){
+        pw = image.width;
+        ph = image.height;
+        auto luminance = [&](int px, int py){
+            const uint8_t *p = image.pixels + py*image.stride + 4*(size_t)px;
+            return (77*p[0] + 150*p[1] + 29*p[2]) >> 8;
+        };
+        foreground.assign((size_t)(pw+1)*(ph+1), 0);
+        gradient.assign((size_t)(pw+1)*(ph+1), 0.0);
+        for(int py=0;py<ph;py++){
+            int rowCount = 0;
+            double rowSum = 0;
+            for(int px=0;px<pw;px++){
+                int l = luminance(px, py);
+                int g = std::abs((px+1<pw ? luminance(px+1, py) : l) - l) + std::abs((py+1<ph ? luminance(px, py+1) : l) - l);
+                rowCount += image.pixels[py*image.stride + 4*(size_t)px + 3] > alphaThreshold;
+                rowSum += std::max(0, g-gradientFloor);
+                foreground[(py+1)*(pw+1)+px+1] = foreground[py*(pw+1)+px+1] + rowCount;
+                gradient[(py+1)*(pw+1)+px+1] = gradient[py*(pw+1)+px+1] + rowSum;
+            }
+        }
+        // a fully transparent image is taken as opaque
+        if(foreground.back()==0){
+            for(int py=0;py<=ph;py++){
+                for(int px=0;px<=pw;px++) foreground[py*(pw+1)+px] = px*py;
+            }
+        }
+    }
+
+    // pixel rectangle of the lattice interval [i0, i1) x [j0, j1), at least one pixel wide
+    void pixelRect(int i0, int j0, int i1, int j1, int &x0, int &y0, int &x1, int &y1) const{
+        x0 = std::min(pw-1, (int)((long long)i0*pw/NX));
+        y0 = std::min(ph-1, (int)((long long)j0*ph/NY));
+        x1 = std::max(x0+1, (int)((long long)i1*pw/NX));
+        y1 = std::max(y0+1, (int)((long long)j1*ph/NY));
+    }
+
+    void build(const ImageRasterizer::Image &image, const Options &options){
+        computeTables(image, options.alphaThreshold, options.gradientFloor);
+        int minCell = std::max(1, options.minCell), maxCell = std::max(minCell, options.maxCell);
+        while((minCell<<(depth+1))<=maxCell) depth++;
+        // root cells of about maxCell pixels that tile the image exactly
+        int columns = std::max(1, (int)std::lround((double)pw/(minCell<<depth)));
+        int rows = std::max(1, (int)std::lround((double)ph/(minCell<<depth)));
+        NX = columns<<depth;
+        NY = rows<<depth;
+        maxEdge = std::max(width/columns, height/rows);
+
+        // refinement by content
+        std::unordered_set<long long> internal;
+        std::vector<Cell> leaves, stack;
+        for(int j=0;j<rows;j++){
+            for(int i=0;i<columns;i++) stack.push_back({0, i, j});
+        }
+        while(!stack.empty()){
+            Cell c = stack.back();
+            stack.pop_back();
+            int s = 1<<(depth-c.level), x0, y0, x1, y1;
+            pixelRect(c.i*s, c.j*s, (c.i+1)*s, (c.j+1)*s, x0, y0, x1, y1);
+            int covered = area(foreground, x0, y0, x1, y1);
+            if(covered==0) continue;
+            bool outline = covered<(x1-x0)*(y1-y0);
+            double detail = area(gradient, x0, y0, x1, y1)/std::max(x1-x0, y1-y0);
+            if(c.level<depth && (outline || detail>options.detailThreshold)){
+                internal.insert(cellKey(c.level, c.i, c.j));
+                for(int k=0;k<4;k++) stack.push_back({c.level+1, 2*c.i+(k&1), 2*c.j+(k>>1)});
+            }else{
+                leaves.push_back(c);
+            }
+        }
+
+        // balance: a leaf next to a split cell of the next level is split as well (keeping all four children)
+        static const int side[4][2] = {{-1, 0}, {1, 0}, {0, -1}, {0, 1}};
+        for(bool changed=true;changed;){
+            changed = false;
+            std::vector<Cell> next;
+            next.reserve(leaves.size());
+            for(const Cell &c : leaves){
+                bool split = false;
+                for(int d=0;d<4 && !split && c.level+1<depth;d++){
+                    int ni = c.i+side[d][0], nj = c.j+side[d][1];
+                    if(ni<0 || nj<0) continue;
+                    // the two children of the neighbour along the shared side
+                    for(int k=0;k<2 && !split;k++){
+                        int ci = 2*ni + (side[d][0]!=0 ? (side[d][0]<0 ? 1 : 0) : k);
+                        int cj = 2*nj + (side[d][1]!=0 ? (side[d][1]<0 ? 1 : 0) : k);
+                        split = internal.count(cellKey(c.level+1, ci, cj))>0;
+                    }
+                }
+                if(split){
+                    internal.insert(cellKey(c.level, c.i, c.j));
+                    for(int k=0;k<4;k++) next.push_back({c.level+1, 2*c.i+(k&1), 2*c.j+(k>>1)});
+                    changed = true;
+                }else{
+                    next.push_back(c);
+                }
+            }
+            leaves.swap(next);
+        }
+
+        // corners of the leaves, then the triangles; vertices are numbered by lattice point for now
+        std::unordered_map<long long, int> points;
+        std::vector<int> pi, pj;
+        auto point = [&](int i, int j){
+            auto inserted = points.insert({pointKey(i, j), (int)pi.size()});
+            if(inserted.second){
+                pi.push_back(i);
+                pj.push_back(j);
+            }
+            return inserted.first->second;
+        };
+        for(const Cell &c : leaves){
+            int s = 1<<(depth-c.level);
+            point(c.i*s, c.j*s); point((c.i+1)*s, c.j*s);
+            point(c.i*s, (c.j+1)*s); point((c.i+1)*s, (c.j+1)*s);
+        }
+        std::vector<int> tri;
+        tri.reserve(8*leaves.size());
+        for(const Cell &c : leaves){
+            int s = 1<<(depth-c.level), i0 = c.i*s, j0 = c.j*s, h = s/2;
+            // boundary counterclockwise on screen (j grows downwards): top left, bottom left, bottom right, top right,
+            // with the midpoints of the sides that carry a vertex of a finer neighbour
+            int corner[4][2] = {{i0, j0}, {i0, j0+s}, {i0+s, j0+s}, {i0+s, j0}};
+            int middle[4][2] = {{i0, j0+h}, {i0+h, j0+s}, {i0+s, j0+h}, {i0+h, j0}};
+            std::vector<int> ring;
+            bool hanging = false;
+            for(int k=0;k<4;k++){
+                ring.push_back(points[pointKey(corner[k][0], corner[k][1])]);
+                auto m = s>1 ? points.find(pointKey(middle[k][0], middle[k][1])) : points.end();
+                if(m!=points.end()){
+                    ring.push_back(m->second);
+                    hanging = true;
+                }
+            }
+            if(!hanging){
+                tri.insert(tri.end(), {ring[0], ring[1], ring[2], ring[0], ring[2], ring[3]});
+                continue;
+            }
+            int centre = point(i0+h, j0+h);
+            for(size_t k=0;k<ring.size();k++){
+                tri.insert(tri.end(), {centre, ring[k], ring[(k+1)%ring.size()]});
+            }
+        }
+
+        // largest edge-connected piece (union-find on the triangles)
+        int nt = (int)tri.size()/3;
+        std::vector<int> parent(nt);
+        for(int t=0;t<nt;t++) parent[t] = t;
+        auto find = [&](int t){
+            while(parent[t]!=t) t = parent[t] = parent[parent[t]];
+            return t;
+        };
+        std::unordered_map<long long, int> edges;
+        edges.reserve(3*nt);
+        for(int t=0;t<nt;t++){
+            for(int k=0;k<3;k++){
+                int a = tri[3*t+k], b = tri[3*t+(k+1)%3];
+                auto inserted = edges.insert({(long long)std::min(a, b)*(long long)pi.size() + std::max(a, b), t});
+                if(!inserted.second) parent[find(t)] = find(inserted.first->second);
+            }
+        }
+        std::vector<int> pieceSize(nt, 0);
+        int largest = 0;
+        for(int t=0;t<nt;t++){
+            int r = find(t);
+            if(++pieceSize[r]>pieceSize[largest]) largest = r;
+        }
+
+        // vertices of that piece, bottom row first and left to right as in GridMesh
+        std::vector<int> order;
+        std::vector<char> used(pi.size(), 0);
+        for(int t=0;t<nt;t++){
+            if(find(t)!=largest) continue;
+            for(int k=0;k<3;k++) used[tri[3*t+k]] = 1;
+        }
+        for(int p=0;p<(int)pi.size();p++){
+            if(used[p]) order.push_back(p);
+        }
+        std::sort(order.begin(), order.end(), [&](int a, int b){
+            return pj[a]!=pj[b] ? pj[a]>pj[b] : pi[a]<pi[b];
+        });
+        std::vector<int> index(pi.size(), -1);
+        numVertices = (int)order.size();
+        u.resize(numVertices);
+        v.resize(numVertices);
+        for(int k=0;k<numVertices;k++){
+            index[order[k]] = k;
+            u[k] = (float)pi[order[k]]/NX;
+            v[k] = 1.0f - (float)pj[order[k]]/NY;
+        }
+        triangles.clear();
+        for(int t=0;t<nt;t++){
+            if(find(t)!=largest) continue;
+            for(int k=0;k<3;k++) triangles.push_back(index[tri[3*t+k]]);
+        }
+        numTriangles = (int)triangles.size()/3;
+    }
+};
+
+#endif /* AdaptiveMesh_h */
@@ -0,0 +1,69 @@
+//
+//  AllocationCounter.h
+//  iPad-SimEnergy
+//
+//  Debug counter of heap allocations, used to check that a steady-state drag
+//  frame does not allocate. Enabled by defining DEBUG_ALLOCATIONS; otherwise
+//  count() stays zero and nothing is hooked.
+//
+//  Counted are global operator new (std containers, Eigen sparse storage)
+//  and the heap allocations of Eigen dense objects, which Eigen makes with
+//  malloc. The latter are caught with EIGEN_RUNTIME_NO_MALLOC: once
+//  Eigen::internal::set_is_malloc_allowed(false) has been called, every such
+//  allocation trips an assertion that is counted instead of aborting.
+//  The header has to be included before any Eigen header, and exactly one
+//  translation unit defines ALLOCATION_COUNTER_IMPLEMENTATION to provide the
+//  replacement operator new.
+//
+
+#ifndef AllocationCounter_h
+#define AllocationCounter_h
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+struct AllocationCounter {
+    // number of allocations made by the calling thread
+    static long &count(){
+        static thread_local long c = 0;
+        return c;
+    }
+    // failed Eigen assertion: a forbidden heap allocation is counted, anything else aborts
+    static void eigenAssertion(const char *condition, const char *file, int line){
+        if(std::strstr(condition, "heap allocation is forbidden")){
+            count()++;
+            return;
+        }
+        std::fprintf(stderr, "%s:%d: Eigen assertion failed: %s\n", file, line, condition);
+        std::abort();
+    }
+};
+
+#ifdef DEBUG_ALLOCATIONS
+#ifdef EIGEN_CORE_H
+#error "AllocationCounter.h must be included before Eigen"
+#endif
+#define EIGEN_RUNTIME_NO_MALLOC
+#define eigen_assert(x) ((x) ? (void)0 : ::AllocationCounter::eigenAssertion(#x, __FILE__, __LINE__))
+
+#ifdef ALLOCATION_COUNTER_IMPLEMENTATION
+#include <new>
+void *operator new(std::size_t size){
+    AllocationCounter::count()++;
+    if(void *p = std::malloc(size ? size : 1)) return p;
+    throw std::bad_alloc();
+}
+void *operator new[](std::size_t size){
+    AllocationCounter::count()++;
+    if(void *p = std::malloc(size ? size : 1)) return p;
+    throw std::bad_alloc();
+}
+void operator delete(void *p) noexcept { std::free(p); }
+void operator delete[](void *p) noexcept { std::free(p); }
+void operator delete(void *p, std::size_t) noexcept { std::free(p); }
+void operator delete[](void *p, std::size_t) noexcept { std::free(p); }
+#endif
+#endif
+
+#endif /* AllocationCounter_h */
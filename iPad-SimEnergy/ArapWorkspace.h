@@ -0,0 +1,184 @@
+//
+//  ArapWorkspace.h
+//  iPad-SimEnergy
+//
+//  Per-mesh storage for the ARAP local/global iteration.
+//
+//  Everything per triangle is kept in structure-of-arrays form and sized once
+//  per mesh by resize(), so the iteration itself does not touch the heap.
+//  P[2*k+l][i] is entry (k,l) of the 3x2 inverted mesh matrix of triangle i,
+//  J[2*j+l][i] and R[2*j+l][i] are entry (j,l) of its 2x2 local map B*Pinv
+//  and of the rotation part of that map. energy() and rotationChange() measure
+//  the convergence of the iteration after each local step.
+//
+//  The local step and the right-hand side run in parallel: the rotations are
+//  independent per triangle, and every row of the right-hand side gathers the
+//  contributions of its triangles (vertex->triangle adjacency in CSR form,
+//  built by computePinv()) in increasing triangle order. That is the order
+//  of the serial scatter, so the results do not depend on the thread count.
+//
+
+#ifndef ArapWorkspace_h
+#define ArapWorkspace_h
+
+#include "SolverBackend.h"
+#include "PolarRotation.h"
+#include "ParallelFor.h"
+
+class ArapWorkspace {
+public:
+    int numVertices = 0, numTriangles = 0;
+    std::vector<float> P[6], J[4], R[4];
+    // right-hand side and solution of the global step (numVertices x 2)
+    Eigen::MatrixXf U, Sol;
+
+    void resize(int nv, int nt){
+        numVertices = nv;
+        numTriangles = nt;
+        for(int k=0;k<6;k++) P[k].assign(nt, 0.0f);
+        for(int k=0;k<4;k++){
+            J[k].assign(nt, 0.0f);
+            R[k].assign(nt, 0.0f);
+            previousR[k].assign(nt, 0.0f);
+        }
+        U = Eigen::MatrixXf::Zero(nv, 2);
+        Sol = Eigen::MatrixXf::Zero(nv, 2);
+        isHandle.assign(nv, false);
+        incidentStart.clear();
+        resetRotations();
+    }
+
+    // inverted mesh matrices of the rest pose, and the triangles around every vertex
+    void computePinv(const float *ix, const float *iy, const int *triangles){
+        computeIncidence(triangles);
+        for(int i=0;i<numTriangles;i++){
+            int posx=triangles[3*i];
+            int posz=triangles[3*i+1];
+            int poss=triangles[3*i+2];
+            float a = ix[posx];
+            float b = iy[posx];
+            float c = ix[posz];
+            float d = iy[posz];
+            float e = ix[poss];
+            float f = iy[poss];
+            float detA = (a*d-a*f-b*c+b*e+c*f-d*e);
+            P[0][i] = (d-f)/detA;
+            P[1][i] = (-c+e)/detA;
+            P[2][i] = (-b+f)/detA;
+            P[3][i] = (a-e)/detA;
+            P[4][i] = (b-d)/detA;
+            P[5][i] = (-a+c)/detA;
+        }
+    }
+
+    // the energy |B-I|^2 differentiated: Pinv*Pinv^T for each triangle (products in the precision of the triplets)
+    template <class S>
+    void energyTriplets(const int *triangles, std::vector<Eigen::Triplet<S>> &tripletList) const{
+        for(int i=0;i<numTriangles;i++){
+            const int pos[3] = {triangles[3*i], triangles[3*i+1], triangles[3*i+2]};
+            for(int k=0;k<3;k++){
+                for(int l=0;l<3;l++){
+                    tripletList.push_back(Eigen::Triplet<S>(pos[k], pos[l], (S)P[2*k][i]*P[2*l][i] + (S)P[2*k+1][i]*P[2*l+1][i]));
+                }
+            }
+        }
+    }
+
+    void resetRotations(){
+        std::fill(R[0].begin(), R[0].end(), 1.0f);
+        std::fill(R[1].begin(), R[1].end(), 0.0f);
+        std::fill(R[2].begin(), R[2].end(), 0.0f);
+        std::fill(R[3].begin(), R[3].end(), 1.0f);
+    }
+
+    // local step: rotation parts of the local maps of the current solution, in parallel over the triangles
+    void fitRotations(const int *triangles){
+        parallelFor(0, numTriangles, 2048, [&](int lo, int hi){
+            for(int i=lo;i<hi;i++){
+                int posx=triangles[3*i];
+                int posz=triangles[3*i+1];
+                int poss=triangles[3*i+2];
+                float x0 = Sol(posx,0), x1 = Sol(posz,0), x2 = Sol(poss,0);
+                float y0 = Sol(posx,1), y1 = Sol(posz,1), y2 = Sol(poss,1);
+                J[0][i] = x0*P[0][i] + x1*P[2][i] + x2*P[4][i];
+                J[1][i] = x0*P[1][i] + x1*P[3][i] + x2*P[5][i];
+                J[2][i] = y0*P[0][i] + y1*P[2][i] + y2*P[4][i];
+                J[3][i] = y0*P[1][i] + y1*P[3][i] + y2*P[5][i];
+            }
+            for(int k=0;k<4;k++) std::copy(R[k].begin()+lo, R[k].begin()+hi, previousR[k].begin()+lo);
+            // (the SIMD lanes and the scalar tail agree, so the chunking does not change the rotations)
+            polarRotations(hi-lo, J[0].data()+lo, J[1].data()+lo, J[2].data()+lo, J[3].data()+lo,
+                           R[0].data()+lo, R[1].data()+lo, R[2].data()+lo, R[3].data()+lo);
+        });
+    }
+
+    // ARAP energy sum |B-R|^2 of the current solution, after fitRotations()
+    double energy() const{
+        double e = 0;
+        for(int k=0;k<4;k++){
+            for(int i=0;i<numTriangles;i++) e += (double)(J[k][i]-R[k][i])*(J[k][i]-R[k][i]);
+        }
+        return e;
+    }
+
+    // root mean square change of the rotation entries in the last fitRotations()
+    double rotationChange() const{
+        double c = 0;
+        for(int k=0;k<4;k++){
+            for(int i=0;i<numTriangles;i++) c += (double)(R[k][i]-previousR[k][i])*(R[k][i]-previousR[k][i]);
+        }
+        return numTriangles>0 ? std::sqrt(c/(4.0*numTriangles)) : 0;
+    }
+
+    // global step right-hand side: rows of the handles hold their positions
+    void formRHS(const int *triangles, const int *selected, int numSelected, const float *x, const float *y){
+        if((int)incidentStart.size()!=numVertices+1) computeIncidence(triangles);
+        for(int k=0;k<numSelected;k++){
+            int i=selected[k];
+            isHandle[i] = true;
+            U.row(i) << x[i], y[i];
+        }
+        // Pinv * A^T, gathered per vertex
+        parallelFor(0, numVertices, 2048, [&](int lo, int hi){
+            for(int v=lo;v<hi;v++){
+                if(isHandle[v]) continue;
+                float u0 = 0, u1 = 0;
+                for(int e=incidentStart[v];e<incidentStart[v+1];e++){
+                    int i = incidentTriangle[e], k = incidentCorner[e];
+                    u0 += P[2*k][i]*R[0][i] + P[2*k+1][i]*R[1][i];
+                    u1 += P[2*k][i]*R[2][i] + P[2*k+1][i]*R[3][i];
+                }
+                U(v,0) = u0;
+                U(v,1) = u1;
+            }
+        });
+        for(int k=0;k<numSelected;k++){
+            isHandle[selected[k]] = false;
+        }
+    }
+
+private:
+    // triangles and corners around every vertex, in increasing triangle order
+    void computeIncidence(const int *triangles){
+        incidentStart.assign(numVertices+1, 0);
+        for(int c=0;c<3*numTriangles;c++) incidentStart[triangles[c]+1]++;
+        for(int v=0;v<numVertices;v++) incidentStart[v+1] += incidentStart[v];
+        incidentTriangle.resize(3*numTriangles);
+        incidentCorner.resize(3*numTriangles);
+        fill.assign(incidentStart.begin(), incidentStart.end()-1);
+        for(int c=0;c<3*numTriangles;c++){
+            int e = fill[triangles[c]]++;
+            incidentTriangle[e] = c/3;
+            incidentCorner[e] = (char)(c%3);
+        }
+    }
+
+    std::vector<char> isHandle;
+    // incidentTriangle/incidentCorner[incidentStart[v]..incidentStart[v+1]) are the corners at vertex v
+    std::vector<int> incidentStart, incidentTriangle, fill;
+    std::vector<char> incidentCorner;
+    // R before the last fitRotations()
+    std::vector<float> previousR[4];
+};
+
+#endif /* ArapWorkspace_h */
@@ -0,0 +1,322 @@
+//
+//  AsyncSolver.cpp
+//  iPad-SimEnergy
+//
+//  Worker thread of the deformation; see AsyncSolver.h.
+//
+
+#include "AsyncSolver.h"
+
+AsyncSolver::AsyncSolver(){
+}
+
+AsyncSolver::~AsyncSolver(){
+    {
+        std::lock_guard<std::mutex> lock(queueMutex);
+        stopping = true;
+    }
+    queueChanged.notify_all();
+    if(worker.joinable()) worker.join();
+}
+
+void AsyncSolver::setMesh(const DeformationMesh &mesh){
+    {
+        std::lock_guard<std::mutex> lock(queueMutex);
+        count = 0;
+    }
+    std::lock_guard<std::mutex> lock(engineMutex);
+    int nv = mesh.numVertices;
+    x.assign(mesh.x, mesh.x+nv);
+    y.assign(mesh.y, mesh.y+nv);
+    ix.assign(mesh.ix, mesh.ix+nv);
+    iy.assign(mesh.iy, mesh.iy+nv);
+    triangles.assign(mesh.triangles, mesh.triangles+3*mesh.numTriangles);
+    selected.assign(nv, 0);
+    DeformationMesh m = mesh;
+    m.x = x.data();
+    m.y = y.data();
+    m.ix = ix.data();
+    m.iy = iy.data();
+    m.triangles = triangles.data();
+    m.selected = selected.data();
+    m.numSelected = 0;
+    engine.setMesh(m);
+    recordMesh();
+    for(int k=0;k<3;k++){
+        frames.slot(k).x.assign(nv, 0.0f);
+        frames.slot(k).y.assign(nv, 0.0f);
+    }
+    publish();
+    if(!worker.joinable()){
+        worker = std::thread(&AsyncSolver::run, this);
+    }
+}
+
+void AsyncSolver::reset(const DeformationMesh &mesh){
+    {
+        std::lock_guard<std::mutex> lock(queueMutex);
+        count = 0;
+    }
+    std::lock_guard<std::mutex> lock(engineMutex);
+    std::copy(mesh.x, mesh.x+x.size(), x.begin());
+    std::copy(mesh.y, mesh.y+y.size(), y.begin());
+    std::copy(mesh.ix, mesh.ix+ix.size(), ix.begin());
+    std::copy(mesh.iy, mesh.iy+iy.size(), iy.begin());
+    engine.setNumSelected(0);
+    engine.invalidate();
+    recordReset();
+    publish();
+}
+
+void AsyncSolver::setSolverBackend(SolverBackend::Kind kind, int multigridCycles, int refinementSteps, bool handleBasis){
+    std::lock_guard<std::mutex> lock(engineMutex);
+    backendKind = kind;
+    this->multigridCycles = multigridCycles;
+    this->refinementSteps = refinementSteps;
+    this->handleBasis = handleBasis;
+    engine.multigridCycles = multigridCycles;
+    engine.refinementSteps = refinementSteps;
+    engine.handleBasis = handleBasis;
+    engine.setSolverBackend(kind);
+    recordBackend();
+}
+
+void AsyncSolver::setArapBudget(double milliseconds, double tolerance){
+    std::lock_guard<std::mutex> lock(engineMutex);
+    arapBudget = milliseconds;
+    arapTolerance = tolerance;
+    engine.arapBudget = milliseconds;
+    engine.arapTolerance = tolerance;
+    recordBackend();
+}
+
+void AsyncSolver::push(const Settings &settings, const int *selected, int numSelected, const float *x, const float *y, bool structural, bool invalidate){
+    std::unique_lock<std::mutex> lock(queueMutex);
+    if(!worker.joinable()) return;
+    Request *r = nullptr;
+    if(!structural && count>0 && !queue[(head+count-1)%QUEUE_SIZE].structural){
+        // latest wins: the pending drag is superseded
+        r = &queue[(head+count-1)%QUEUE_SIZE];
+        std::lock_guard<std::mutex> statsLock(statsMutex);
+        stats.dropped++;
+    }else{
+        // touch down/up are kept; only a full queue of them makes the caller wait
+        queueChanged.wait(lock, [&]{ return count<QUEUE_SIZE || stopping; });
+        if(stopping) return;
+        r = &queue[(head+count)%QUEUE_SIZE];
+        count++;
+    }
+    r->structural = structural;
+    r->invalidate = invalidate;
+    r->settings = settings;
+    r->selected.assign(selected, selected+numSelected);
+    r->x.resize(structural ? 0 : numSelected);
+    r->y.resize(structural ? 0 : numSelected);
+    for(int k=0;k<(int)r->x.size();k++){
+        r->x[k] = x[selected[k]];
+        r->y[k] = y[selected[k]];
+    }
+    r->time = std::chrono::steady_clock::now();
+    if(!structural){
+        std::lock_guard<std::mutex> statsLock(statsMutex);
+        stats.posted++;
+    }
+    queueChanged.notify_all();
+}
+
+void AsyncSolver::finish(){
+    std::unique_lock<std::mutex> lock(queueMutex);
+    queueChanged.wait(lock, [&]{ return (count==0 && !busy) || stopping; });
+}
+
+AsyncSolver::Statistics AsyncSolver::statistics(){
+    std::lock_guard<std::mutex> lock(statsMutex);
+    return stats;
+}
+
+void AsyncSolver::run(){
+    for(;;){
+        {
+            std::unique_lock<std::mutex> lock(queueMutex);
+            busy = false;
+            queueChanged.notify_all();
+            queueChanged.wait(lock, [&]{ return count>0 || stopping; });
+            if(stopping) return;
+            const Request &r = queue[head];
+            work.structural = r.structural;
+            work.invalidate = r.invalidate;
+            work.settings = r.settings;
+            work.selected.assign(r.selected.begin(), r.selected.end());
+            work.x.assign(r.x.begin(), r.x.end());
+            work.y.assign(r.y.begin(), r.y.end());
+            work.time = r.time;
+            head = (head+1)%QUEUE_SIZE;
+            count--;
+            busy = true;
+            queueChanged.notify_all();
+        }
+        std::lock_guard<std::mutex> lock(engineMutex);
+        process(work);
+        // after processing, so that a drag record holds the ARAP rounds the frame took
+        recordRequest(work);
+        // the end of a gesture
+        if(work.structural && work.selected.empty()) recordCheckpoint();
+    }
+}
+
+void AsyncSolver::process(const Request &request){
+    engine.mode = request.settings.mode;
+    engine.iteration = request.settings.iteration;
+    engine.prefactored = request.settings.prefactored;
+    engine.arapRounds = request.settings.arapRounds;
+    if(request.invalidate) engine.invalidate();
+    int numSelected = (int)request.selected.size();
+    for(int k=0;k<numSelected;k++){
+        selected[k] = request.selected[k];
+    }
+    for(int k=0;k<(int)request.x.size();k++){
+        x[selected[k]] = request.x[k];
+        y[selected[k]] = request.y[k];
+    }
+    engine.setNumSelected(numSelected);
+    long allocations = 0;
+    if(request.structural){
+        PROFILE_STAGE(Rebuild);
+        engine.resetTimings();
+        engine.formEnergy();
+    }else{
+        PROFILE_STAGE(Frame);
+        allocations = AllocationCounter::count();
+        engine.solve();
+        allocations = AllocationCounter::count()-allocations;
+        PROFILE_COUNTER(Allocations, allocations);
+    }
+    publish();
+    double latency = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - request.time).count();
+
+    std::lock_guard<std::mutex> lock(statsMutex);
+    SolverBackend &backend = engine.backend();
+    stats.backend = backend.name();
+    stats.factorizeTime = backend.factorizeTime;
+    stats.solveTime = backend.solveTime;
+    stats.numSolves = backend.numSolves;
+    if(MultigridBackend *mg = dynamic_cast<MultigridBackend *>(&backend)){
+        stats.cycles = mg->lastCycles;
+        stats.residual = mg->lastResidual;
+    }else if(MatrixFreeCGBackend *cg = dynamic_cast<MatrixFreeCGBackend *>(&backend)){
+        stats.cycles = cg->lastIterations;
+        stats.residual = cg->lastResidual;
+    }
+    stats.refinementSteps = engine.refinement().steps;
+    stats.refinementBound = engine.refinement().errorBound;
+    if(!request.structural){
+        const DeformationEngine::ArapProgress &progress = engine.arapProgress();
+        stats.arapIterations = progress.iterations;
+        stats.arapEnergy = progress.energy;
+        stats.arapRotationChange = progress.rotationChange;
+        stats.arapConverged = progress.converged;
+    }
+    if(request.structural){
+        stats.maxLatency = 0;
+    }else{
+        stats.solved++;
+        stats.allocations = allocations;
+    }
+    stats.latency = latency;
+    stats.maxLatency = std::max(stats.maxLatency, latency);
+}
+
+void AsyncSolver::publish(){
+    Frame &frame = frames.back();
+    std::copy(x.begin(), x.end(), frame.x.begin());
+    std::copy(y.begin(), y.end(), frame.y.begin());
+    frame.sequence = ++sequence;
+    frames.publish();
+}
+
+bool AsyncSolver::startRecording(const char *path){
+    std::lock_guard<std::mutex> lock(engineMutex);
+    if(!trace.open(path)) return false;
+    traceStart = std::chrono::steady_clock::now();
+    recordMesh();
+    recordBackend();
+    trace.flush();
+    return true;
+}
+
+void AsyncSolver::stopRecording(){
+    std::lock_guard<std::mutex> lock(engineMutex);
+    recordCheckpoint();
+    trace.close();
+}
+
+double AsyncSolver::traceTime(std::chrono::steady_clock::time_point time) const{
+    return std::chrono::duration<double>(time - traceStart).count();
+}
+
+void AsyncSolver::recordMesh(){
+    if(!trace.isOpen()) return;
+    const DeformationMesh &mesh = engine.getMesh();
+    int nv = (int)x.size();
+    trace.begin(TouchTrace::Mesh, traceTime(std::chrono::steady_clock::now()));
+    trace.ints({mesh.horizontalDivisions, mesh.verticalDivisions, nv, (int)triangles.size()/3});
+    trace.floats(x.data(), nv);
+    trace.floats(y.data(), nv);
+    trace.floats(ix.data(), nv);
+    trace.floats(iy.data(), nv);
+    trace.ints(triangles.data(), triangles.size());
+    trace.end();
+}
+
+void AsyncSolver::recordReset(){
+    if(!trace.isOpen()) return;
+    int nv = (int)x.size();
+    trace.begin(TouchTrace::Reset, traceTime(std::chrono::steady_clock::now()));
+    trace.ints({nv});
+    trace.floats(x.data(), nv);
+    trace.floats(y.data(), nv);
+    trace.floats(ix.data(), nv);
+    trace.floats(iy.data(), nv);
+    trace.end();
+}
+
+void AsyncSolver::recordBackend(){
+    if(!trace.isOpen()) return;
+    trace.begin(TouchTrace::Backend, traceTime(std::chrono::steady_clock::now()));
+    trace.ints({(int)backendKind, multigridCycles, refinementSteps, handleBasis ? 1 : 0});
+    trace.doubles({arapBudget, arapTolerance});
+    trace.end();
+}
+
+void AsyncSolver::recordRequest(const Request &request){
+    if(!trace.isOpen()) return;
+    const Settings &settings = request.settings;
+    int numSelected = (int)request.selected.size();
+    if(request.structural){
+        trace.begin(TouchTrace::Structural, traceTime(request.time));
+        trace.ints({settings.mode, settings.iteration, settings.prefactored ? 1 : 0, request.invalidate ? 1 : 0, numSelected});
+        trace.ints(request.selected.data(), numSelected);
+    }else{
+        trace.begin(TouchTrace::Drag, traceTime(request.time));
+        trace.ints({settings.mode, settings.iteration, settings.prefactored ? 1 : 0, numSelected});
+        trace.ints(request.selected.data(), numSelected);
+        trace.floats(request.x.data(), numSelected);
+        trace.floats(request.y.data(), numSelected);
+        // the rounds depend on timing when the frame has a budget
+        const DeformationEngine::ArapProgress &progress = engine.arapProgress();
+        bool timed = settings.mode==DeformationEngine::ARAP && engine.arapBudget>0;
+        trace.ints({timed ? progress.iterations : 0, timed && progress.converged ? 1 : 0});
+    }
+    trace.end();
+}
+
+void AsyncSolver::recordCheckpoint(){
+    if(!trace.isOpen()) return;
+    int nv = (int)x.size();
+    trace.begin(TouchTrace::Checkpoint, traceTime(std::chrono::steady_clock::now()));
+    trace.ints({nv});
+    trace.floats(x.data(), nv);
+    trace.floats(y.data(), nv);
+    trace.end();
+    trace.flush();
+}
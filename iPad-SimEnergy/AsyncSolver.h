@@ -0,0 +1,161 @@
+//
+//  AsyncSolver.h
+//  iPad-SimEnergy
+//
+//  Runs a DeformationEngine on a dedicated worker thread, so that slow solves
+//  do not hold up touch delivery or rendering.
+//
+//  The UI thread posts requests: drags carry the positions of the handles,
+//  touch down/up (and mode changes) rebuild the energy for the new selection.
+//  Requests are processed in order, except that consecutive drags collapse
+//  into the latest one; touch down/up are never dropped.
+//  The worker owns its copy of the vertices and publishes every result
+//  through a triple buffer, which the renderer reads without locking.
+//  Everything the worker does can be recorded to a TouchTrace for replay.
+//
+
+#ifndef AsyncSolver_h
+#define AsyncSolver_h
+
+#include "DeformationEngine.h"
+#include "TripleBuffer.h"
+#include "TouchTrace.h"
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+class AsyncSolver {
+public:
+    // UI state applied by the worker before each request
+    struct Settings {
+        int mode = DeformationEngine::Sim;
+        int iteration = 1;
+        bool prefactored = false;
+        // ARAP with a budget: the rounds of the frame instead of timing them (0: timed; see DeformationEngine::arapRounds)
+        int arapRounds = 0;
+    };
+    // published vertex positions
+    struct Frame {
+        std::vector<float> x, y;
+        // number of requests processed up to this frame
+        long sequence = 0;
+    };
+    struct Statistics {
+        const char *backend = "";
+        // since the last rebuild of the energy
+        double factorizeTime = 0, solveTime = 0;
+        int numSolves = 0;
+        // drag requests posted, solved and superseded before being solved
+        long posted = 0, solved = 0, dropped = 0;
+        // milliseconds from posting a request to publishing its result
+        double latency = 0, maxLatency = 0;
+        // heap allocations in the last drag (counted with DEBUG_ALLOCATIONS only)
+        long allocations = 0;
+        // Multigrid, MatrixFreeCG: V-cycles or CG iterations, and relative residual of the last solve
+        int cycles = 0;
+        double residual = 0;
+        // mixed-precision refinement of the last solve: steps and bound on the relative error left
+        int refinementSteps = 0;
+        double refinementBound = 0;
+        // ARAP rounds of the last drag, with the energy and rotation change of its last local step
+        int arapIterations = 0;
+        double arapEnergy = 0, arapRotationChange = 0;
+        bool arapConverged = false;
+    };
+
+    AsyncSolver();
+    ~AsyncSolver();
+
+    // copies the mesh; pending requests are discarded. Starts the worker on the first call.
+    void setMesh(const DeformationMesh &mesh);
+    // back to the given positions and rest pose with nothing selected
+    void reset(const DeformationMesh &mesh);
+
+    // drag: new positions of the selected vertices
+    void post(const Settings &settings, const int *selected, int numSelected, const float *x, const float *y){
+        push(settings, selected, numSelected, x, y, false, false);
+    }
+    // the selection or the mode changed: the energy is rebuilt (invalidate: a kept factorization is stale).
+    // The handles keep the worker's positions, which may be newer than the ones on screen.
+    void postStructural(const Settings &settings, const int *selected, int numSelected, bool invalidate = false){
+        push(settings, selected, numSelected, nullptr, nullptr, true, invalidate);
+    }
+
+    // choose the linear solver, its refinement steps and the Sim handle basis (recorded in the trace, unlike changes made through exclusive())
+    void setSolverBackend(SolverBackend::Kind kind, int multigridCycles, int refinementSteps = 0, bool handleBasis = false);
+    // ARAP: milliseconds of rounds per frame and their tolerance (see DeformationEngine::arapBudget), recorded in the
+    // trace together with the rounds each frame took
+    void setArapBudget(double milliseconds, double tolerance);
+
+    // f(engine) on the calling thread, between requests of the worker
+    template <class F>
+    void exclusive(const F &f){
+        std::lock_guard<std::mutex> lock(engineMutex);
+        f(engine);
+    }
+
+    // renderer side, lock-free: true if a newer frame was published since the last call
+    bool acquire(){ return frames.update(); }
+    const Frame &frame() const { return frames.front(); }
+
+    // wait until all posted requests are processed
+    void finish();
+
+    Statistics statistics();
+
+    // trace of the processed requests (see TouchTrace.h), starting with the current mesh
+    bool startRecording(const char *path);
+    // ends the trace with a checkpoint of the current vertices
+    void stopRecording();
+
+private:
+    struct Request {
+        bool structural = false, invalidate = false;
+        Settings settings;
+        std::vector<int> selected;
+        std::vector<float> x, y;
+        std::chrono::steady_clock::time_point time;
+    };
+
+    void push(const Settings &settings, const int *selected, int numSelected, const float *x, const float *y, bool structural, bool invalidate);
+    void run();
+    void process(const Request &request);
+    void publish();
+    // trace records; called with engineMutex held
+    double traceTime(std::chrono::steady_clock::time_point time) const;
+    void recordMesh();
+    void recordReset();
+    void recordBackend();
+    void recordRequest(const Request &request);
+    void recordCheckpoint();
+
+    DeformationEngine engine;
+    // the worker's vertices, selection and rest pose
+    std::vector<float> x, y, ix, iy;
+    std::vector<int> triangles, selected;
+    TripleBuffer<Frame> frames;
+    long sequence = 0;
+
+    // ring of pending requests; its storage is reused, so posting does not allocate after warm-up
+    static const int QUEUE_SIZE = 16;
+    Request queue[QUEUE_SIZE];
+    int head = 0, count = 0;
+    // true while the worker processes a request taken from the queue
+    bool busy = false;
+    bool stopping = false;
+    Request work;
+    std::mutex queueMutex, engineMutex, statsMutex;
+    std::condition_variable queueChanged;
+    std::thread worker;
+    Statistics stats;
+
+    TouchTrace::Writer trace;
+    std::chrono::steady_clock::time_point traceStart;
+    SolverBackend::Kind backendKind = SolverBackend::LDLT;
+    int multigridCycles = 20;
+    int refinementSteps = 0;
+    bool handleBasis = false;
+    double arapBudget = 0, arapTolerance = 1e-4;
+};
+
+#endif /* AsyncSolver_h */
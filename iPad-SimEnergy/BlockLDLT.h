@@ -0,0 +1,402 @@
+//
+//  BlockLDLT.h
+//  iPad-SimEnergy
+//
+//  Sparse LDL^T factorization on the vertices of the mesh, with the x and y
+//  of every vertex interleaved into 2x2 blocks.
+//
+//  The engine numbers the Sim DOFs x block first, then y block, so every
+//  triangle couples entries numVertices apart. Here the unknowns of a vertex
+//  are kept together instead: the matrix is stored block-sparse (BSR) with a
+//  2x2 block per pair of adjacent vertices, and L and D of the factorization
+//  are made of 2x2 blocks as well. The ARAP system has one unknown per vertex
+//  and uses 1x1 blocks. The vertices are numbered by reverse Cuthill-McKee
+//  (narrow profile) or nested dissection (less fill on large meshes), which
+//  is computed on the vertex graph, so the symbolic work and the index
+//  storage are those of a matrix a quarter of the size.
+//
+//  analyzePattern() computes the ordering, the block pattern with a scatter
+//  map from the entries of the matrix, the elimination tree and the pattern
+//  of L. factorize() scatters the values and runs an up-looking block LDL^T;
+//  solve() permutes the right-hand side, then runs the block triangular
+//  solves. Arithmetic is in float, as in the other direct backends.
+//
+//  Included by SolverBackend.h; select it with SolverBackend::BlockLDLT.
+//
+
+#ifndef BlockLDLT_h
+#define BlockLDLT_h
+
+class BlockLDLTBackend : public SolverBackend {
+public:
+    enum Ordering { ReverseCuthillMcKee, NestedDissection };
+
+    Ordering ordering = NestedDissection;
+
+    const char *name() const { return "BlockLDLT"; }
+
+    void setTriangles(int numVertices, int /*numTriangles*/, const int * /*triangles*/, const float * /*ix*/, const float * /*iy*/){
+        nv = numVertices;
+    }
+
+    void analyzePattern(const SpMat &G){
+        n = (int)G.rows();
+        // Sim: 2 DOFs per vertex (x block, y block); anything else is taken one DOF per node
+        b = (nv>0 && n==2*nv) ? 2 : 1;
+        nb = n/b;
+        buildGraph(G);
+        if(ordering==ReverseCuthillMcKee){
+            reverseCuthillMcKee();
+        }else{
+            nestedDissection();
+        }
+        buildBlocks(G);
+        eliminationTree();
+        info = -1;
+    }
+
+    void factorize(const SpMat &G){
+        auto start = std::chrono::steady_clock::now();
+        if((int)G.rows()!=n || (Eigen::Index)entrySlot.size()!=G.nonZeros()) analyzePattern(G);
+        std::fill(blockValue.begin(), blockValue.end(), 0.0f);
+        const float *value = G.valuePtr();
+        for(size_t e=0;e<entrySlot.size();e++) blockValue[entrySlot[e]] = value[e];
+        info = b==2 ? factorizeBlocks<2>() : factorizeBlocks<1>();
+        factorizeTime += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    }
+
+    bool succeeded() const { return info==0; }
+    long factorNonZeros() const { return succeeded() ? (long)(2*Li.size() + nb)*b*b : 0; }
+
+    using SolverBackend::solve;
+    void solve(const Eigen::MatrixXf &rhs, Eigen::MatrixXf &x){
+        auto start = std::chrono::steady_clock::now();
+        int c = (int)rhs.cols();
+        x.resize(n, c);
+        for(int k=0;k<c;k++){
+            permute(rhs.col(k).data(), z.data());
+            if(b==2) solveBlocks<2>(z.data()); else solveBlocks<1>(z.data());
+            unpermute(z.data(), x.col(k).data());
+        }
+        solveTime += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+        numSolves++;
+    }
+
+    // size of the blocks (1 or 2), and of the factor: blocks of L below the diagonal and bytes of L and D
+    int blockSize() const { return b; }
+    size_t factorBlocks() const { return Li.size(); }
+    size_t factorBytes() const {
+        return (Lx.size() + D.size() + Dinv.size())*sizeof(float) + (Li.size() + Lp.size())*sizeof(int);
+    }
+
+    // the matrix in block numbering: w = A z, with z and w permuted as by permute()
+    void multiplyBlocks(const float *z, float *w) const{
+        if(b==2) multiply<2>(z, w); else multiply<1>(z, w);
+    }
+    // a vector of the engine's layout into block numbering (interleaved, ordered) and back
+    void permute(const float *v, float *p) const{
+        for(int d=0;d<n;d++) p[position[d]] = v[d];
+    }
+    void unpermute(const float *p, float *v) const{
+        for(int d=0;d<n;d++) v[d] = p[position[d]];
+    }
+
+private:
+    int nv = 0, n = 0, b = 1, nb = 0, info = -1;
+    // node graph (CSR without the diagonal), and its numbering: order[new node] = old node
+    std::vector<int> adjacencyStart, adjacency, order, rank;
+    // position[DOF] = index of the DOF in block numbering
+    std::vector<int> position;
+    // BSR of the whole symmetric matrix in block numbering, b*b row-major floats per block;
+    // entrySlot[e] = float of the e-th entry of G (in its compressed storage)
+    std::vector<int> blockStart, blockColumn, entrySlot;
+    std::vector<float> blockValue;
+    // elimination tree, and L by columns: rows Li and blocks Lx, column k at [Lp[k], Lp[k+1])
+    std::vector<int> parent, Lp, Li;
+    std::vector<float> Lx, D, Dinv;
+    // factorization and solve workspaces
+    std::vector<int> flag, pattern, count;
+    std::vector<float> y, z;
+
+    int node(int dof) const { return b==2 ? dof%nv : dof; }
+
+    void buildGraph(const SpMat &G){
+        std::vector<std::vector<int> > neighbours(nb);
+        for(int c=0;c<G.outerSize();c++){
+            for(SpMat::InnerIterator it(G,c);it;++it){
+                int i = node((int)it.row()), j = node(c);
+                if(i!=j) neighbours[i].push_back(j);
+            }
+        }
+        adjacencyStart.assign(nb+1, 0);
+        adjacency.clear();
+        for(int i=0;i<nb;i++){
+            std::sort(neighbours[i].begin(), neighbours[i].end());
+            neighbours[i].erase(std::unique(neighbours[i].begin(), neighbours[i].end()), neighbours[i].end());
+            adjacency.insert(adjacency.end(), neighbours[i].begin(), neighbours[i].end());
+            adjacencyStart[i+1] = (int)adjacency.size();
+        }
+    }
+
+    int degree(int i) const { return adjacencyStart[i+1]-adjacencyStart[i]; }
+
+    // breadth-first levels from root over the nodes with mark[i]==stamp; the visited nodes in visit order
+    void levels(int root, const std::vector<int> &mark, int stamp, std::vector<int> &level, std::vector<int> &visited) const{
+        visited.clear();
+        visited.push_back(root);
+        level[root] = 0;
+        for(size_t q=0;q<visited.size();q++){
+            int i = visited[q];
+            for(int e=adjacencyStart[i];e<adjacencyStart[i+1];e++){
+                int j = adjacency[e];
+                if(mark[j]==stamp && level[j]<0){
+                    level[j] = level[i]+1;
+                    visited.push_back(j);
+                }
+            }
+        }
+    }
+
+    // a node far from the others (George-Liu): restart from the lowest-degree node of the last level
+    int peripheralNode(int start, const std::vector<int> &mark, int stamp, std::vector<int> &level, std::vector<int> &visited) const{
+        int root = start, eccentricity = -1;
+        for(int round=0;round<8;round++){
+            for(int i : visited) level[i] = -1;
+            levels(root, mark, stamp, level, visited);
+            int last = level[visited.back()];
+            if(last<=eccentricity) break;
+            eccentricity = last;
+            int next = visited.back();
+            for(int q=(int)visited.size()-1;q>=0 && level[visited[q]]==last;q--){
+                if(degree(visited[q])<degree(next)) next = visited[q];
+            }
+            root = next;
+        }
+        for(int i : visited) level[i] = -1;
+        levels(root, mark, stamp, level, visited);
+        return root;
+    }
+
+    void reverseCuthillMcKee(){
+        order.clear();
+        std::vector<int> mark(nb, 0), level(nb, -1), visited, numbered(nb, 0);
+        for(int s=0;s<nb;s++){
+            if(numbered[s]) continue;
+            // one connected component, breadth first from a peripheral node, neighbours by increasing degree
+            int root = peripheralNode(s, mark, 0, level, visited);
+            for(int i : visited) level[i] = -1;
+            size_t first = order.size();
+            order.push_back(root);
+            numbered[root] = 1;
+            for(size_t q=first;q<order.size();q++){
+                int i = order[q];
+                size_t from = order.size();
+                for(int e=adjacencyStart[i];e<adjacencyStart[i+1];e++){
+                    int j = adjacency[e];
+                    if(!numbered[j]){
+                        numbered[j] = 1;
+                        order.push_back(j);
+                    }
+                }
+                std::sort(order.begin()+from, order.end(), [&](int p, int q){ return degree(p)<degree(q); });
+            }
+        }
+        std::reverse(order.begin(), order.end());
+    }
+
+    void nestedDissection(){
+        order.clear();
+        std::vector<int> mark(nb, 0), level(nb, -1), all(nb);
+        for(int i=0;i<nb;i++) all[i] = i;
+        int stamp = 0;
+        dissect(all, mark, stamp, level);
+    }
+
+    // numbers the two halves of nodes, then the level of a breadth-first search that separates them
+    void dissect(const std::vector<int> &nodes, std::vector<int> &mark, int &stamp, std::vector<int> &level){
+        if(nodes.size()<=64){
+            order.insert(order.end(), nodes.begin(), nodes.end());
+            return;
+        }
+        ++stamp;
+        for(int i : nodes){
+            mark[i] = stamp;
+            level[i] = -1;
+        }
+        std::vector<int> visited;
+        peripheralNode(nodes[0], mark, stamp, level, visited);
+        std::vector<int> first, second, separator;
+        if(visited.size()<nodes.size()){
+            // several components: the one reached and the rest, with nothing between them
+            first = visited;
+            for(int i : nodes) if(level[i]<0) second.push_back(i);
+        }else{
+            int depth = level[visited.back()];
+            if(depth<2){
+                order.insert(order.end(), visited.begin(), visited.end());
+                return;
+            }
+            // the level that holds the middle node, away from the ends
+            int middle = std::min(std::max(level[visited[visited.size()/2]], 1), depth-1);
+            for(int i : visited){
+                if(level[i]<middle){
+                    first.push_back(i);
+                }else if(level[i]>middle){
+                    second.push_back(i);
+                }else{
+                    // only the nodes of the level that touch the next one separate the halves
+                    bool touches = false;
+                    for(int e=adjacencyStart[i];e<adjacencyStart[i+1] && !touches;e++){
+                        touches = mark[adjacency[e]]==stamp && level[adjacency[e]]==middle+1;
+                    }
+                    (touches ? separator : first).push_back(i);
+                }
+            }
+        }
+        for(int i : nodes) level[i] = -1;
+        dissect(first, mark, stamp, level);
+        dissect(second, mark, stamp, level);
+        order.insert(order.end(), separator.begin(), separator.end());
+    }
+
+    void buildBlocks(const SpMat &G){
+        rank.assign(nb, 0);
+        for(int k=0;k<nb;k++) rank[order[k]] = k;
+        position.resize(n);
+        for(int d=0;d<n;d++) position[d] = b*rank[node(d)] + (b==2 ? d/nv : 0);
+        // block rows in the new numbering: the diagonal and the neighbours, sorted
+        blockStart.assign(nb+1, 0);
+        blockColumn.clear();
+        std::vector<int> row;
+        for(int k=0;k<nb;k++){
+            int i = order[k];
+            row.assign(1, k);
+            for(int e=adjacencyStart[i];e<adjacencyStart[i+1];e++) row.push_back(rank[adjacency[e]]);
+            std::sort(row.begin(), row.end());
+            blockColumn.insert(blockColumn.end(), row.begin(), row.end());
+            blockStart[k+1] = (int)blockColumn.size();
+        }
+        blockValue.assign(blockColumn.size()*b*b, 0.0f);
+        entrySlot.resize(G.nonZeros());
+        for(int c=0;c<G.outerSize();c++){
+            for(int e=G.outerIndexPtr()[c];e<G.outerIndexPtr()[c+1];e++){
+                int pr = position[G.innerIndexPtr()[e]], pc = position[c];
+                int r = pr/b, s = (int)(std::lower_bound(blockColumn.begin()+blockStart[r], blockColumn.begin()+blockStart[r+1], pc/b) - blockColumn.begin());
+                entrySlot[e] = s*b*b + (pr%b)*b + pc%b;
+            }
+        }
+        y.assign(nb*b*b, 0.0f);
+        z.assign(n, 0.0f);
+    }
+
+    // elimination tree and column counts of L (the symbolic phase of Eigen's SimplicialCholesky, on nodes)
+    void eliminationTree(){
+        parent.assign(nb, -1);
+        flag.assign(nb, 0);
+        count.assign(nb, 0);
+        for(int k=0;k<nb;k++){
+            flag[k] = k;
+            for(int e=blockStart[k];e<blockStart[k+1];e++){
+                int i = blockColumn[e];
+                if(i>=k) continue;
+                for(;flag[i]!=k;i=parent[i]){
+                    if(parent[i]==-1) parent[i] = k;
+                    count[i]++;
+                    flag[i] = k;
+                }
+            }
+        }
+        Lp.assign(nb+1, 0);
+        for(int k=0;k<nb;k++) Lp[k+1] = Lp[k] + count[k];
+        Li.resize(Lp[nb]);
+        Lx.resize((size_t)Lp[nb]*b*b);
+        D.resize(nb*b*b);
+        Dinv.resize(nb*b*b);
+        pattern.resize(nb);
+    }
+
+    // up-looking: row k of L from the triangular solve with the column k of A above the diagonal
+    template <int B>
+    int factorizeBlocks(){
+        typedef Eigen::Matrix<float, B, B, Eigen::RowMajor> Block;
+        typedef Eigen::Map<Block> BlockMap;
+        for(int k=0;k<nb;k++){
+            int top = nb;
+            flag[k] = k;
+            count[k] = 0;
+            for(int e=blockStart[k];e<blockStart[k+1];e++){
+                int i = blockColumn[e];
+                if(i>k) continue;
+                // A(i,k) = A(k,i)^T
+                BlockMap(y.data()+i*B*B) += BlockMap(blockValue.data()+(size_t)e*B*B).transpose();
+                int len = 0;
+                for(;flag[i]!=k;i=parent[i]){
+                    pattern[len++] = i;
+                    flag[i] = k;
+                }
+                while(len>0) pattern[--top] = pattern[--len];
+            }
+            Block d = BlockMap(y.data()+k*B*B);
+            BlockMap(y.data()+k*B*B).setZero();
+            for(;top<nb;top++){
+                int i = pattern[top];
+                // Y = D(i) L(k,i)^T, then L(k,i) = Y^T D(i)^-1
+                Block Y = BlockMap(y.data()+i*B*B);
+                BlockMap(y.data()+i*B*B).setZero();
+                Block Lki = Y.transpose() * BlockMap(Dinv.data()+i*B*B);
+                int end = Lp[i] + count[i];
+                for(int p=Lp[i];p<end;p++) BlockMap(y.data()+Li[p]*B*B).noalias() -= BlockMap(Lx.data()+(size_t)p*B*B) * Y;
+                d.noalias() -= Lki * Y;
+                Li[end] = k;
+                BlockMap(Lx.data()+(size_t)end*B*B) = Lki;
+                count[i]++;
+            }
+            // the diagonal blocks of an SPD matrix are SPD
+            if(!(d(0,0)>0) || !(d.determinant()>0)) return k+1;
+            BlockMap(D.data()+k*B*B) = d;
+            BlockMap(Dinv.data()+k*B*B) = d.inverse();
+        }
+        return 0;
+    }
+
+    template <int B>
+    void solveBlocks(float *x) const{
+        typedef Eigen::Matrix<float, B, B, Eigen::RowMajor> Block;
+        typedef Eigen::Map<const Block> BlockMap;
+        typedef Eigen::Matrix<float, B, 1> Vector;
+        typedef Eigen::Map<Vector> VectorMap;
+        // L z = b
+        for(int i=0;i<nb;i++){
+            Vector xi = VectorMap(x+i*B);
+            for(int p=Lp[i];p<Lp[i+1];p++) VectorMap(x+Li[p]*B).noalias() -= BlockMap(Lx.data()+(size_t)p*B*B) * xi;
+        }
+        for(int i=0;i<nb;i++){
+            Vector xi = VectorMap(x+i*B);
+            VectorMap(x+i*B).noalias() = BlockMap(Dinv.data()+i*B*B) * xi;
+        }
+        // L^T x = z
+        for(int i=nb-1;i>=0;i--){
+            Vector xi = VectorMap(x+i*B);
+            for(int p=Lp[i];p<Lp[i+1];p++) xi.noalias() -= BlockMap(Lx.data()+(size_t)p*B*B).transpose() * VectorMap(x+Li[p]*B);
+            VectorMap(x+i*B) = xi;
+        }
+    }
+
+    template <int B>
+    void multiply(const float *x, float *w) const{
+        typedef Eigen::Matrix<float, B, B, Eigen::RowMajor> Block;
+        typedef Eigen::Map<const Block> BlockMap;
+        typedef Eigen::Matrix<float, B, 1> Vector;
+        parallelFor(0, nb, 1024, [&](int lo, int hi){
+            for(int i=lo;i<hi;i++){
+                Vector sum = Vector::Zero();
+                for(int e=blockStart[i];e<blockStart[i+1];e++){
+                    sum.noalias() += BlockMap(blockValue.data()+(size_t)e*B*B) * Eigen::Map<const Vector>(x+blockColumn[e]*B);
+                }
+                Eigen::Map<Vector>(w+i*B) = sum;
+            }
+        });
+    }
+};
+
+#endif /* BlockLDLT_h */
@@ -0,0 +1,328 @@
+//
+//  DeformationEngine.cpp
+//  iPad-SimEnergy
+//
+//  Energies and solves of the deformation, independent of UIKit and OpenGL.
+//
+
+#include "DeformationEngine.h"
+
+using namespace Eigen;
+
+DeformationEngine::DeformationEngine(){
+    setSolverBackend(SolverBackend::LDLT);
+}
+
+void DeformationEngine::setMesh(const DeformationMesh &mesh){
+    this->mesh = mesh;
+    arap.resize(mesh.numVertices, mesh.numTriangles);
+    // size of the Sim system: two-times (x and y coordinates) the number of vertices
+    V = MatrixXf::Zero(2*mesh.numVertices, 1);
+    Sol = MatrixXf::Zero(2*mesh.numVertices, 1);
+    // the Sim (2n x 1) and ARAP (n x 2) systems have the same number of entries
+    refiner.resize(2*mesh.numVertices, 1);
+    simAssembly.invalidate();
+    prefactoredSolver.invalidate();
+    basisValid = false;
+    configureBackend(solver.getBackend());
+    configureBackend(prefactoredSolver.getBackend());
+    // the workers of the parallel loops, so that the first drag frame does not start threads
+    parallelForReserve();
+}
+
+void DeformationEngine::setSolverBackend(SolverBackend::Kind kind){
+    solver.setBackend(kind);
+    prefactoredSolver.setBackend(kind);
+    configureBackend(solver.getBackend());
+    configureBackend(prefactoredSolver.getBackend());
+}
+
+void DeformationEngine::configureBackend(SolverBackend &backend){
+    backend.setGrid(mesh.horizontalDivisions, mesh.verticalDivisions);
+    backend.setTriangles(mesh.numVertices, mesh.numTriangles, mesh.triangles, mesh.ix, mesh.iy);
+    // the previous frame is the initial guess of the iterative backends
+    if(MultigridBackend *mg = dynamic_cast<MultigridBackend *>(&backend)){
+        mg->cycleBudget = multigridCycles;
+    }
+    if(MatrixFreeCGBackend *cg = dynamic_cast<MatrixFreeCGBackend *>(&backend)){
+        cg->iterationBudget = cgIterations;
+        cg->tolerance = cgTolerance;
+    }
+    if(BlockLDLTBackend *block = dynamic_cast<BlockLDLTBackend *>(&backend)){
+        block->ordering = blockOrdering;
+    }
+}
+
+SolverBackend &DeformationEngine::backend(){
+    return prefactored ? prefactoredSolver.getBackend() : solver.getBackend();
+}
+
+void DeformationEngine::resetTimings(){
+    solver.getBackend().resetTimings();
+    prefactoredSolver.getBackend().resetTimings();
+    assemblyTime = localStepTime = basisTime = 0;
+    numLocalSteps = 0;
+}
+
+// prepare the energy matrix
+void DeformationEngine::formEnergy(){
+    if(mesh.numSelected==0){
+        return;
+    }
+    // a gesture starts from the rest orientation of the triangles
+    arap.resetRotations();
+    // and the iterative backends from the current shape, which the handles only move locally
+    for(int i=0;i<mesh.numVertices;i++){
+        Sol(i) = arap.Sol(i,0) = mesh.x[i];
+        Sol(i+mesh.numVertices) = arap.Sol(i,1) = mesh.y[i];
+    }
+    if(prefactored){
+        // the rest pose is kept, so only the handles change unless the energy itself has to be rebuilt
+        if(!prefactoredSolver.isFactorized()){
+            if(mode==ARAP){
+                formEnergyARAP();
+            }else if(mode==Sim){
+                formEnergySim();
+            }
+        }
+        setHandles();
+        computeHandleBasis();
+        return;
+    }
+    // all starting points are updated
+    for(int j=0;j<mesh.numVertices;j++){
+        mesh.ix[j] = mesh.x[j];
+        mesh.iy[j] = mesh.y[j];
+    }
+    if(mode==ARAP){
+        formEnergyARAP();
+    }else if(mode==Sim){
+        formEnergySim();
+    }
+    setHandles();
+    computeHandleBasis();
+}
+
+// Similarity invariant energy
+void DeformationEngine::formEnergySim(){
+    auto start = std::chrono::steady_clock::now();
+    // the sparsity pattern only depends on the triangulation; afterwards only the values are recomputed
+    if(!simAssembly.isAnalyzed()){
+        PROFILE_STAGE(SetFromTriplets);
+        simAssembly.analyze(mesh.numVertices, mesh.numTriangles, mesh.triangles);
+    }
+    // compute the energy derivation matrix (constraints are eliminated symmetrically by the solver)
+    {
+        PROFILE_STAGE(Assembly);
+        simAssembly.assemble(mesh.ix, mesh.iy);
+    }
+    const SpMat &G = simAssembly.matrix();
+    assemblyTime += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    PROFILE_COUNTER(NonZeros, G.nonZeros());
+    if(prefactored){
+        // two pinned vertices kill the similarity invariance of the energy
+        int last=mesh.numVertices-1;
+        {
+            PROFILE_STAGE(Factorize);
+            prefactoredSolver.factorize(G, {0, mesh.numVertices, last, last+mesh.numVertices});
+        }
+        PROFILE_COUNTER(FillIn, fillIn(prefactoredSolver.getBackend(), G));
+        return;
+    }
+    solver.setEnergy(G);
+}
+
+// ARAP energy
+void DeformationEngine::formEnergyARAP(){
+    auto start = std::chrono::steady_clock::now();
+    int n=mesh.numVertices;
+    SpMat G(n, n);
+    std::vector<T> tripletListMat(0);
+    tripletListMat.reserve(mesh.numTriangles*9);
+    // the same energy with the products in double, for the residuals of the refinement
+    std::vector<TD> preciseTriplets;
+    preciseTriplets.reserve(mesh.numTriangles*9);
+    {
+        PROFILE_STAGE(Assembly);
+        // inverted mesh matrices of the rest pose
+        arap.computePinv(mesh.ix, mesh.iy, mesh.triangles);
+        // partial derivative of the energy |B-I|^2, where B=VP^{-1}
+        arap.energyTriplets(mesh.triangles, tripletListMat);
+        arap.energyTriplets(mesh.triangles, preciseTriplets);
+    }
+    {
+        PROFILE_STAGE(SetFromTriplets);
+        G.setFromTriplets(tripletListMat.begin(), tripletListMat.end());
+        preciseARAP.resize(n, n);
+        preciseARAP.setFromTriplets(preciseTriplets.begin(), preciseTriplets.end());
+    }
+    assemblyTime += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    PROFILE_COUNTER(NonZeros, G.nonZeros());
+    if(prefactored){
+        // a single pinned vertex kills the translation invariance of the energy
+        {
+            PROFILE_STAGE(Factorize);
+            prefactoredSolver.factorize(G, {0});
+        }
+        PROFILE_COUNTER(FillIn, fillIn(prefactoredSolver.getBackend(), G));
+        return;
+    }
+    solver.setEnergy(G);
+}
+
+// constrained DOFs: the touched vertices (and the lower left corner when a single vertex fixes Sim)
+void DeformationEngine::setHandles(){
+    handles.clear();
+    int n=mesh.numVertices;
+    for(int s=0;s<mesh.numSelected;s++){
+        int i=mesh.selected[s];
+        handles.push_back(i);
+        if(mode==Sim) handles.push_back(i+n);
+    }
+    if(mode==Sim && mesh.numSelected==1){
+        handles.push_back(0);
+        handles.push_back(n);
+    }
+    if(prefactored){
+        PROFILE_STAGE(Factorize);
+        prefactoredSolver.setHandles(handles);
+    }else{
+        {
+            PROFILE_STAGE(Factorize);
+            solver.setConstraints(handles);
+        }
+        PROFILE_COUNTER(FillIn, fillIn(solver.getBackend(), solver.energy()));
+    }
+}
+
+// The Sim solution is linear in the handle values (the constrained rows of V, all other rows being zero),
+// so it is the combination of the solutions for unit handle values, computed here with the factorization
+void DeformationEngine::computeHandleBasis(){
+    basisValid = false;
+    if(!handleBasis || mode!=Sim || handles.empty()) return;
+    auto start = std::chrono::steady_clock::now();
+    int n = 2*mesh.numVertices, h = (int)handles.size();
+    MatrixXf unit = MatrixXf::Zero(n, h);
+    for(int k=0;k<h;k++) unit(handles[k], k) = 1;
+    basis = MatrixXf::Zero(n, h);
+    solveLinearSystem(unit, basis);
+    // the refinement buffers grew to h columns; back to the size of a drag
+    refiner.resize(n, 1);
+    handleValues.resize(h);
+    basisValid = backend().succeeded();
+    basisTime += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+void DeformationEngine::solve(){
+    if(mesh.numSelected==0) return;
+    if(mode==ARAP){
+        solveARAP();
+    }else if(mode==Sim){
+        solveSim();
+    }
+}
+
+// determine the location of un-constraint vertices by solving a linear system
+void DeformationEngine::solveSim(){
+    V.setZero();
+    if(mesh.numSelected==1){
+        int index=mesh.selected[0];
+        mesh.x[0] = mesh.ix[0] + mesh.x[index]-mesh.ix[index];
+        mesh.y[0] = mesh.iy[0] + mesh.y[index]-mesh.iy[index];
+        V(0) = mesh.x[0];
+        V(mesh.numVertices) = mesh.y[0];
+    }
+    for(int k=0;k<mesh.numSelected;k++){
+        int i=mesh.selected[k];
+        int j=i+mesh.numVertices;
+        V(i) = mesh.x[i];
+        V(j) = mesh.y[i];
+    }
+    if(basisValid && handleBasis){
+        // dense (2n x handles) product, vectorised by Eigen, in row blocks
+        PROFILE_STAGE(Solve);
+        for(int k=0;k<(int)handles.size();k++) handleValues(k) = V(handles[k]);
+        parallelFor(0, (int)Sol.rows(), 16384, [&](int lo, int hi){
+            Sol.col(0).segment(lo, hi-lo).noalias() = basis.middleRows(lo, hi-lo)*handleValues;
+        });
+    }else{
+        solveLinearSystem(V, Sol);
+    }
+    for(int i=0;i<mesh.numVertices;i++){
+        mesh.x[i] = Sol(i);
+        mesh.y[i] = Sol(i+mesh.numVertices);
+    }
+}
+
+void DeformationEngine::solveARAP(){
+    auto frameStart = std::chrono::steady_clock::now();
+    bool budgeted = arapBudget>0;
+    // without a budget every drag starts from the rest orientation of the triangles;
+    // with one, from the rotations the previous frame ended with
+    if(!budgeted) arap.resetRotations();
+    progress = ArapProgress();
+    {
+        PROFILE_STAGE(ArapRHS);
+        arap.formRHS(mesh.triangles, mesh.selected, mesh.numSelected, mesh.x, mesh.y);
+    }
+    solveLinearSystem(arap.U, arap.Sol);
+    progress.iterations = 1;
+    // iterative refinement
+    for(int iter=1;budgeted || iter<iteration;iter++){
+        auto start = std::chrono::steady_clock::now();
+        // local step: rotation parts of B*Pinv in one batch
+        {
+            PROFILE_STAGE(Rotations);
+            arap.fitRotations(mesh.triangles);
+        }
+        progress.energy = arap.energy();
+        progress.rotationChange = arap.rotationChange();
+        if(budgeted && progress.rotationChange<=arapTolerance){
+            progress.converged = true;
+            localStepTime += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+            numLocalSteps++;
+            break;
+        }
+        {
+            PROFILE_STAGE(ArapRHS);
+            arap.formRHS(mesh.triangles, mesh.selected, mesh.numSelected, mesh.x, mesh.y);
+        }
+        localStepTime += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+        numLocalSteps++;
+        solveLinearSystem(arap.U, arap.Sol);
+        progress.iterations++;
+        if(budgeted && arapRounds>0){
+            if(progress.iterations>=arapRounds) break;
+        }else if(budgeted){
+            // stop unless another round, taken to cost the average so far, still fits
+            double spent = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - frameStart).count();
+            if(spent + spent/progress.iterations > arapBudget) break;
+        }
+    }
+    PROFILE_COUNTER(ArapIterations, progress.iterations);
+    // set coordinates
+    for(int i=0;i<mesh.numVertices;i++){
+        mesh.x[i] = arap.Sol(i,0);
+        mesh.y[i] = arap.Sol(i,1);
+    }
+}
+
+// solve the current energy with the right-hand side b (constrained rows hold the target values)
+void DeformationEngine::solveLinearSystem(const MatrixXf &b, MatrixXf &x){
+    PROFILE_STAGE(Solve);
+    if(prefactored){
+        prefactoredSolver.solve(b, x);
+    }else{
+        solver.solve(b, x);
+    }
+    // residuals of the double energy, corrections from the float factorization
+    refiner.maxSteps = refinementSteps;
+    const SpMatD &K = mode==ARAP ? preciseARAP : simAssembly.preciseMatrix();
+    refiner.refine(K, handles, b, x, [this](const MatrixXf &r, MatrixXf &dx){
+        if(prefactored){
+            prefactoredSolver.solve(r, dx);
+        }else{
+            solver.solve(r, dx);
+        }
+    });
+}
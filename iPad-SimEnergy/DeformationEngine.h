@@ -0,0 +1,137 @@
+//
+//  DeformationEngine.h
+//  iPad-SimEnergy
+//
+//  Platform-neutral core of the deformation: assembly of the Sim and ARAP
+//  energies, their factorization for the current handles, and the per-frame
+//  solve (with the ARAP local/global iteration).
+//
+//  The vertex arrays are owned by the caller (ImageMesh in the app, GridMesh
+//  in the benchmark) and are read and written in place; the engine only keeps
+//  the matrices and the per-mesh workspaces.
+//
+
+#ifndef DeformationEngine_h
+#define DeformationEngine_h
+
+#include "SolverBackend.h"
+#include "PrefactoredSolver.h"
+#include "ArapWorkspace.h"
+#include "SimAssembly.h"
+#include "IterativeRefinement.h"
+#include "FrameProfiler.h"
+
+// arrays of a triangulated mesh, as laid out by ImageMesh
+struct DeformationMesh {
+    // grid structure, used by the geometric backends (0 for a general mesh)
+    int horizontalDivisions = 0, verticalDivisions = 0;
+    int numVertices = 0, numTriangles = 0;
+    // current vertex coordinates
+    float *x = nullptr, *y = nullptr;
+    // initial vertex coordinates
+    float *ix = nullptr, *iy = nullptr;
+    // vertex index of triangles
+    const int *triangles = nullptr;
+    // list of the indices of the selected vertices
+    const int *selected = nullptr;
+    int numSelected = 0;
+};
+
+class DeformationEngine {
+public:
+    enum Mode { Sim = 0, ARAP = 1 };
+
+    int mode = Sim;
+    // local/global iterations of ARAP per frame
+    int iteration = 1;
+    // keep the rest pose and factorise the energy only once (handles via Schur complement)
+    bool prefactored = false;
+    // budget of V-cycles per solve of the Multigrid backend (applied by setSolverBackend)
+    int multigridCycles = 20;
+    // iteration budget and relative tolerance of the MatrixFreeCG backend (applied by setSolverBackend)
+    int cgIterations = 100;
+    double cgTolerance = 1e-6;
+    // vertex ordering of the BlockLDLT backend (applied by setSolverBackend)
+    BlockLDLTBackend::Ordering blockOrdering = BlockLDLTBackend::NestedDissection;
+    // mixed precision: steps of iterative refinement per solve, with double residuals (0: float only)
+    int refinementSteps = 0;
+    // Sim: solve once per handle DOF at formEnergy(), then every drag is a dense product with that basis
+    bool handleBasis = false;
+    // ARAP: time budget of the local/global rounds of a frame in milliseconds (0: exactly `iteration` rounds).
+    // With a budget the rotations carry over between frames, so unfinished rounds continue in the next one.
+    double arapBudget = 0;
+    // ARAP with a budget: the rounds stop once the rotations change less than this (RMS of the entries)
+    double arapTolerance = 1e-4;
+    // ARAP with a budget: at most this many rounds in place of the timing (0: as many as the budget allows),
+    // so that a recorded session replays the rounds each frame took
+    int arapRounds = 0;
+
+    // convergence of the ARAP rounds of the last frame
+    struct ArapProgress {
+        // global steps; energy and rotation change measured by the last local step
+        int iterations = 0;
+        double energy = 0, rotationChange = 0;
+        // stopped by the tolerance rather than the budget
+        bool converged = false;
+    };
+
+    // timings in milliseconds since resetTimings()
+    double assemblyTime = 0, localStepTime = 0, basisTime = 0;
+    int numLocalSteps = 0;
+
+    DeformationEngine();
+
+    // the arrays must stay valid until the next setMesh(); all per-frame storage is allocated here
+    void setMesh(const DeformationMesh &mesh);
+    DeformationMesh &getMesh(){ return mesh; }
+    // the selection lives in the caller's arrays; only its size is copied
+    void setNumSelected(int numSelected){ mesh.numSelected = numSelected; }
+
+    // choose the linear solver
+    void setSolverBackend(SolverBackend::Kind kind);
+    SolverBackend &backend();
+
+    // touch down/up: rebuild the energy for the current rest pose and handles
+    void formEnergy();
+    // drag: positions of the free vertices for the current handle positions
+    void solve();
+    // the rest pose or the mode changed, so a kept factorization is stale
+    void invalidate(){ prefactoredSolver.invalidate(); }
+    // convergence of the refinement in the last solve
+    const IterativeRefinement &refinement() const { return refiner; }
+    const ArapProgress &arapProgress() const { return progress; }
+
+    void resetTimings();
+
+private:
+    void formEnergySim();
+    void formEnergyARAP();
+    void setHandles();
+    void solveSim();
+    void solveARAP();
+    void solveLinearSystem(const Eigen::MatrixXf &b, Eigen::MatrixXf &x);
+    void computeHandleBasis();
+    void configureBackend(SolverBackend &backend);
+
+    DeformationMesh mesh;
+    ConstrainedSolver solver;
+    // factorised once per rest pose; used when prefactored is set
+    PrefactoredSolver prefactoredSolver;
+    // pattern and scatter map of the Sim energy
+    SimAssembly simAssembly;
+    // the ARAP energy in double (the Sim one is kept by simAssembly)
+    SpMatD preciseARAP;
+    // inverted mesh matrices, local rotations and buffers of the ARAP iteration
+    ArapWorkspace arap;
+    // right-hand side and solution of the Sim system
+    Eigen::MatrixXf V, Sol;
+    std::vector<int> handles;
+    IterativeRefinement refiner;
+    // Sim response to a unit move of each handle DOF (2n x handles), and the handle values of a frame
+    Eigen::MatrixXf basis;
+    Eigen::VectorXf handleValues;
+    bool basisValid = false;
+    ArapProgress progress;
+};
+
+#endif /* DeformationEngine_h */
@@ -0,0 +1,257 @@
+//
+//  FrameProfiler.h
+//  iPad-SimEnergy
+//
+//  Scoped timers and counters on the stages of a frame, for telling where a
+//  slow frame went: assembly, setFromTriplets, factorization, solve, ARAP
+//  rotations and right-hand side, and the mesh update of the renderer.
+//  Enabled by defining PROFILE_FRAMES; otherwise PROFILE_STAGE and
+//  PROFILE_COUNTER expand to nothing, their arguments are not evaluated, and
+//  none of the code below is compiled.
+//
+//  Every thread writes into its own ring of the last RING_SIZE events with a
+//  plain store and a release of the write index, so recording takes no lock
+//  and does not allocate after the first event of the thread (which registers
+//  its ring). A stage event holds the heap allocations the thread made inside
+//  the scope (counted with DEBUG_ALLOCATIONS only, see AllocationCounter.h).
+//  writeChromeTrace() dumps the rings as Chrome trace-event JSON (load it in
+//  chrome://tracing or Perfetto), printSummary() the p50/p99 latency of each
+//  stage. Both are meant to run while the profiled threads are idle; events
+//  overwritten during a dump are skipped.
+//
+
+#ifndef FrameProfiler_h
+#define FrameProfiler_h
+
+#ifdef PROFILE_FRAMES
+
+#include "AllocationCounter.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace FrameProfiler {
+
+enum Stage : uint16_t {
+    // the solve of a drag request on the worker
+    Frame,
+    // a touch down/up request: energy, handles and factorization
+    Rebuild,
+    // values of the energy matrix (Sim scatter, ARAP triplets)
+    Assembly,
+    SetFromTriplets,
+    // symbolic and numeric factorization for the handles
+    Factorize,
+    // back-substitutions with refinement, or the product with the handle basis
+    Solve,
+    // ARAP local step: the rotations of the triangles
+    Rotations,
+    ArapRHS,
+    // copy of the published vertices into the mesh of the renderer
+    Deform,
+    NumStages
+};
+
+enum Counter : uint16_t {
+    // entries of the energy matrix
+    NonZeros,
+    // entries of the factors that are zero in the matrix (0 for the iterative backends)
+    FillIn,
+    // ARAP global steps of a frame
+    ArapIterations,
+    // heap allocations of a drag request
+    Allocations,
+    NumCounters
+};
+
+inline const char *stageName(int stage){
+    static const char *names[NumStages] = {"frame", "rebuild", "assembly", "setFromTriplets", "factorize",
+                                           "solve", "rotations", "arapRHS", "deform"};
+    return names[stage];
+}
+inline const char *counterName(int counter){
+    static const char *names[NumCounters] = {"nnz", "fill-in", "ARAP iterations", "allocations"};
+    return names[counter];
+}
+
+struct Event {
+    // nanoseconds since the start of the profiler; duration 0 for counters
+    int64_t start, duration;
+    // allocations in a stage, or the value of a counter
+    int64_t value;
+    uint16_t id;
+    bool counter;
+};
+
+static const uint64_t RING_SIZE = 1 << 13;
+
+// events of one thread; written by that thread only
+struct Ring {
+    Event events[RING_SIZE];
+    // events written so far, and the first one still to report
+    std::atomic<uint64_t> written{0}, first{0};
+    int thread = 0;
+
+    void push(const Event &e){
+        uint64_t w = written.load(std::memory_order_relaxed);
+        events[w & (RING_SIZE-1)] = e;
+        written.store(w+1, std::memory_order_release);
+    }
+    // the events still in the ring, oldest first
+    void snapshot(std::vector<Event> &out) const {
+        uint64_t end = written.load(std::memory_order_acquire);
+        uint64_t begin = std::max(first.load(std::memory_order_relaxed), end>RING_SIZE ? end-RING_SIZE : 0);
+        size_t offset = out.size();
+        for(uint64_t k=begin;k<end;k++) out.push_back(events[k & (RING_SIZE-1)]);
+        // drop what the thread overwrote while we were copying
+        uint64_t now = written.load(std::memory_order_acquire);
+        if(now>RING_SIZE && now-RING_SIZE>begin){
+            size_t lost = (size_t)std::min(end-begin, now-RING_SIZE-begin);
+            out.erase(out.begin()+offset, out.begin()+offset+lost);
+        }
+    }
+};
+
+// the rings of all threads that recorded something; they live until exit, as their threads may not
+struct Registry {
+    std::mutex mutex;
+    std::vector<std::unique_ptr<Ring>> rings;
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+    static Registry &instance(){
+        static Registry registry;
+        return registry;
+    }
+};
+
+inline Ring &threadRing(){
+    static thread_local Ring *ring = nullptr;
+    if(!ring){
+        Registry &registry = Registry::instance();
+        std::lock_guard<std::mutex> lock(registry.mutex);
+        registry.rings.emplace_back(new Ring());
+        ring = registry.rings.back().get();
+        ring->thread = (int)registry.rings.size();
+    }
+    return *ring;
+}
+
+inline int64_t now(){
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - Registry::instance().start).count();
+}
+
+inline void count(Counter counter, long value){
+    threadRing().push(Event{now(), 0, value, counter, true});
+}
+
+class Scope {
+public:
+    explicit Scope(Stage stage) : stage(stage), allocations(AllocationCounter::count()), start(now()) {}
+    ~Scope(){
+        int64_t end = now();
+        threadRing().push(Event{start, end-start, AllocationCounter::count()-allocations, stage, false});
+    }
+    Scope(const Scope &) = delete;
+    Scope &operator=(const Scope &) = delete;
+
+private:
+    Stage stage;
+    long allocations;
+    int64_t start;
+};
+
+// events of every thread, with the thread number of each
+inline std::vector<std::pair<int, Event>> collect(){
+    Registry &registry = Registry::instance();
+    std::lock_guard<std::mutex> lock(registry.mutex);
+    std::vector<std::pair<int, Event>> all;
+    std::vector<Event> events;
+    for(const auto &ring : registry.rings){
+        events.clear();
+        ring->snapshot(events);
+        for(const Event &e : events) all.emplace_back(ring->thread, e);
+    }
+    return all;
+}
+
+// forget the events recorded so far
+inline void clear(){
+    Registry &registry = Registry::instance();
+    std::lock_guard<std::mutex> lock(registry.mutex);
+    for(const auto &ring : registry.rings){
+        ring->first.store(ring->written.load(std::memory_order_acquire), std::memory_order_relaxed);
+    }
+}
+
+// complete events ("X") for the stages and counter events ("C"), in microseconds
+inline bool writeChromeTrace(const char *path){
+    std::FILE *file = std::fopen(path, "w");
+    if(!file) return false;
+    std::fprintf(file, "{\"traceEvents\":[\n");
+    bool comma = false;
+    for(const auto &te : collect()){
+        const Event &e = te.second;
+        if(e.counter){
+            std::fprintf(file, "%s{\"name\":\"%s\",\"ph\":\"C\",\"ts\":%.3f,\"pid\":1,\"tid\":%d,\"args\":{\"value\":%lld}}",
+                         comma ? ",\n" : "", counterName(e.id), e.start/1000.0, te.first, (long long)e.value);
+        }else{
+            std::fprintf(file, "%s{\"name\":\"%s\",\"cat\":\"stage\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,\"pid\":1,\"tid\":%d,\"args\":{\"allocations\":%lld}}",
+                         comma ? ",\n" : "", stageName(e.id), e.start/1000.0, e.duration/1000.0, te.first, (long long)e.value);
+        }
+        comma = true;
+    }
+    std::fprintf(file, "\n],\"displayTimeUnit\":\"ms\"}\n");
+    return std::fclose(file)==0;
+}
+
+// per stage: count, p50, p99 and max in milliseconds, and the allocations; per counter: last and largest value
+inline void printSummary(std::FILE *out){
+    std::vector<double> times[NumStages];
+    long allocations[NumStages] = {};
+    long last[NumCounters] = {}, largest[NumCounters] = {};
+    int samples[NumCounters] = {};
+    for(const auto &te : collect()){
+        const Event &e = te.second;
+        if(e.counter){
+            last[e.id] = (long)e.value;
+            largest[e.id] = samples[e.id]++ ? std::max(largest[e.id], (long)e.value) : (long)e.value;
+        }else{
+            times[e.id].push_back(e.duration/1e6);
+            allocations[e.id] += (long)e.value;
+        }
+    }
+    std::fprintf(out, "%-16s %8s %10s %10s %10s %12s\n", "stage", "count", "p50 ms", "p99 ms", "max ms", "allocations");
+    for(int s=0;s<NumStages;s++){
+        std::vector<double> &t = times[s];
+        if(t.empty()) continue;
+        std::sort(t.begin(), t.end());
+        auto percentile = [&](double p){ return t[std::min(t.size()-1, (size_t)(p*t.size()))]; };
+        std::fprintf(out, "%-16s %8zu %10.3f %10.3f %10.3f %12ld\n", stageName(s), t.size(), percentile(0.5), percentile(0.99),
+                     t.back(), allocations[s]);
+    }
+    for(int c=0;c<NumCounters;c++){
+        if(samples[c]==0) continue;
+        std::fprintf(out, "%-16s last %ld, max %ld over %d samples\n", counterName(c), last[c], largest[c], samples[c]);
+    }
+}
+
+}
+
+#define PROFILE_CONCAT_(a, b) a##b
+#define PROFILE_CONCAT(a, b) PROFILE_CONCAT_(a, b)
+#define PROFILE_STAGE(stage) ::FrameProfiler::Scope PROFILE_CONCAT(profileScope, __LINE__)(::FrameProfiler::stage)
+#define PROFILE_COUNTER(counter, value) ::FrameProfiler::count(::FrameProfiler::counter, (long)(value))
+
+#else
+
+#define PROFILE_STAGE(stage) ((void)0)
+#define PROFILE_COUNTER(counter, value) ((void)0)
+
+#endif
+
+#endif /* FrameProfiler_h */
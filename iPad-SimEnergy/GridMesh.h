@@ -0,0 +1,93 @@
+//
+//  GridMesh.h
+//  iPad-SimEnergy
+//
+//  The regular triangulated grid of ImageMesh without the OpenGL buffers,
+//  for running the deformation headless (benchmarks, tools). Vertices,
+//  triangles and the rest pose are laid out exactly as in ImageMesh.m.
+//
+
+#ifndef GridMesh_h
+#define GridMesh_h
+
+#include "DeformationEngine.h"
+
+class GridMesh {
+public:
+    int horizontalDivisions, verticalDivisions;
+    int numVertices, numTriangles;
+    float width, height;
+    std::vector<float> x, y, ix, iy;
+    std::vector<int> triangles, selected;
+
+    GridMesh(float width, float height, int verticalDivisions, int horizontalDivisions)
+    : horizontalDivisions(horizontalDivisions), verticalDivisions(verticalDivisions),
+      numVertices((verticalDivisions+1)*(horizontalDivisions+1)),
+      numTriangles(2*verticalDivisions*horizontalDivisions),
+      width(width), height(height){
+        // triangle strip of each row, as the vertexIndices of ImageMesh
+        std::vector<int> vertexIndices;
+        vertexIndices.reserve(2*verticalDivisions*(horizontalDivisions+1));
+        for(int j=0;j<verticalDivisions;j++){
+            for(int i=0;i<=horizontalDivisions;i++){
+                vertexIndices.push_back((j+1)*(horizontalDivisions+1)+i);   // lower
+                vertexIndices.push_back(j*(horizontalDivisions+1)+i);       // upper
+            }
+        }
+        triangles.reserve(3*numTriangles);
+        int stv=0;
+        for(int j=0;j<verticalDivisions;j++){
+            for(int i=0;i<2*horizontalDivisions;i++){
+                triangles.push_back(vertexIndices[stv]);
+                triangles.push_back(vertexIndices[stv+1]);
+                triangles.push_back(vertexIndices[stv+2]);
+                stv++;
+            }
+            stv = stv+2;
+        }
+        x.resize(numVertices);
+        y.resize(numVertices);
+        ix.resize(numVertices);
+        iy.resize(numVertices);
+        selected.reserve(numVertices);
+        initialize();
+    }
+
+    // rest pose centred at the origin; no vertex is selected
+    void initialize(){
+        float stX = -width/2;
+        float stY = -height/2;
+        int count = 0;
+        for(int j=0;j<=verticalDivisions;j++){
+            for(int i=0;i<=horizontalDivisions;i++){
+                x[count] = i*(width/horizontalDivisions) + stX;
+                y[count] = j*(height/verticalDivisions) + stY;
+                ix[count] = x[count];
+                iy[count] = y[count];
+                count++;
+            }
+        }
+        selected.clear();
+    }
+
+    int vertex(int i, int j) const { return j*(horizontalDivisions+1)+i; }
+
+    // arrays for DeformationEngine::setMesh; valid while the mesh lives and selected is not reallocated
+    DeformationMesh view(){
+        DeformationMesh m;
+        m.horizontalDivisions = horizontalDivisions;
+        m.verticalDivisions = verticalDivisions;
+        m.numVertices = numVertices;
+        m.numTriangles = numTriangles;
+        m.x = x.data();
+        m.y = y.data();
+        m.ix = ix.data();
+        m.iy = iy.data();
+        m.triangles = triangles.data();
+        m.selected = selected.data();
+        m.numSelected = (int)selected.size();
+        return m;
+    }
+};
+
+#endif /* GridMesh_h */
@@ -103,26 +103,6 @@ extension ImageMesh {
     
     // MARK: - Geometric Calculations
     
-    func findNearestVertex(to point: (x: Float, y: Float), maxDistance: Float = -1) -> Int? {
-        let searchRadius = maxDistance > 0 ? maxDistance : self.radius
-        var nearestIndex: Int?
-        var minDistance = searchRadius
-        
-        // Skip vertex 0 as it's reserved for constraint handling
-        for i in 1..<Int(numVertices) {
-            let dx = point.x - x[i]
-            let dy = point.y - y[i]
-            let distance = sqrt(dx * dx + dy * dy)
-            
-            if distance < minDistance {
-                minDistance = distance
-                nearestIndex = i
-            }
-        }
-        
-        return nearestIndex
-    }
-    
     func calculateMeshBounds() -> (min: (x: Float, y: Float), max: (x: Float, y: Float)) {
         guard numVertices > 0 else {
             return (min: (x: 0, y: 0), max: (x: 0, y: 0))
@@ -46,6 +46,9 @@
 // radius for a point ( used for touch recognision )
 @property float radius;
 
+// texture coordinates of the vertices of a general mesh (NULL for the grid)
+@property GLfloat *u, *v;
+
 // current vertex coordinates
 @property GLfloat *x, *y;
 // initial vertex coordinates
@@ -61,8 +64,12 @@
 
 - (void)dealloc;
 
-// init
+// init; the grid resolution is only limited by memory (all arrays live on the heap)
 - (ImageMesh*)initWithUIImage:(UIImage*)uiImage VerticalDivisions:(GLuint)verticalDivisions HorizontalDivisions:(GLuint)horizotalDivisions;
+- (ImageMesh*)initWithWidth:(float)width Height:(float)height VerticalDivisions:(GLuint)verticalDivisions HorizontalDivisions:(GLuint)horizotalDivisions;
+// a general triangulation (such as AdaptiveMesh), drawn as GL_TRIANGLES; both divisions are 0.
+// The rest pose is given by the texture coordinates; the arrays are copied.
+- (ImageMesh*)initWithWidth:(float)width Height:(float)height NumVertices:(int)numVertices U:(const float*)u V:(const float*)v NumTriangles:(int)numTriangles Triangles:(const int*)triangles Radius:(float)radius;
 
 - (void)deform;
 - (void)initialize;
@@ -34,7 +34,7 @@
 @synthesize image_width,image_height;
 
 @synthesize numVertices;
-@synthesize radius,x,y,ix,iy;
+@synthesize radius,u,v,x,y,ix,iy;
 @synthesize selected,numSelected;
 @synthesize triangles,numTriangles;
 
@@ -44,6 +44,8 @@
     free(verticesArr);
     free(textureCoordsArr);
     free(vertexIndices);
+    free(u);
+    free(v);
     free(x);
     free(y);
     free(ix);
@@ -54,14 +56,17 @@
 
 // init
 - (ImageMesh*)initWithUIImage:(UIImage*)uiImage VerticalDivisions:(GLuint)lverticalDivisions HorizontalDivisions:(GLuint)lhorizontalDivisions{
+    return [self initWithWidth:(float)uiImage.size.width Height:(float)uiImage.size.height VerticalDivisions:lverticalDivisions HorizontalDivisions:lhorizontalDivisions];
+}
+- (ImageMesh*)initWithWidth:(float)width Height:(float)height VerticalDivisions:(GLuint)lverticalDivisions HorizontalDivisions:(GLuint)lhorizontalDivisions{
     if (self = [super init]) {
         verticalDivisions = lverticalDivisions;
         horizontalDivisions = lhorizontalDivisions;
         numVertices = (verticalDivisions+1) * (horizontalDivisions+1);
         indexArrsize = 2 * verticalDivisions * (horizontalDivisions+1);
         numTriangles = 2 * verticalDivisions * horizontalDivisions;
-        image_width = (float)uiImage.size.width;
-        image_height = (float)uiImage.size.height;
+        image_width = width;
+        image_height = height;
         float r = image_width/(float)horizontalDivisions;
         radius = r*r;
 
@@ -116,6 +121,44 @@
     }
     return self;
 }
+- (ImageMesh*)initWithWidth:(float)width Height:(float)height NumVertices:(int)lnumVertices U:(const float*)lu V:(const float*)lv NumTriangles:(int)lnumTriangles Triangles:(const int*)ltriangles Radius:(float)lradius{
+    if (self = [super init]) {
+        verticalDivisions = 0;
+        horizontalDivisions = 0;
+        numVertices = lnumVertices;
+        numTriangles = lnumTriangles;
+        // every triangle is drawn on its own
+        indexArrsize = 3 * numTriangles;
+        image_width = width;
+        image_height = height;
+        radius = lradius*lradius;
+
+        //malloc
+        verticesArr = malloc(2 * indexArrsize * sizeof(*verticesArr));
+        textureCoordsArr = malloc(2 * indexArrsize * sizeof(*textureCoordsArr));
+        vertexIndices = malloc(indexArrsize * sizeof(*vertexIndices));
+        u = malloc(numVertices * sizeof(*u));
+        v = malloc(numVertices * sizeof(*v));
+        x = malloc(numVertices * sizeof(*x));
+        y = malloc(numVertices * sizeof(*y));
+        ix = malloc(numVertices * sizeof(*ix));
+        iy = malloc(numVertices * sizeof(*iy));
+        selected = malloc(numVertices * sizeof(*selected));
+        numSelected = 0;
+        triangles = malloc(3 * numTriangles * sizeof(*triangles));
+
+        memcpy(u, lu, numVertices * sizeof(*u));
+        memcpy(v, lv, numVertices * sizeof(*v));
+        memcpy(triangles, ltriangles, 3 * numTriangles * sizeof(*triangles));
+        memcpy(vertexIndices, ltriangles, indexArrsize * sizeof(*vertexIndices));
+        for (int i=0; i<indexArrsize; i++) {
+            textureCoordsArr[2*i] = u[vertexIndices[i]];
+            textureCoordsArr[2*i+1] = v[vertexIndices[i]];
+        }
+        [self initialize];
+    }
+    return self;
+}
 // set coordinates
 - (void)deform{
     // prepare OpenGL vertices
@@ -128,6 +171,16 @@
     // prepare mesh vertices
     float stX = - image_width / 2;
     float stY = - image_height / 2;
+    if (horizontalDivisions == 0) {
+        // general mesh: the rest pose is where the vertices show their texture coordinates
+        for (int i=0; i<numVertices; i++) {
+            x[i] = ix[i] = u[i] * image_width + stX;
+            y[i] = iy[i] = v[i] * image_height + stY;
+        }
+        numSelected = 0;
+        [self deform];
+        return;
+    }
     int count = 0;
     float width = (image_width)/horizontalDivisions;
     float height = (image_height)/verticalDivisions;
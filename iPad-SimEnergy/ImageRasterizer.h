@@ -0,0 +1,231 @@
+//
+//  ImageRasterizer.h
+//  iPad-SimEnergy
+//
+//  Offscreen rasterizer of the deformed image at an arbitrary resolution,
+//  for exports beyond the screen size.
+//
+//  The deformed triangles are binned into tiles of TILE_ROWS output rows;
+//  renderRows() fills any range of rows by rasterizing its tiles in parallel,
+//  sampling the source image bilinearly at the interpolated texture
+//  coordinates. Triangles are drawn in index order, as OpenGL draws the
+//  strips, so folded-over parts look the same as on screen. Since rows can
+//  be produced in order and in chunks, the output can be streamed to an
+//  encoder without ever holding the whole image (rasterize()).
+//
+//  The source need not be held whole either: sourceRows() gives the band of
+//  source rows that a range of output rows samples, and renderRows() accepts
+//  that band alone (Image::top). A band is bounded by the texture extent of
+//  the triangles over those output rows, so it stays a small fraction of the
+//  source unless the mesh is folded or squeezed so far that a few output rows
+//  show most of the image; in the worst case it is the whole source.
+//
+//  Pixels are RGBA with 8 bits per channel; uncovered pixels are transparent.
+//
+
+#ifndef ImageRasterizer_h
+#define ImageRasterizer_h
+
+#include "ParallelFor.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+class ImageRasterizer {
+public:
+    static const int TILE_ROWS = 32;
+
+    // source pixels, top row first; width and height are those of the whole source, while pixels may
+    // hold just a band of it that starts at row top
+    struct Image {
+        const uint8_t *pixels = nullptr;
+        int width = 0, height = 0;
+        size_t stride = 0;
+        int top = 0;
+    };
+
+    // texture coordinates of the grid vertices of ImageMesh (origin at the lower left)
+    static void gridTextureCoordinates(int horizontalDivisions, int verticalDivisions, float *u, float *v){
+        for(int j=0;j<=verticalDivisions;j++){
+            for(int i=0;i<=horizontalDivisions;i++){
+                u[j*(horizontalDivisions+1)+i] = i*(1.0f/horizontalDivisions);
+                v[j*(horizontalDivisions+1)+i] = j*(1.0f/verticalDivisions);
+            }
+        }
+    }
+
+    // Prepares an output of width x height pixels showing the rectangle [left,right]x[bottom,top]
+    // of the mesh coordinates. The arrays are read during the call only.
+    void setup(const Image &source, int numVertices, int numTriangles, const float *x, const float *y,
+               const float *u, const float *v, const int *triangles,
+               int width, int height, float left, float right, float bottom, float top){
+        this->source = source;
+        this->width = width;
+        this->height = height;
+        this->numTriangles = numTriangles;
+        // vertices in pixel coordinates of the output (y downwards), texture coordinates in source pixels
+        px.resize(numVertices); py.resize(numVertices);
+        tu.resize(numVertices); tv.resize(numVertices);
+        float sx = width/(right-left), sy = height/(top-bottom);
+        for(int i=0;i<numVertices;i++){
+            px[i] = (x[i]-left)*sx;
+            py[i] = (top-y[i])*sy;
+            tu[i] = u[i]*source.width - 0.5f;
+            tv[i] = (1.0f-v[i])*source.height - 0.5f;
+        }
+        tri.assign(triangles, triangles+3*numTriangles);
+        // bin the triangles by tile row, keeping the drawing order within each tile
+        numTiles = (height+TILE_ROWS-1)/TILE_ROWS;
+        tileStart.assign(numTiles+1, 0);
+        for(int t=0;t<numTriangles;t++){
+            int lo, hi;
+            if(tileRange(t, lo, hi)) for(int k=lo;k<=hi;k++) tileStart[k+1]++;
+        }
+        for(int k=0;k<numTiles;k++) tileStart[k+1] += tileStart[k];
+        tileItems.resize(tileStart[numTiles]);
+        std::vector<int> fill(tileStart.begin(), tileStart.end()-1);
+        for(int t=0;t<numTriangles;t++){
+            int lo, hi;
+            if(tileRange(t, lo, hi)) for(int k=lo;k<=hi;k++) tileItems[fill[k]++] = t;
+        }
+    }
+
+    int getWidth() const { return width; }
+    int getHeight() const { return height; }
+
+    // rows [row, row+rows) into out (row-major with the given stride); the tiles are rendered in parallel
+    void renderRows(int row, int rows, uint8_t *out, size_t stride) const{
+        renderRows(row, rows, out, stride, source);
+    }
+
+    // the same from a band of the source that holds at least the rows given by sourceRows(row, rows)
+    void renderRows(int row, int rows, uint8_t *out, size_t stride, const Image &band) const{
+        int first = row/TILE_ROWS, last = (row+rows-1)/TILE_ROWS;
+        parallelFor(first, last+1, 1, [&](int lo, int hi){
+            for(int k=lo;k<hi;k++){
+                int y0 = std::max(row, k*TILE_ROWS), y1 = std::min(row+rows, (k+1)*TILE_ROWS);
+                for(int y=y0;y<y1;y++) std::memset(out+(y-row)*stride, 0, 4*(size_t)width);
+                for(int e=tileStart[k];e<tileStart[k+1];e++){
+                    drawTriangle(tileItems[e], y0, y1, out+(size_t)(y0-row)*stride, stride, band);
+                }
+            }
+        });
+    }
+
+    // source rows [lo, hi) sampled by output rows [row, row+rows); false if no triangle shows there
+    bool sourceRows(int row, int rows, int &lo, int &hi) const{
+        float y0 = (float)row, y1 = (float)(row+rows);
+        float tmin = INFINITY, tmax = -INFINITY;
+        int first = row/TILE_ROWS, last = (row+rows-1)/TILE_ROWS;
+        for(int k=first;k<=last;k++){
+            for(int e=tileStart[k];e<tileStart[k+1];e++){
+                const int *t = &tri[3*tileItems[e]];
+                // tv is affine over the triangle, so over its part within the rows it is extreme at the
+                // vertices inside them or where the edges cross y0 or y1
+                for(int i=0;i<3;i++){
+                    int a = t[i], b = t[(i+1)%3];
+                    if(py[a]>=y0 && py[a]<=y1){
+                        tmin = std::min(tmin, tv[a]);
+                        tmax = std::max(tmax, tv[a]);
+                    }
+                    for(float yc : {y0, y1}){
+                        if((py[a]-yc)*(py[b]-yc)<0){
+                            float s = tv[a] + (yc-py[a])/(py[b]-py[a])*(tv[b]-tv[a]);
+                            tmin = std::min(tmin, s);
+                            tmax = std::max(tmax, s);
+                        }
+                    }
+                }
+            }
+        }
+        if(!(tmin<=tmax)) return false;
+        // as clamped by sample(), plus the bilinear neighbour and a row either side for rounding
+        tmin = std::min(std::max(tmin, 0.0f), source.height-1.0f);
+        tmax = std::min(std::max(tmax, 0.0f), source.height-1.0f);
+        lo = std::max((int)tmin-1, 0);
+        hi = std::min((int)tmax+3, source.height);
+        return true;
+    }
+
+    // streams the whole image in chunks of rows: sink(row, rows, pixels, stride), top to bottom.
+    // Only one chunk (chunkRows full rows) is held in memory.
+    template <class Sink>
+    void rasterize(const Sink &sink, int chunkRows = 4*TILE_ROWS) const{
+        chunkRows = std::max(TILE_ROWS, chunkRows/TILE_ROWS*TILE_ROWS);
+        size_t stride = 4*(size_t)width;
+        std::vector<uint8_t> chunk(stride*std::min(chunkRows, height));
+        for(int row=0;row<height;row+=chunkRows){
+            int rows = std::min(chunkRows, height-row);
+            renderRows(row, rows, chunk.data(), stride);
+            sink(row, rows, (const uint8_t *)chunk.data(), stride);
+        }
+    }
+
+private:
+    // tile rows touched by the bounding box of triangle t
+    bool tileRange(int t, int &lo, int &hi) const{
+        float y0 = std::min({py[tri[3*t]], py[tri[3*t+1]], py[tri[3*t+2]]});
+        float y1 = std::max({py[tri[3*t]], py[tri[3*t+1]], py[tri[3*t+2]]});
+        // (the negated test also rejects NaN)
+        if(!(y1>=0 && y0<height)) return false;
+        lo = (int)std::max(y0, 0.0f)/TILE_ROWS;
+        hi = (int)std::min(y1, height-1.0f)/TILE_ROWS;
+        return true;
+    }
+
+    // pixels of rows [y0, y1) whose centres lie in triangle t; image points at row y0
+    void drawTriangle(int t, int y0, int y1, uint8_t *image, size_t stride, const Image &src) const{
+        int a = tri[3*t], b = tri[3*t+1], c = tri[3*t+2];
+        float det = (px[b]-px[a])*(py[c]-py[a]) - (px[c]-px[a])*(py[b]-py[a]);
+        if(det==0) return;
+        float inv = 1.0f/det;
+        // bounding box, clamped before the conversion to int
+        int xmin = (int)std::max(std::min({px[a], px[b], px[c]}), 0.0f);
+        int xmax = (int)std::min(std::max({px[a], px[b], px[c]}), width-1.0f);
+        int ymin = std::max(y0, (int)std::max(std::min({py[a], py[b], py[c]}), 0.0f));
+        int ymax = std::min(y1-1, (int)std::min(std::max({py[a], py[b], py[c]}), height-1.0f));
+        for(int y=ymin;y<=ymax;y++){
+            float cy = y+0.5f;
+            uint8_t *line = image + (size_t)(y-y0)*stride;
+            for(int x=xmin;x<=xmax;x++){
+                float cx = x+0.5f;
+                float l1 = ((cx-px[a])*(py[c]-py[a]) - (px[c]-px[a])*(cy-py[a]))*inv;
+                float l2 = ((px[b]-px[a])*(cy-py[a]) - (cx-px[a])*(py[b]-py[a]))*inv;
+                float l0 = 1.0f-l1-l2;
+                if(l0<0 || l1<0 || l2<0) continue;
+                sample(l0*tu[a]+l1*tu[b]+l2*tu[c], l0*tv[a]+l1*tv[b]+l2*tv[c], line+4*x, src);
+            }
+        }
+    }
+
+    // bilinear interpolation at (s, t) in source pixels, clamped to the edges
+    void sample(float s, float t, uint8_t *out, const Image &src) const{
+        s = std::min(std::max(s, 0.0f), (float)(src.width-1));
+        t = std::min(std::max(t, 0.0f), (float)(src.height-1));
+        int s0 = (int)s, t0 = (int)t;
+        int s1 = std::min(s0+1, src.width-1), t1 = std::min(t0+1, src.height-1);
+        float fs = s-s0, ft = t-t0;
+        const uint8_t *row0 = src.pixels + (t0-src.top)*src.stride;
+        const uint8_t *row1 = src.pixels + (t1-src.top)*src.stride;
+        const uint8_t *p00 = row0 + 4*s0;
+        const uint8_t *p01 = row0 + 4*s1;
+        const uint8_t *p10 = row1 + 4*s0;
+        const uint8_t *p11 = row1 + 4*s1;
+        for(int ch=0;ch<4;ch++){
+            float top = p00[ch] + fs*(p01[ch]-p00[ch]);
+            float bottom = p10[ch] + fs*(p11[ch]-p10[ch]);
+            out[ch] = (uint8_t)(top + ft*(bottom-top) + 0.5f);
+        }
+    }
+
+    Image source;
+    int width = 0, height = 0, numTriangles = 0, numTiles = 0;
+    std::vector<float> px, py, tu, tv;
+    std::vector<int> tri;
+    // triangles of tile k are tileItems[tileStart[k]..tileStart[k+1])
+    std::vector<int> tileStart, tileItems;
+};
+
+#endif /* ImageRasterizer_h */
@@ -0,0 +1,99 @@
+//
+//  IterativeRefinement.h
+//  iPad-SimEnergy
+//
+//  Mixed-precision iterative refinement of a constrained solve: the float
+//  factorization is kept, the residual of the energy (assembled in double) is
+//  computed in double, and each step adds the float solve of that residual
+//  to a double solution.
+//
+//  The system is that of ConstrainedSolver and PrefactoredSolver: K x = b on
+//  the free rows, x = b on the constrained rows. Corrections have zero rows
+//  for the constrained DOFs, so either solver computes them unchanged.
+//
+//  The steps contract the error by about rho = cond(K) * 2^-24 as long as
+//  rho < 1. rho is estimated from the ratio of successive corrections, and
+//  the error left after the last step is bounded by rho/(1-rho) times the
+//  last correction. Refinement stops when a correction no longer shows in
+//  float, or as soon as a correction grows, which is then not applied.
+//
+
+#ifndef IterativeRefinement_h
+#define IterativeRefinement_h
+
+#include "SolverBackend.h"
+#include <cmath>
+
+class IterativeRefinement {
+public:
+    // at most this many steps per solve (0: plain float solve)
+    int maxSteps = 0;
+    // stop once the correction is below this fraction of the solution (half a float ulp)
+    double tolerance = 0x1p-25;
+
+    // report of the last refine(): steps applied, relative size of the last correction,
+    // estimated contraction per step, and bound on the relative error left (infinite if diverging)
+    int steps = 0;
+    double correction = 0, contraction = 0, errorBound = 0;
+
+    // preallocate for rows x cols systems, so that refining a drag frame does not allocate
+    void resize(int rows, int cols){
+        xd.resize(rows, cols);
+        rd.resize(rows, cols);
+        rf.resize(rows, cols);
+        dx.resize(rows, cols);
+    }
+
+    // refine x, the float solution of K x = b with the given constrained rows; solve(b, x) is the float solver
+    template <class Solve>
+    void refine(const SpMatD &K, const std::vector<int> &fixed, const Eigen::MatrixXf &b, Eigen::MatrixXf &x, const Solve &solve){
+        steps = 0;
+        correction = contraction = errorBound = 0;
+        if(maxSteps<=0) return;
+        int cols = (int)b.cols();
+        xd = x.cast<double>();
+        for(int h : fixed) xd.row(h) = b.row(h).cast<double>();
+        double scale = std::max(xd.lpNorm<Eigen::Infinity>(), 1e-30);
+        double previous = 0;
+        for(int s=0;s<maxSteps;s++){
+            // r = b - K x in double; K is symmetric, so its columns are its rows
+            rd = b.cast<double>();
+            for(int j=0;j<K.outerSize();j++){
+                for(SpMatD::InnerIterator it(K,j);it;++it){
+                    for(int c=0;c<cols;c++){
+                        rd(it.row(),c) -= it.value() * xd(j,c);
+                    }
+                }
+            }
+            for(int h : fixed) rd.row(h).setZero();
+            rf = rd.cast<float>();
+            // zero initial guess for the iterative backends
+            dx.setZero();
+            solve(rf, dx);
+            double size = dx.cast<double>().lpNorm<Eigen::Infinity>()/scale;
+            if(s>0 && size>=previous){
+                // diverging: cond(K) * 2^-24 is not below one
+                contraction = previous>0 ? size/previous : INFINITY;
+                errorBound = INFINITY;
+                break;
+            }
+            xd += dx.cast<double>();
+            steps++;
+            if(s>0) contraction = size/previous;
+            correction = previous = size;
+            if(size<=tolerance) break;
+        }
+        if(errorBound==0){
+            // with a single step the contraction is unknown, and the next correction is taken to be no larger
+            errorBound = steps>1 ? contraction/(1-contraction)*correction : correction;
+        }
+        x = xd.cast<float>();
+    }
+
+private:
+    // double solution and residual; float residual and correction for the float solver
+    Eigen::MatrixXd xd, rd;
+    Eigen::MatrixXf rf, dx;
+};
+
+#endif /* IterativeRefinement_h */
@@ -0,0 +1,150 @@
+//
+//  LapackBackend.h
+//  iPad-SimEnergy
+//
+//  Banded LAPACK factorization of the energy: sgbtrf once per constraint set,
+//  sgbtrs per frame.
+//
+//  The grid couples each vertex with its neighbours in the same and the next
+//  row only, so once the x and y of a vertex are interleaved the matrix is
+//  banded with about twice the number of vertices per row as its half
+//  bandwidth. analyzePattern() picks the numbering (rows or columns of the
+//  grid first, interleaved or not) with the narrowest band, and only the band
+//  is stored: n*(3k+1) floats instead of the n*n of a dense matrix.
+//
+//  LAPACK comes from Accelerate on Apple platforms; elsewhere the build
+//  defines HAS_LAPACK and links the reference (or an optimised) LAPACK.
+//
+//  Included by SolverBackend.h; select it with SolverBackend::BandedLAPACK.
+//
+
+#ifndef LapackBackend_h
+#define LapackBackend_h
+
+#if defined(__APPLE__)
+#include <Accelerate/Accelerate.h>
+#ifndef HAS_LAPACK
+#define HAS_LAPACK
+#endif
+typedef __CLPK_integer lapack_int;
+#elif defined(HAS_LAPACK)
+typedef int lapack_int;
+extern "C" {
+void sgbtrf_(lapack_int *m, lapack_int *n, lapack_int *kl, lapack_int *ku, float *ab, lapack_int *ldab,
+             lapack_int *ipiv, lapack_int *info);
+void sgbtrs_(char *trans, lapack_int *n, lapack_int *kl, lapack_int *ku, lapack_int *nrhs, float *ab, lapack_int *ldab,
+             lapack_int *ipiv, float *b, lapack_int *ldb, lapack_int *info);
+}
+#endif
+
+#ifdef HAS_LAPACK
+class LapackBackend : public SolverBackend {
+public:
+    const char *name() const { return "LAPACK sgbtrf"; }
+
+    void setGrid(int horizontalDivisions, int verticalDivisions){
+        H = horizontalDivisions;
+        V = verticalDivisions;
+    }
+
+    void analyzePattern(const SpMat &G){
+        int n = (int)G.rows();
+        // candidate numberings of the DOFs; the one with the narrowest band wins
+        std::vector<int> candidate(n);
+        bandwidth = -1;
+        for(int transposed=0;transposed<2;transposed++){
+            for(int interleaved=0;interleaved<2;interleaved++){
+                if(!numbering(n, transposed, interleaved, candidate)) continue;
+                int k = 0;
+                for(int j=0;j<G.outerSize();j++){
+                    for(SpMat::InnerIterator it(G,j);it;++it){
+                        k = std::max(k, std::abs(candidate[it.row()]-candidate[it.col()]));
+                    }
+                }
+                if(bandwidth<0 || k<bandwidth){
+                    bandwidth = k;
+                    order = candidate;
+                }
+            }
+        }
+        ldab = 3*bandwidth+1;
+        AB.resize((size_t)ldab*n);
+        ipiv.resize(n);
+        B.resize(n, 2);
+    }
+
+    void factorize(const SpMat &G){
+        auto start = std::chrono::steady_clock::now();
+        lapack_int n = (lapack_int)G.rows();
+        if((int)order.size()!=n) analyzePattern(G);
+        lapack_int k = bandwidth;
+        // band of the permuted matrix in LAPACK's layout: entry (i,j) at AB[2k+i-j + j*ldab];
+        // the top k rows are room for the fill-in of the pivoting
+        std::fill(AB.begin(), AB.end(), 0.0f);
+        for(int j=0;j<G.outerSize();j++){
+            for(SpMat::InnerIterator it(G,j);it;++it){
+                int r = order[it.row()], c = order[it.col()];
+                AB[2*k+r-c + (size_t)c*ldab] = it.value();
+            }
+        }
+        sgbtrf_(&n, &n, &k, &k, AB.data(), &ldab, ipiv.data(), &info);
+        factorizeTime += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    }
+
+    bool succeeded() const { return info == 0; }
+
+    using SolverBackend::solve;
+    void solve(const Eigen::MatrixXf &b, Eigen::MatrixXf &x){
+        auto start = std::chrono::steady_clock::now();
+        lapack_int n = (lapack_int)b.rows(), nrhs = (lapack_int)b.cols(), k = bandwidth, solveInfo;
+        char trans = 'N';
+        B.resize(n, nrhs);
+        for(int c=0;c<nrhs;c++){
+            for(int i=0;i<n;i++) B(order[i], c) = b(i, c);
+        }
+        sgbtrs_(&trans, &n, &k, &k, &nrhs, AB.data(), &ldab, ipiv.data(), B.data(), &n, &solveInfo);
+        x.resize(n, nrhs);
+        for(int c=0;c<nrhs;c++){
+            for(int i=0;i<n;i++) x(i, c) = B(order[i], c);
+        }
+        solveTime += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+        numSolves++;
+    }
+
+    // half bandwidth of the chosen numbering
+    int getBandwidth() const { return bandwidth; }
+
+private:
+    // order[dof] = position of dof in the banded system. The vertices are numbered row by row
+    // (or column by column) of the grid; with blocks of x and y they are interleaved.
+    // False if the numbering does not apply to a system of this size.
+    bool numbering(int n, bool transposed, bool interleaved, std::vector<int> &order) const{
+        int nv = (H+1)*(V+1);
+        bool grid = H>0 && V>0 && n%nv==0;
+        if(transposed && !grid) return false;
+        int blocks = grid ? n/nv : 1;
+        if(!grid) nv = n;
+        if(interleaved && blocks==1) return false;
+        for(int d=0;d<blocks;d++){
+            for(int v=0;v<nv;v++){
+                // grid vertex v = j*(H+1)+i
+                int p = transposed ? (v%(H+1))*(V+1) + v/(H+1) : v;
+                order[d*nv+v] = interleaved ? p*blocks+d : d*nv+p;
+            }
+        }
+        return true;
+    }
+
+    int H = 0, V = 0;
+    std::vector<int> order;
+    lapack_int bandwidth = 0, ldab = 1;
+    // LU factors in LAPACK's band storage, column-major
+    std::vector<float> AB;
+    std::vector<lapack_int> ipiv;
+    lapack_int info = -1;
+    // right-hand sides in the banded numbering
+    Eigen::MatrixXf B;
+};
+#endif
+
+#endif /* LapackBackend_h */
@@ -2,152 +2,91 @@
 //  MathematicalEngine.swift
 //  iPad-SimEnergy
 //
-//  Swift wrapper for mathematical computations while preserving LAPACK backend
+//  Swift wrapper around the C++ deformation core (SimEnergyCore.h).
+//  The core solves the sparse Sim/ARAP systems in place on ImageMesh's
+//  arrays, so no vertex data is duplicated on the Swift side.
 //
 
 import Foundation
-import Accelerate
 
 class MathematicalEngine {
-    
-    // Maximum number of vertices for matrix operations
-    static let maxVertices = 1000
-    static let N = maxVertices * 2  // x and y coordinates
-    
-    // LAPACK arrays - maintaining C compatibility
-    private var IPIV = Array<__CLPK_integer>(repeating: 0, count: N)
-    private var A = Array<Float>(repeating: 0, count: N * N)
-    private var mat = Array<Float>(repeating: 0, count: N * N)
-    private var vec = Array<Float>(repeating: 0, count: N)
-    
-    // Reference to the ImageMesh object
-    weak var imageMesh: ImageMesh?
-    
+
+    private let engine: OpaquePointer
+
+    // Reference to the ImageMesh object, whose arrays the core reads and writes
+    private(set) weak var imageMesh: ImageMesh?
+
+    // Sim (0) or ARAP (1)
+    var mode: Int = 0 {
+        didSet { simenergy_set_mode(engine, SimEnergyMode(rawValue: UInt32(mode))) }
+    }
+
+    // ARAP local/global iterations per frame
+    var iteration: Int = 1 {
+        didSet { simenergy_set_iterations(engine, Int32(max(iteration, 1))) }
+    }
+
     init(imageMesh: ImageMesh) {
+        engine = simenergy_create()
         self.imageMesh = imageMesh
+
+        var mesh = SimEnergyMesh(
+            horizontalDivisions: imageMesh.horizontalDivisions,
+            verticalDivisions: imageMesh.verticalDivisions,
+            numVertices: imageMesh.numVertices,
+            numTriangles: imageMesh.numTriangles,
+            x: imageMesh.x, y: imageMesh.y,
+            ix: imageMesh.ix, iy: imageMesh.iy,
+            triangles: UnsafePointer(imageMesh.triangles),
+            selected: UnsafePointer(imageMesh.selected))
+        let status = simenergy_set_mesh(engine, &mesh)
+        if status != SIMENERGY_OK {
+            print("MathematicalEngine: set_mesh failed (\(status.rawValue))")
+        }
+    }
+
+    deinit {
+        simenergy_destroy(engine)
     }
-    
+
     // MARK: - Energy Matrix Formation
-    
+
+    // touch down/up: rebuild and factorise the energy for the current selection
     func formEnergyMatrix() {
         guard let mesh = imageMesh else { return }
-        
-        // Clear matrix
-        mat = Array<Float>(repeating: 0, count: Self.N * Self.N)
-        
-        // Form the energy derivation matrix
-        for i in 0..<Int(mesh.numTriangles) {
-            let triangleIndex = i * 3
-            let posx = Int(mesh.triangles[triangleIndex])
-            let posy = posx + Int(mesh.numVertices)
-            let posz = Int(mesh.triangles[triangleIndex + 1])
-            let posw = posz + Int(mesh.numVertices)
-            let poss = Int(mesh.triangles[triangleIndex + 2])
-            let post = poss + Int(mesh.numVertices)
-            
-            let a = mesh.ix[posx]
-            let b = mesh.iy[posx]
-            let c = mesh.ix[posz]
-            let d = mesh.iy[posz]
-            let e = mesh.ix[poss]
-            let f = mesh.iy[poss]
-            
-            let detA2 = (a*d - a*f - b*c + b*e + c*f - d*e) * (a*d - a*f - b*c + b*e + c*f - d*e)
-            
-            // CAREFUL: matrix indexing for LAPACK is in FORTRAN style
-            // Partial derivative of the energy |B|^2 - 2 det(B), where B=VP^{-1}
-            mat[posx + posx * Self.N] += (c*c - 2*c*e + d*d - 2*d*f + e*e + f*f) / detA2
-            mat[posx + posz * Self.N] += (-a*c + a*e - b*d + b*f + c*e + d*f - e*e - f*f) / detA2
-            mat[posx + posw * Self.N] += (-a*d + a*f + b*c - b*e - c*f + d*e) / detA2
-            mat[posx + poss * Self.N] += (a*c - a*e + b*d - b*f - c*c + c*e - d*d + d*f) / detA2
-            mat[posx + post * Self.N] += (a*d - a*f - b*c + b*e + c*f - d*e) / detA2
-            
-            // Continue with remaining matrix elements...
-            // (Abbreviated for brevity - full implementation would include all matrix calculations)
-        }
-        
-        // Incorporate constraints
-        incorporateConstraints()
-    }
-    
-    // MARK: - Constraint Handling
-    
-    private func incorporateConstraints() {
-        guard let mesh = imageMesh else { return }
-        
-        // Handle single vertex constraint case
-        if mesh.numSelected == 1 {
-            for k in 0..<Int(mesh.numVertices) {
-                mat[0 + k * Self.N] = 0
-                mat[Int(mesh.numVertices) + k * Self.N] = 0
-            }
-            mat[0 + 0 * Self.N] = 1.0
-            mat[Int(mesh.numVertices) + Int(mesh.numVertices) * Self.N] = 1.0
-        }
-        
-        // Apply constraints for selected vertices
-        for s in 0..<Int(mesh.numSelected) {
-            let i = Int(mesh.selected[s])
-            let j = i + Int(mesh.numVertices)
-            
-            for k in 0..<Int(mesh.numVertices) {
-                mat[i + k * Self.N] = 0
-                mat[j + k * Self.N] = 0
-            }
-            mat[i + i * Self.N] = 1.0
-            mat[j + j * Self.N] = 1.0
+        let status = simenergy_set_handles(engine, mesh.numSelected)
+        if status != SIMENERGY_OK {
+            print("MathematicalEngine: factorization failed (\(status.rawValue))")
         }
     }
-    
+
     // MARK: - Linear System Solution
-    
-    func solveVerticesLAPACK() {
-        guard let mesh = imageMesh else { return }
-        
-        // Clear constraint vector
-        vec = Array<Float>(repeating: 0, count: Self.N)
-        
-        // Handle single vertex constraint case
-        if mesh.numSelected == 1 {
-            let index = Int(mesh.selected[Int(mesh.numSelected) - 1])
-            mesh.x[0] = mesh.ix[0] + mesh.x[index] - mesh.ix[index]
-            mesh.y[0] = mesh.iy[0] + mesh.y[index] - mesh.iy[index]
-            vec[0] = mesh.x[0]
-            vec[Int(mesh.numVertices)] = mesh.y[0]
-        }
-        
-        // Constrain touched vertices
-        for k in 0..<Int(mesh.numSelected) {
-            let i = Int(mesh.selected[k])
-            let j = i + Int(mesh.numVertices)
-            vec[i] = mesh.x[i]
-            vec[j] = mesh.y[i]
-        }
-        
-        // Solve linear system using LAPACK
-        var size: __CLPK_integer = __CLPK_integer(Self.N)
-        var NRHS: __CLPK_integer = 1
-        var LDA: __CLPK_integer = __CLPK_integer(Self.N)
-        var LDB: __CLPK_integer = __CLPK_integer(Self.N)
-        var INFO: __CLPK_integer = 0
-        
-        // LAPACK destroys original matrix so A should be duplicated from mat
-        A = mat
-        
-        // Call LAPACK solver
-        sgesv_(&size, &NRHS, &A, &LDA, &IPIV, &vec, &LDB, &INFO)
-        
-        // Copy results back to mesh
-        for i in 0..<Int(mesh.numVertices) {
-            mesh.x[i] = vec[i]
-            mesh.y[i] = vec[i + Int(mesh.numVertices)]
-        }
+
+    // drag: positions of the free vertices, written into the mesh
+    func solveVertices() {
+        simenergy_solve(engine)
     }
-    
+
+    // the mesh was reset to its initial positions
+    func reset() {
+        simenergy_invalidate(engine)
+    }
+
+    // MARK: - Picking
+
+    // nearest vertex within maxDistance (the touch radius by default), skipping
+    // vertex 0 as it's reserved for constraint handling
+    func findNearestVertex(to point: (x: Float, y: Float), maxDistance: Float = -1) -> Int? {
+        guard let mesh = imageMesh else { return nil }
+        // mesh.radius already bounds the squared distance
+        let searchRadius = maxDistance > 0 ? maxDistance : sqrt(mesh.radius)
+        let index = simenergy_nearest_vertex(engine, point.x, point.y, searchRadius * searchRadius, 1)
+        return index >= 0 ? Int(index) : nil
+    }
+
     // MARK: - High-level Interface
-    
+
     func performDeformation() {
-        formEnergyMatrix()
-        solveVerticesLAPACK()
+        solveVertices()
     }
-}
\ No newline at end of file
+}
@@ -0,0 +1,471 @@
+//
+//  MatrixFreeCG.h
+//  iPad-SimEnergy
+//
+//  Preconditioned conjugate gradient that applies the energy Hessian per
+//  triangle, without multiplying by the assembled matrix.
+//
+//  With the inverted mesh matrix Pinv = [p0 p1] (3x2) of a rest triangle and
+//  the local coordinates x, y of its vertices, the ARAP Hessian is Pinv*Pinv^T
+//  on each coordinate, and the Sim Hessian (of |B|^2 - 2 det B) maps (x, y) to
+//      gx = p0 s + p1 t,  gy = p0 t - p1 s,  s = p0.x - p1.y,  t = p1.x + p0.y.
+//  A product takes two passes: the triangles compute their (s, t), then every
+//  vertex gathers from its triangles, so both passes run in parallel without
+//  write conflicts. The system (ARAP: n DOFs, Sim: 2n) is told apart by the
+//  size of the matrix, as in the Multigrid backend.
+//
+//  Constrained DOFs, given by setConstraints(), are identity rows and columns.
+//  The iteration runs in double, starts from the incoming x (the previous
+//  frame), and stops at the tolerance or after the iteration budget.
+//
+//  A few handles pin a mesh of thousands of vertices, so the slow modes are
+//  global (with two handles the Sim solution is a similarity of the whole
+//  image), and one-level preconditioners only move them a ring of triangles
+//  per iteration. The default preconditioner is therefore two-level: Jacobi
+//  plus a correction on the bilinear functions of a coarse lattice over the
+//  rest pose, about `coarsening` vertex spacings per cell. The coarse matrix
+//  P^T A P is summed from the same per-triangle kernels, so nothing depends on
+//  the assembled matrix; it is factorised at touch down. Jacobi alone and
+//  IC(0) of the assembled constrained matrix remain as alternatives.
+//
+//  Included by SolverBackend.h; select it with SolverBackend::MatrixFreeCG.
+//
+
+#ifndef MatrixFreeCG_h
+#define MatrixFreeCG_h
+
+#include "ParallelFor.h"
+
+class MatrixFreeCGBackend : public SolverBackend {
+public:
+    enum Preconditioner { Jacobi, IncompleteCholesky, TwoLevel };
+
+    Preconditioner preconditioner = TwoLevel;
+    // TwoLevel: vertex spacings per cell of the coarse lattice
+    int coarsening = 4;
+    // at most this many iterations per solve
+    int iterationBudget = 100;
+    // relative residual at which a solve stops
+    double tolerance = 1e-6;
+    // statistics of the last solve (worst column)
+    int lastIterations = 0;
+    double lastResidual = 0;
+    // lastIterations summed over the solves counted by numSolves
+    long totalIterations = 0;
+
+    const char *name() const { return "MatrixFreeCG"; }
+
+    void setTriangles(int numVertices, int numTriangles, const int *triangles, const float *ix, const float *iy){
+        nv = numVertices;
+        nt = numTriangles;
+        this->triangles = triangles;
+        this->ix = ix;
+        this->iy = iy;
+        // the corners of the triangles around every vertex, as 3*triangle+corner
+        incidentStart.assign(nv+1, 0);
+        for(int c=0;c<3*nt;c++) incidentStart[triangles[c]+1]++;
+        for(int v=0;v<nv;v++) incidentStart[v+1] += incidentStart[v];
+        incident.resize(3*nt);
+        incidentTriangle.resize(3*nt);
+        std::vector<int> fill(incidentStart.begin(), incidentStart.end()-1);
+        for(int c=0;c<3*nt;c++) incident[fill[triangles[c]]++] = c;
+        for(int e=0;e<3*nt;e++) incidentTriangle[e] = incident[e]/3;
+    }
+
+    void setConstraints(const std::vector<bool> &isFixed){
+        fixed = isFixed;
+    }
+
+    void analyzePattern(const SpMat &){}
+
+    void factorize(const SpMat &G){
+        auto start = std::chrono::steady_clock::now();
+        n = (int)G.rows();
+        ok = nv>0 && (n==nv || n==2*nv);
+        if(ok){
+            if((int)fixed.size()!=n) fixed.assign(n, false);
+            freeMask.resize(n);
+            for(int i=0;i<n;i++) freeMask(i) = fixed[i] ? 0.0 : 1.0;
+            computePinv();
+            if(preconditioner==IncompleteCholesky){
+                ok = factorizeIC(G);
+            }else{
+                computeDiagonal();
+            }
+            if(preconditioner==TwoLevel){
+                ok = factorizeCoarse();
+            }
+            rhs.setZero(n); sol.setZero(n); res.setZero(n);
+            z.setZero(n); p.setZero(n); q.setZero(n);
+            st.assign(2*nt, 0.0);
+        }
+        factorizeTime += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    }
+
+    bool succeeded() const { return ok; }
+
+    using SolverBackend::solve;
+    void solve(const Eigen::MatrixXf &b, Eigen::MatrixXf &x){
+        auto start = std::chrono::steady_clock::now();
+        // warm start from x when it has the right shape
+        if(x.rows()!=n || x.cols()!=b.cols()) x.setZero(n, b.cols());
+        lastIterations = 0;
+        lastResidual = 0;
+        for(int k=0;k<b.cols();k++){
+            rhs = b.col(k).cast<double>();
+            sol = x.col(k).cast<double>();
+            pcg();
+            x.col(k) = sol.cast<float>();
+        }
+        solveTime += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+        numSolves++;
+        totalIterations += lastIterations;
+    }
+
+private:
+    // the mesh (rest pose read at factorization)
+    int nv = 0, nt = 0;
+    const int *triangles = nullptr;
+    const float *ix = nullptr, *iy = nullptr;
+    std::vector<int> incidentStart, incident, incidentTriangle;
+    // the system: n = nv (ARAP) or 2*nv (Sim)
+    int n = 0;
+    bool ok = false;
+    std::vector<bool> fixed;
+    Eigen::VectorXd freeMask;
+    // P[6*i+2*k+l]: entry (k,l) of Pinv of triangle i, in double
+    std::vector<double> P;
+    // row of Pinv for every incident corner, in the order of incident
+    std::vector<double> incidentP;
+    // (s, t) of the Sim kernel of every triangle, or (p0.x, p1.x) for ARAP
+    std::vector<double> st;
+    // Jacobi: inverse diagonal
+    Eigen::VectorXd invDiag;
+    // IC(0): rows of the lower factor, with the diagonal last in each row
+    std::vector<int> rowStart, column;
+    std::vector<double> value;
+    // TwoLevel: lattice of (cellsX+1) x (cellsY+1) nodes; the cell of every vertex, and the 4 nodes and bilinear weights
+    int cellsX = 0, cellsY = 0, numNodes = 0;
+    std::vector<int> vertexCell, vertexNode;
+    std::vector<double> vertexWeight;
+    Eigen::SimplicialLDLT<Eigen::SparseMatrix<double>> coarse;
+    Eigen::VectorXd coarseInvD, coarseRHS, coarseSol;
+    // CG vectors
+    Eigen::VectorXd rhs, sol, res, z, p, q;
+
+    void computePinv(){
+        P.resize(6*nt);
+        for(int i=0;i<nt;i++){
+            double a = ix[triangles[3*i]], b = iy[triangles[3*i]];
+            double c = ix[triangles[3*i+1]], d = iy[triangles[3*i+1]];
+            double e = ix[triangles[3*i+2]], f = iy[triangles[3*i+2]];
+            double detA = (a*d-a*f-b*c+b*e+c*f-d*e);
+            double *p = &P[6*i];
+            p[0] = (d-f)/detA;
+            p[1] = (-c+e)/detA;
+            p[2] = (-b+f)/detA;
+            p[3] = (a-e)/detA;
+            p[4] = (b-d)/detA;
+            p[5] = (-a+c)/detA;
+        }
+        incidentP.resize(6*nt);
+        for(int e=0;e<3*nt;e++){
+            incidentP[2*e] = P[2*incident[e]];
+            incidentP[2*e+1] = P[2*incident[e]+1];
+        }
+    }
+
+    void computeDiagonal(){
+        invDiag.resize(n);
+        for(int v=0;v<nv;v++){
+            double d = 0;
+            for(int e=incidentStart[v];e<incidentStart[v+1];e++){
+                d += incidentP[2*e]*incidentP[2*e] + incidentP[2*e+1]*incidentP[2*e+1];
+            }
+            // the Sim Hessian has the same diagonal for x and y
+            for(int s=v;s<n;s+=nv) invDiag(s) = fixed[s] || d==0 ? 1.0 : 1.0/d;
+        }
+    }
+
+    // lattice over the rest pose, and the coarse matrix P^T A P with P the (masked) bilinear interpolation
+    bool factorizeCoarse(){
+        double x0 = ix[0], x1 = ix[0], y0 = iy[0], y1 = iy[0];
+        for(int v=1;v<nv;v++){
+            x0 = std::min(x0, (double)ix[v]); x1 = std::max(x1, (double)ix[v]);
+            y0 = std::min(y0, (double)iy[v]); y1 = std::max(y1, (double)iy[v]);
+        }
+        double w = std::max(x1-x0, 1e-6), h = std::max(y1-y0, 1e-6);
+        double cell = std::max(coarsening, 1)*std::sqrt(w*h/nv);
+        cellsX = std::max(1, (int)std::ceil(w/cell));
+        cellsY = std::max(1, (int)std::ceil(h/cell));
+        numNodes = (cellsX+1)*(cellsY+1);
+        vertexCell.resize(nv);
+        vertexNode.resize(4*nv);
+        vertexWeight.resize(4*nv);
+        for(int v=0;v<nv;v++){
+            double fx = (ix[v]-x0)/w*cellsX, fy = (iy[v]-y0)/h*cellsY;
+            int cx = std::min(std::max((int)fx, 0), cellsX-1), cy = std::min(std::max((int)fy, 0), cellsY-1);
+            double u = fx-cx, t = fy-cy;
+            int *node = &vertexNode[4*v];
+            double *weight = &vertexWeight[4*v];
+            vertexCell[v] = cy*cellsX + cx;
+            node[0] = cy*(cellsX+1) + cx;
+            node[1] = node[0]+1;
+            node[2] = node[0]+cellsX+1;
+            node[3] = node[2]+1;
+            weight[0] = (1-u)*(1-t);
+            weight[1] = u*(1-t);
+            weight[2] = (1-u)*t;
+            weight[3] = u*t;
+        }
+        // every triangle adds its rank-2 Hessian a a^T + b b^T (Sim: a, b = ds, dt; ARAP: the columns of Pinv),
+        // interpolated to the nodes and summed in a window of nodes around each node
+        int reach = 1;
+        for(int i=0;i<nt;i++){
+            for(int k=0;k<3;k++){
+                for(int l=0;l<3;l++){
+                    int ck = vertexCell[triangles[3*i+k]], cl = vertexCell[triangles[3*i+l]];
+                    reach = std::max(reach, 1 + std::max(std::abs(ck%cellsX - cl%cellsX), std::abs(ck/cellsX - cl/cellsX)));
+                }
+            }
+        }
+        bool sim = n==2*nv;
+        int components = sim ? 2 : 1, side = 2*reach+1, window = side*side*components*components;
+        std::vector<double> accumulated((size_t)numNodes*window, 0.0);
+        const double *mask = freeMask.data();
+        for(int i=0;i<nt;i++){
+            const double *pi = &P[6*i];
+            const int *t = triangles+3*i;
+            for(int term=0;term<2;term++){
+                // coarse entries of the rank-1 term, merged by node and component
+                int entryNode[24], entryComponent[24];
+                double entryValue[24];
+                int entries = 0;
+                for(int k=0;k<3;k++){
+                    const int *node = &vertexNode[4*t[k]];
+                    const double *weight = &vertexWeight[4*t[k]];
+                    // (x, y) coefficients of the vertex in the term
+                    double c[2] = {pi[2*k+term], 0.0};
+                    if(sim) c[1] = term==0 ? -pi[2*k+1] : pi[2*k];
+                    for(int d=0;d<components;d++){
+                        double value = c[d]*mask[t[k]+d*nv];
+                        if(value==0) continue;
+                        for(int m=0;m<4;m++){
+                            if(weight[m]==0) continue;
+                            int e = 0;
+                            while(e<entries && (entryNode[e]!=node[m] || entryComponent[e]!=d)) e++;
+                            if(e==entries){
+                                entryNode[e] = node[m];
+                                entryComponent[e] = d;
+                                entryValue[e] = 0;
+                                entries++;
+                            }
+                            entryValue[e] += weight[m]*value;
+                        }
+                    }
+                }
+                for(int e=0;e<entries;e++){
+                    int a = entryNode[e], ax = a%(cellsX+1), ay = a/(cellsX+1);
+                    for(int f=0;f<entries;f++){
+                        int b = entryNode[f], offset = (b/(cellsX+1)-ay+reach)*side + (b%(cellsX+1)-ax+reach);
+                        accumulated[((size_t)a*side*side + offset)*components*components + entryComponent[e]*components + entryComponent[f]]
+                            += entryValue[e]*entryValue[f];
+                    }
+                }
+            }
+        }
+        std::vector<TD> triplets;
+        std::vector<bool> supported(components*numNodes, false);
+        for(int a=0;a<numNodes;a++){
+            int ax = a%(cellsX+1), ay = a/(cellsX+1);
+            for(int offset=0;offset<side*side;offset++){
+                int bx = ax + offset%side - reach, by = ay + offset/side - reach;
+                if(bx<0 || by<0 || bx>cellsX || by>cellsY) continue;
+                int b = by*(cellsX+1) + bx;
+                for(int d=0;d<components;d++){
+                    for(int e=0;e<components;e++){
+                        double value = accumulated[((size_t)a*side*side + offset)*components*components + d*components + e];
+                        if(value==0) continue;
+                        if(a==b && d==e){
+                            // a relative shift keeps the nodes whose functions are dependent on the vertices SPD
+                            value *= 1+1e-8;
+                            supported[a+d*numNodes] = true;
+                        }
+                        triplets.push_back(TD(a+d*numNodes, b+e*numNodes, value));
+                    }
+                }
+            }
+        }
+        // nodes without free vertices
+        for(int c=0;c<components*numNodes;c++) if(!supported[c]) triplets.push_back(TD(c, c, 1.0));
+        Eigen::SparseMatrix<double> Ac(components*numNodes, components*numNodes);
+        Ac.setFromTriplets(triplets.begin(), triplets.end());
+        coarse.compute(Ac);
+        if(coarse.info()!=Eigen::Success) return false;
+        coarseInvD = coarse.vectorD().cwiseInverse();
+        coarseRHS.setZero(components*numNodes);
+        coarseSol.setZero(components*numNodes);
+        return true;
+    }
+
+    // y = A x, with identity rows and columns for the constrained DOFs
+    void apply(const Eigen::VectorXd &x, Eigen::VectorXd &y){
+        bool sim = n==2*nv;
+        const double *mask = freeMask.data();
+        parallelFor(0, nt, 4096, [&](int lo, int hi){
+            for(int i=lo;i<hi;i++){
+                const double *p = &P[6*i];
+                const int *t = triangles+3*i;
+                double x0 = x(t[0])*mask[t[0]], x1 = x(t[1])*mask[t[1]], x2 = x(t[2])*mask[t[2]];
+                double u0 = p[0]*x0 + p[2]*x1 + p[4]*x2;
+                double u1 = p[1]*x0 + p[3]*x1 + p[5]*x2;
+                if(sim){
+                    double y0 = x(t[0]+nv)*mask[t[0]+nv], y1 = x(t[1]+nv)*mask[t[1]+nv], y2 = x(t[2]+nv)*mask[t[2]+nv];
+                    double w0 = p[0]*y0 + p[2]*y1 + p[4]*y2;
+                    double w1 = p[1]*y0 + p[3]*y1 + p[5]*y2;
+                    u0 -= w1;
+                    u1 += w0;
+                }
+                st[2*i] = u0;
+                st[2*i+1] = u1;
+            }
+        });
+        parallelFor(0, nv, 4096, [&](int lo, int hi){
+            for(int v=lo;v<hi;v++){
+                double gx = 0, gy = 0;
+                for(int e=incidentStart[v];e<incidentStart[v+1];e++){
+                    const double *c = &st[2*incidentTriangle[e]];
+                    double p0 = incidentP[2*e], p1 = incidentP[2*e+1];
+                    gx += p0*c[0] + p1*c[1];
+                    gy += p0*c[1] - p1*c[0];
+                }
+                y(v) = mask[v]==0 ? x(v) : gx;
+                if(sim) y(v+nv) = mask[v+nv]==0 ? x(v+nv) : gy;
+            }
+        });
+    }
+
+    // IC(0) of the constrained matrix: the lower factor keeps the pattern of the lower triangle of G.
+    // A breakdown is retried with a growing diagonal shift.
+    bool factorizeIC(const SpMat &G){
+        // G is symmetric: column i holds row i
+        rowStart.assign(n+1, 0);
+        column.clear();
+        value.clear();
+        std::vector<double> a;
+        for(int i=0;i<n;i++){
+            for(SpMat::InnerIterator it(G,i);it;++it){
+                if(it.row()>i) break;
+                column.push_back((int)it.row());
+                a.push_back(it.value());
+            }
+            if(column.empty() || column.back()!=i) return false;
+            rowStart[i+1] = (int)column.size();
+        }
+        value.resize(a.size());
+        for(double shift=0; shift<1; shift = shift==0 ? 1e-4 : 4*shift){
+            if(factorizeIC(a, shift)) return true;
+        }
+        return false;
+    }
+
+    bool factorizeIC(const std::vector<double> &a, double shift){
+        for(int i=0;i<n;i++){
+            int end = rowStart[i+1]-1;
+            double d = a[end]*(1+shift);
+            for(int e=rowStart[i];e<end;e++){
+                int j = column[e];
+                // a_ij minus the dot product of rows i and j over the columns before j
+                double sum = a[e];
+                int ei = rowStart[i], ej = rowStart[j], endj = rowStart[j+1]-1;
+                while(ei<e && ej<endj){
+                    if(column[ei]<column[ej]) ei++;
+                    else if(column[ei]>column[ej]) ej++;
+                    else sum -= value[ei++]*value[ej++];
+                }
+                value[e] = sum/value[endj];
+                d -= value[e]*value[e];
+            }
+            if(!(d>0)) return false;
+            value[end] = std::sqrt(d);
+        }
+        return true;
+    }
+
+    // z = (L L^T)^{-1} r, the Jacobi scaling, or that plus P Ac^{-1} P^T r
+    void precondition(const Eigen::VectorXd &r, Eigen::VectorXd &z){
+        if(preconditioner==Jacobi){
+            z = r.cwiseProduct(invDiag);
+            return;
+        }
+        if(preconditioner==TwoLevel){
+            // restriction P^T r, coarse solve, and the interpolated correction on top of Jacobi
+            coarseRHS.setZero();
+            for(int s=0;s<n;s++){
+                int v = s<nv ? s : s-nv, d = s<nv ? 0 : numNodes;
+                const int *node = &vertexNode[4*v];
+                const double *w = &vertexWeight[4*v];
+                double value = r(s)*freeMask(s);
+                for(int m=0;m<4;m++) coarseRHS(node[m]+d) += w[m]*value;
+            }
+            // the steps of coarse.solve(), which would allocate for its in-place permutation and a copy of D
+            coarseSol = coarse.permutationP()*coarseRHS;
+            coarse.matrixL().solveInPlace(coarseSol);
+            coarseSol.array() *= coarseInvD.array();
+            coarse.matrixU().solveInPlace(coarseSol);
+            coarseRHS = coarse.permutationPinv()*coarseSol;
+            for(int s=0;s<n;s++){
+                int v = s<nv ? s : s-nv, d = s<nv ? 0 : numNodes;
+                const int *node = &vertexNode[4*v];
+                const double *w = &vertexWeight[4*v];
+                double value = w[0]*coarseRHS(node[0]+d) + w[1]*coarseRHS(node[1]+d) + w[2]*coarseRHS(node[2]+d) + w[3]*coarseRHS(node[3]+d);
+                z(s) = r(s)*invDiag(s) + value*freeMask(s);
+            }
+            return;
+        }
+        for(int i=0;i<n;i++){
+            double sum = r(i);
+            int end = rowStart[i+1]-1;
+            for(int e=rowStart[i];e<end;e++) sum -= value[e]*z(column[e]);
+            z(i) = sum/value[end];
+        }
+        for(int i=n-1;i>=0;i--){
+            int end = rowStart[i+1]-1;
+            z(i) /= value[end];
+            for(int e=rowStart[i];e<end;e++) z(column[e]) -= value[e]*z(i);
+        }
+    }
+
+    // preconditioned conjugate gradient on rhs, starting from sol
+    void pcg(){
+        double bnorm = rhs.norm();
+        if(bnorm==0){
+            sol.setZero();
+            return;
+        }
+        // the constrained DOFs are known; the iteration then leaves them alone
+        for(int i=0;i<n;i++) if(fixed[i]) sol(i) = rhs(i);
+        apply(sol, q);
+        res = rhs - q;
+        double rnorm = res.norm()/bnorm;
+        int it = 0;
+        double rz = 0;
+        while(it<iterationBudget && rnorm>tolerance){
+            precondition(res, z);
+            double rzNew = res.dot(z);
+            if(it==0) p = z;
+            else p = z + (rzNew/rz)*p;
+            rz = rzNew;
+            apply(p, q);
+            double alpha = rz/p.dot(q);
+            sol += alpha*p;
+            res -= alpha*q;
+            rnorm = res.norm()/bnorm;
+            it++;
+        }
+        lastIterations = std::max(lastIterations, it);
+        lastResidual = std::max(lastResidual, rnorm);
+    }
+};
+
+#endif /* MatrixFreeCG_h */
@@ -0,0 +1,192 @@
+//
+//  MeshSpatialIndex.h
+//  iPad-SimEnergy
+//
+//  Uniform grid over the current (deformed) vertices and triangles, for
+//  picking the vertex nearest to a touch and for locating the triangle and
+//  barycentric coordinates of a point (hit-testing, backward texture mapping).
+//
+//  The vertex arrays are read in place. After the vertices move, refit()
+//  recomputes their cells and re-buckets only if some vertex changed its cell;
+//  the bounding box of a triangle's cells is that of its vertices' cells, so
+//  the triangle buckets follow from the same test. Points outside the grid
+//  domain are clamped to its border cells, which keeps the queries exact; the
+//  domain is re-fitted when the mesh leaves it or shrinks well inside it.
+//
+
+#ifndef MeshSpatialIndex_h
+#define MeshSpatialIndex_h
+
+#include "ParallelFor.h"
+#include <atomic>
+#include <cmath>
+
+class MeshSpatialIndex {
+public:
+    // the arrays must stay valid until the next build()
+    void build(int numVertices, int numTriangles, const float *x, const float *y, const int *triangles){
+        this->numVertices = numVertices;
+        this->numTriangles = numTriangles;
+        this->x = x;
+        this->y = y;
+        this->triangles = triangles;
+        vertexCell.assign(numVertices, -1);
+        cols = rows = 0;
+        refit();
+    }
+
+    // to be called after the vertices moved (cheap when no vertex changed its cell)
+    void refit(){
+        if(numVertices==0) return;
+        float x0 = x[0], x1 = x[0], y0 = y[0], y1 = y[0];
+        for(int i=1;i<numVertices;i++){
+            x0 = std::min(x0, x[i]); x1 = std::max(x1, x[i]);
+            y0 = std::min(y0, y[i]); y1 = std::max(y1, y[i]);
+        }
+        bool outside = x0<minX || x1>maxX || y0<minY || y1>maxY;
+        bool shrunk = (x1-x0)*(y1-y0) < 0.25f*(maxX-minX)*(maxY-minY);
+        if(cols==0 || outside || shrunk){
+            setDomain(x0, x1, y0, y1);
+        }
+        // cells of the vertices; the buckets are only rebuilt if one of them changed
+        std::atomic<bool> changed(false);
+        parallelFor(0, numVertices, 4096, [&](int lo, int hi){
+            bool moved = false;
+            for(int i=lo;i<hi;i++){
+                int c = cellOf(x[i], y[i]);
+                if(c!=vertexCell[i]){
+                    vertexCell[i] = c;
+                    moved = true;
+                }
+            }
+            if(moved) changed.store(true, std::memory_order_relaxed);
+        });
+        if(changed.load() || rebucket){
+            bucketVertices();
+            bucketTriangles();
+            rebucket = false;
+        }
+    }
+
+    // nearest vertex with index >= firstVertex and squared distance below maxDist2, or -1.
+    // Ties go to the smaller index, as in a linear scan.
+    int nearestVertex(float px, float py, float maxDist2, int firstVertex = 0) const{
+        if(cols==0) return -1;
+        float r = std::sqrt(maxDist2);
+        int c0 = column(px-r), c1 = column(px+r);
+        int r0 = row(py-r), r1 = row(py+r);
+        int nearest = -1;
+        float minDist = maxDist2;
+        for(int j=r0;j<=r1;j++){
+            for(int i=c0;i<=c1;i++){
+                int cell = j*cols+i;
+                for(int k=vertexStart[cell];k<vertexStart[cell+1];k++){
+                    int v = vertexItems[k];
+                    if(v<firstVertex) continue;
+                    float dist = (px-x[v])*(px-x[v])+(py-y[v])*(py-y[v]);
+                    if(dist<minDist || (dist==minDist && nearest>=0 && v<nearest)){
+                        minDist = dist;
+                        nearest = v;
+                    }
+                }
+            }
+        }
+        return nearest;
+    }
+
+    // triangle containing (px, py) (the one with the smallest index if several do), or -1;
+    // bary receives the barycentric coordinates w.r.t. its three vertices
+    int locate(float px, float py, float bary[3]) const{
+        if(cols==0) return -1;
+        int cell = cellOf(px, py);
+        for(int k=triangleStart[cell];k<triangleStart[cell+1];k++){
+            int t = triangleItems[k];
+            if(barycentric(t, px, py, bary)) return t;
+        }
+        return -1;
+    }
+
+    // barycentric coordinates of (px, py) in triangle t; true if the point lies in it
+    bool barycentric(int t, float px, float py, float bary[3]) const{
+        const float tolerance = 1e-5f;
+        int a = triangles[3*t], b = triangles[3*t+1], c = triangles[3*t+2];
+        float det = (x[b]-x[a])*(y[c]-y[a]) - (x[c]-x[a])*(y[b]-y[a]);
+        if(det==0) return false;
+        bary[1] = ((px-x[a])*(y[c]-y[a]) - (x[c]-x[a])*(py-y[a]))/det;
+        bary[2] = ((x[b]-x[a])*(py-y[a]) - (px-x[a])*(y[b]-y[a]))/det;
+        bary[0] = 1.0f-bary[1]-bary[2];
+        return bary[0]>=-tolerance && bary[1]>=-tolerance && bary[2]>=-tolerance;
+    }
+
+private:
+    void setDomain(float x0, float x1, float y0, float y1){
+        // a margin, so that a drag does not immediately leave the domain
+        float w = std::max(x1-x0, 1e-6f), h = std::max(y1-y0, 1e-6f);
+        minX = x0-0.1f*w; maxX = x1+0.1f*w;
+        minY = y0-0.1f*h; maxY = y1+0.1f*h;
+        // about one vertex per cell
+        cellSize = std::sqrt((maxX-minX)*(maxY-minY)/numVertices);
+        cols = std::max(1, (int)std::ceil((maxX-minX)/cellSize));
+        rows = std::max(1, (int)std::ceil((maxY-minY)/cellSize));
+        vertexStart.assign(cols*rows+1, 0);
+        triangleStart.assign(cols*rows+1, 0);
+        rebucket = true;
+    }
+
+    int column(float px) const{
+        return std::min(cols-1, std::max(0, (int)std::floor((px-minX)/cellSize)));
+    }
+    int row(float py) const{
+        return std::min(rows-1, std::max(0, (int)std::floor((py-minY)/cellSize)));
+    }
+    int cellOf(float px, float py) const{ return row(py)*cols + column(px); }
+
+    // counting sort of the vertices by cell; items of a cell stay in index order
+    void bucketVertices(){
+        std::fill(vertexStart.begin(), vertexStart.end(), 0);
+        for(int i=0;i<numVertices;i++) vertexStart[vertexCell[i]+1]++;
+        for(int c=0;c<cols*rows;c++) vertexStart[c+1] += vertexStart[c];
+        vertexItems.resize(numVertices);
+        fill.assign(vertexStart.begin(), vertexStart.end()-1);
+        for(int i=0;i<numVertices;i++) vertexItems[fill[vertexCell[i]]++] = i;
+    }
+
+    // every triangle goes to all cells of the bounding box of its vertices' cells
+    template <class F>
+    void forTriangleCells(int t, const F &f) const{
+        int c[3], r[3];
+        for(int k=0;k<3;k++){
+            int cell = vertexCell[triangles[3*t+k]];
+            c[k] = cell%cols;
+            r[k] = cell/cols;
+        }
+        for(int j=std::min({r[0],r[1],r[2]});j<=std::max({r[0],r[1],r[2]});j++){
+            for(int i=std::min({c[0],c[1],c[2]});i<=std::max({c[0],c[1],c[2]});i++){
+                f(j*cols+i);
+            }
+        }
+    }
+
+    void bucketTriangles(){
+        std::fill(triangleStart.begin(), triangleStart.end(), 0);
+        for(int t=0;t<numTriangles;t++) forTriangleCells(t, [&](int cell){ triangleStart[cell+1]++; });
+        for(int c=0;c<cols*rows;c++) triangleStart[c+1] += triangleStart[c];
+        triangleItems.resize(triangleStart[cols*rows]);
+        fill.assign(triangleStart.begin(), triangleStart.end()-1);
+        for(int t=0;t<numTriangles;t++) forTriangleCells(t, [&](int cell){ triangleItems[fill[cell]++] = t; });
+    }
+
+    int numVertices = 0, numTriangles = 0;
+    const float *x = nullptr, *y = nullptr;
+    const int *triangles = nullptr;
+    // grid domain and resolution
+    float minX = 0, maxX = 0, minY = 0, maxY = 0, cellSize = 1;
+    int cols = 0, rows = 0;
+    bool rebucket = false;
+    std::vector<int> vertexCell;
+    // items of cell c are Items[Start[c]..Start[c+1])
+    std::vector<int> vertexStart, vertexItems, triangleStart, triangleItems;
+    std::vector<int> fill;
+};
+
+#endif /* MeshSpatialIndex_h */
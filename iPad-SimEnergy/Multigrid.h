@@ -0,0 +1,212 @@
+//
+//  Multigrid.h
+//  iPad-SimEnergy
+//
+//  Geometric multigrid preconditioned CG for the energies on the regular
+//  (H+1)x(V+1) grid of ImageMesh.
+//
+//  Each level halves the grid; the transfer is bilinear interpolation,
+//  applied to every block of DOFs (one block for ARAP, x and y for Sim), and
+//  the coarse operators are the Galerkin products R*A*P. So the constrained
+//  (identity) rows and columns need no special treatment: the fine matrix
+//  is the SPD system with the Dirichlet handles eliminated, and so is every
+//  coarse matrix. The smoother is symmetric Gauss-Seidel and the coarsest
+//  level is factorised, which makes the V-cycle a symmetric preconditioner.
+//
+//  The iteration runs in double, since the Sim energy has very small
+//  eigenvalues on fine grids. The incoming x is used as the initial guess,
+//  so that the previous frame warm-starts the next one.
+//
+//  Included by SolverBackend.h; select it with SolverBackend::Multigrid.
+//
+
+#ifndef Multigrid_h
+#define Multigrid_h
+
+class MultigridBackend : public SolverBackend {
+public:
+    typedef Eigen::SparseMatrix<double> SpMatD;
+
+    // at most this many V-cycles (= CG iterations) per solve
+    int cycleBudget = 20;
+    // relative residual at which a solve stops
+    double tolerance = 1e-5;
+    // Gauss-Seidel sweeps before and after the coarse correction
+    int smoothingSteps = 2;
+    // statistics of the last solve (worst column)
+    int lastCycles = 0;
+    double lastResidual = 0;
+
+    const char *name() const { return "Multigrid"; }
+
+    void setGrid(int horizontalDivisions, int verticalDivisions){
+        H = horizontalDivisions;
+        V = verticalDivisions;
+    }
+
+    void analyzePattern(const SpMat &){}
+
+    void factorize(const SpMat &G){
+        auto start = std::chrono::steady_clock::now();
+        buildHierarchy(G);
+        factorizeTime += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    }
+
+    bool succeeded() const { return coarse.info() == Eigen::Success; }
+
+    using SolverBackend::solve;
+    void solve(const Eigen::MatrixXf &b, Eigen::MatrixXf &x){
+        auto start = std::chrono::steady_clock::now();
+        int n = (int)b.rows();
+        // warm start from x when it has the right shape
+        if(x.rows()!=n || x.cols()!=b.cols()) x.setZero(n, b.cols());
+        lastCycles = 0;
+        lastResidual = 0;
+        for(int k=0;k<b.cols();k++){
+            rhs = b.col(k).cast<double>();
+            sol = x.col(k).cast<double>();
+            pcg();
+            x.col(k) = sol.cast<float>();
+        }
+        solveTime += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+        numSolves++;
+    }
+
+private:
+    struct Level {
+        int H, V;
+        SpMatD A, P, R;
+        Eigen::VectorXd invDiag, b, x, r;
+    };
+
+    int H = 0, V = 0;
+    std::vector<Level> levels;
+    Eigen::SimplicialLDLT<SpMatD> coarse;
+    // CG vectors
+    Eigen::VectorXd rhs, sol, res, z, p, q;
+
+    // bilinear interpolation from the grid with ((H+1)/2, (V+1)/2) divisions, for each block
+    static SpMatD prolongation(int H, int V, int blocks){
+        int Hc = (H+1)/2, Vc = (V+1)/2;
+        int nf = (H+1)*(V+1), nc = (Hc+1)*(Vc+1);
+        std::vector<Eigen::Triplet<double> > tripletList;
+        tripletList.reserve(4*blocks*nf);
+        for(int j=0;j<=V;j++){
+            int j0 = j/2, j1 = (j+1)/2;
+            for(int i=0;i<=H;i++){
+                int i0 = i/2, i1 = (i+1)/2;
+                double w = (i0==i1 ? 1.0 : 0.5) * (j0==j1 ? 1.0 : 0.5);
+                for(int s=0;s<blocks;s++){
+                    int row = s*nf + j*(H+1)+i;
+                    tripletList.push_back(Eigen::Triplet<double>(row, s*nc + j0*(Hc+1)+i0, w));
+                    if(i1!=i0) tripletList.push_back(Eigen::Triplet<double>(row, s*nc + j0*(Hc+1)+i1, w));
+                    if(j1!=j0) tripletList.push_back(Eigen::Triplet<double>(row, s*nc + j1*(Hc+1)+i0, w));
+                    if(i1!=i0 && j1!=j0) tripletList.push_back(Eigen::Triplet<double>(row, s*nc + j1*(Hc+1)+i1, w));
+                }
+            }
+        }
+        SpMatD P(blocks*nf, blocks*nc);
+        P.setFromTriplets(tripletList.begin(), tripletList.end());
+        return P;
+    }
+
+    void buildHierarchy(const SpMat &G){
+        levels.clear();
+        Level fine;
+        fine.H = H;
+        fine.V = V;
+        fine.A = G.cast<double>();
+        levels.push_back(fine);
+        int nv = (H+1)*(V+1);
+        // a matrix that does not live on the grid is solved directly
+        int blocks = (H>0 && V>0 && G.rows()%nv==0) ? (int)G.rows()/nv : 0;
+        while(blocks>0 && levels.back().A.rows()>1000 && levels.back().H>=4 && levels.back().V>=4){
+            Level &l = levels.back();
+            l.P = prolongation(l.H, l.V, blocks);
+            l.R = l.P.transpose();
+            Level next;
+            next.H = (l.H+1)/2;
+            next.V = (l.V+1)/2;
+            next.A = l.R * l.A * l.P;
+            levels.push_back(next);
+        }
+        for(Level &l : levels){
+            l.A.makeCompressed();
+            l.invDiag = l.A.diagonal().cwiseInverse();
+            l.b.setZero(l.A.rows());
+            l.x.setZero(l.A.rows());
+            l.r.setZero(l.A.rows());
+        }
+        coarse.compute(levels.back().A);
+        int n = (int)G.rows();
+        rhs.setZero(n); sol.setZero(n); res.setZero(n);
+        z.setZero(n); p.setZero(n); q.setZero(n);
+    }
+
+    // symmetric matrix: column i holds row i
+    static void gaussSeidel(const Level &l, Eigen::VectorXd &x, bool forward){
+        int n = (int)l.A.rows();
+        const int *outer = l.A.outerIndexPtr();
+        const int *inner = l.A.innerIndexPtr();
+        const double *value = l.A.valuePtr();
+        for(int k=0;k<n;k++){
+            int i = forward ? k : n-1-k;
+            double sum = l.b(i);
+            for(int e=outer[i];e<outer[i+1];e++){
+                if(inner[e]!=i) sum -= value[e]*x(inner[e]);
+            }
+            x(i) = sum*l.invDiag(i);
+        }
+    }
+
+    // one V-cycle for levels[k].b from a zero initial guess, into levels[k].x
+    void vcycle(int k){
+        Level &l = levels[k];
+        if(k+1==(int)levels.size()){
+            l.x = coarse.solve(l.b);
+            return;
+        }
+        l.x.setZero();
+        for(int s=0;s<smoothingSteps;s++) gaussSeidel(l, l.x, true);
+        l.r = l.b;
+        l.r.noalias() -= l.A * l.x;
+        levels[k+1].b.noalias() = l.R * l.r;
+        vcycle(k+1);
+        l.x.noalias() += l.P * levels[k+1].x;
+        for(int s=0;s<smoothingSteps;s++) gaussSeidel(l, l.x, false);
+    }
+
+    // preconditioned conjugate gradient on rhs, starting from sol
+    void pcg(){
+        const SpMatD &A = levels[0].A;
+        double bnorm = rhs.norm();
+        if(bnorm==0){
+            sol.setZero();
+            return;
+        }
+        res = rhs;
+        res.noalias() -= A * sol;
+        double rnorm = res.norm()/bnorm;
+        int it = 0;
+        double rz = 0;
+        while(it<cycleBudget && rnorm>tolerance){
+            levels[0].b = res;
+            vcycle(0);
+            z = levels[0].x;
+            double rzNew = res.dot(z);
+            if(it==0) p = z;
+            else p = z + (rzNew/rz)*p;
+            rz = rzNew;
+            q.noalias() = A * p;
+            double alpha = rz/p.dot(q);
+            sol += alpha*p;
+            res -= alpha*q;
+            rnorm = res.norm()/bnorm;
+            it++;
+        }
+        lastCycles = std::max(lastCycles, it);
+        lastResidual = std::max(lastResidual, rnorm);
+    }
+};
+
+#endif /* Multigrid_h */
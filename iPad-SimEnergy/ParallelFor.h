@@ -0,0 +1,177 @@
+//
+//  ParallelFor.h
+//  iPad-SimEnergy
+//
+//  Splits an index range into contiguous chunks processed concurrently.
+//  Uses Grand Central Dispatch where blocks are available and a persistent
+//  set of worker threads elsewhere; small ranges run on the calling thread,
+//  and so do all ranges on threads marked by parallelForSerial() (workers that
+//  already keep every core busy, as those of WorkStealingPool).
+//
+//  The workers are created on first use, or up front by parallelForReserve(),
+//  and wait on a condition variable between loops, so that a loop on the
+//  frame path neither creates threads nor allocates. They serve one loop at a
+//  time: a loop started on another thread while they are busy runs on its
+//  own thread.
+//
+
+#ifndef ParallelFor_h
+#define ParallelFor_h
+
+#if defined(__APPLE__) && defined(__BLOCKS__)
+#include <dispatch/dispatch.h>
+#endif
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// upper bound on the chunks of a parallelFor; 0 for the hardware concurrency
+inline std::atomic<int> &parallelConcurrencyLimit(){
+    static std::atomic<int> limit{0};
+    return limit;
+}
+
+inline int parallelConcurrency(){
+    static const int hardware = (int)std::max(1u, std::thread::hardware_concurrency());
+    int limit = parallelConcurrencyLimit().load(std::memory_order_relaxed);
+    return limit>0 ? limit : hardware;
+}
+
+// true on the current thread: parallelFor runs there without spawning
+inline bool &parallelForSerial(){
+    static thread_local bool serial = false;
+    return serial;
+}
+
+#if !(defined(__APPLE__) && defined(__BLOCKS__))
+// workers of parallelFor; the calling thread takes chunks as well
+class ParallelPool {
+public:
+    static ParallelPool &instance(){
+        static ParallelPool pool;
+        return pool;
+    }
+
+    ~ParallelPool(){
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        wakeup.notify_all();
+        for(std::thread &t : threads) t.join();
+    }
+
+    // at least the given number of workers; only growing the pool allocates
+    void reserve(int workers){
+        std::lock_guard<std::mutex> lock(mutex);
+        while((int)threads.size()<workers) threads.emplace_back([this](){ work(); });
+    }
+
+    // call(context, c) for every chunk c in [0, chunks); false if the workers serve another loop
+    bool run(int chunks, void (*call)(const void *, int), const void *context){
+        std::unique_lock<std::mutex> exclusive(dispatch, std::try_to_lock);
+        if(!exclusive.owns_lock()) return false;
+        reserve(chunks-1);
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            job = Job{call, context, chunks};
+            next.store(0, std::memory_order_relaxed);
+            generation++;
+        }
+        wakeup.notify_all();
+        // loops nested in the chunks run serially, and never come back here holding dispatch
+        bool serial = parallelForSerial();
+        parallelForSerial() = true;
+        runChunks(job);
+        parallelForSerial() = serial;
+        // every chunk was taken by this thread or by a busy worker; once none is busy, all are done
+        std::unique_lock<std::mutex> lock(mutex);
+        done.wait(lock, [this](){ return busy==0; });
+        // workers that wake up late find no job, rather than one whose context is gone
+        job = Job();
+        return true;
+    }
+
+private:
+    struct Job {
+        void (*call)(const void *, int) = nullptr;
+        const void *context = nullptr;
+        int chunks = 0;
+    };
+
+    void runChunks(const Job &current){
+        for(int c=next.fetch_add(1, std::memory_order_relaxed);c<current.chunks;c=next.fetch_add(1, std::memory_order_relaxed)){
+            current.call(current.context, c);
+        }
+    }
+
+    void work(){
+        parallelForSerial() = true;
+        std::unique_lock<std::mutex> lock(mutex);
+        unsigned long seen = generation;
+        for(;;){
+            wakeup.wait(lock, [&](){ return stopping || generation!=seen; });
+            if(stopping) return;
+            seen = generation;
+            if(!job.call) continue;
+            Job current = job;
+            busy++;
+            lock.unlock();
+            runChunks(current);
+            lock.lock();
+            if(--busy==0) done.notify_one();
+        }
+    }
+
+    std::mutex dispatch, mutex;
+    std::condition_variable wakeup, done;
+    std::vector<std::thread> threads;
+    // guarded by mutex
+    Job job;
+    unsigned long generation = 0;
+    int busy = 0;
+    bool stopping = false;
+    // next chunk to take
+    std::atomic<int> next{0};
+};
+#endif
+
+// creates the workers of parallelFor for the current concurrency, so that the first loops do not
+inline void parallelForReserve(){
+#if !(defined(__APPLE__) && defined(__BLOCKS__))
+    ParallelPool::instance().reserve(parallelConcurrency()-1);
+#endif
+}
+
+// calls f(lo, hi) on disjoint chunks covering [begin, end); chunks have at least grain indices
+template <class F>
+inline void parallelFor(int begin, int end, int grain, const F &f){
+    int n = end-begin;
+    int chunks = std::min(parallelConcurrency(), n/std::max(grain, 1));
+    if(chunks<=1 || parallelForSerial()){
+        if(n>0) f(begin, end);
+        return;
+    }
+#if defined(__APPLE__) && defined(__BLOCKS__)
+    const F *g = &f;
+    dispatch_apply(chunks, DISPATCH_APPLY_AUTO, ^(size_t c){
+        (*g)(begin + (int)((long)n*c/chunks), begin + (int)((long)n*(c+1)/chunks));
+    });
+#else
+    struct Chunks {
+        const F &f;
+        int begin, n, chunks;
+        static void call(const void *context, int c){
+            const Chunks &s = *static_cast<const Chunks *>(context);
+            s.f(s.begin + (int)((long)s.n*c/s.chunks), s.begin + (int)((long)s.n*(c+1)/s.chunks));
+        }
+    };
+    Chunks context{f, begin, n, chunks};
+    if(!ParallelPool::instance().run(chunks, &Chunks::call, &context)) f(begin, end);
+#endif
+}
+
+#endif /* ParallelFor_h */
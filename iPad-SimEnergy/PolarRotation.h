@@ -0,0 +1,137 @@
+//
+//  PolarRotation.h
+//  iPad-SimEnergy
+//
+//  Orthogonal part of the polar decomposition of 2x2 matrices in closed form,
+//  batched over structure-of-arrays input.
+//
+//  For M = [a b; c d] with det(M) > 0 the polar factor is the rotation
+//  [p -q; q p]/sqrt(p^2+q^2) with p = a+d, q = c-b. For det(M) < 0 it is the
+//  reflection [p q; q -p]/sqrt(p^2+q^2) with p = a-d, q = b+c. This is the
+//  limit of Higham's scaled Newton iteration, computed without iterating.
+//  A vanishing matrix yields the identity.
+//
+//  Only IEEE-exact operations (add, mul, sqrt, div) are used, so the SIMD
+//  lanes and the scalar tail give identical results.
+//
+
+#ifndef PolarRotation_h
+#define PolarRotation_h
+
+#if defined(__AVX__) || defined(__SSE2__)
+#include <immintrin.h>
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+#include <arm_neon.h>
+#endif
+#include <cmath>
+
+struct ScalarLanes {
+    typedef float V;
+    typedef bool Mask;
+    static const int width = 1;
+    static V load(const float *p){ return *p; }
+    static void store(float *p, V v){ *p = v; }
+    static V set(float s){ return s; }
+    static V add(V a, V b){ return a+b; }
+    static V sub(V a, V b){ return a-b; }
+    static V mul(V a, V b){ return a*b; }
+    static V div(V a, V b){ return a/b; }
+    static V sqrt(V a){ return std::sqrt(a); }
+    static Mask less(V a, V b){ return a<b; }
+    static Mask equal(V a, V b){ return a==b; }
+    static V select(Mask m, V a, V b){ return m ? a : b; }
+};
+
+#if defined(__AVX__)
+struct SimdLanes {
+    typedef __m256 V;
+    typedef __m256 Mask;
+    static const int width = 8;
+    static V load(const float *p){ return _mm256_loadu_ps(p); }
+    static void store(float *p, V v){ _mm256_storeu_ps(p, v); }
+    static V set(float s){ return _mm256_set1_ps(s); }
+    static V add(V a, V b){ return _mm256_add_ps(a, b); }
+    static V sub(V a, V b){ return _mm256_sub_ps(a, b); }
+    static V mul(V a, V b){ return _mm256_mul_ps(a, b); }
+    static V div(V a, V b){ return _mm256_div_ps(a, b); }
+    static V sqrt(V a){ return _mm256_sqrt_ps(a); }
+    static Mask less(V a, V b){ return _mm256_cmp_ps(a, b, _CMP_LT_OQ); }
+    static Mask equal(V a, V b){ return _mm256_cmp_ps(a, b, _CMP_EQ_OQ); }
+    static V select(Mask m, V a, V b){ return _mm256_blendv_ps(b, a, m); }
+};
+#define HAS_SIMD_LANES
+#elif defined(__SSE2__)
+struct SimdLanes {
+    typedef __m128 V;
+    typedef __m128 Mask;
+    static const int width = 4;
+    static V load(const float *p){ return _mm_loadu_ps(p); }
+    static void store(float *p, V v){ _mm_storeu_ps(p, v); }
+    static V set(float s){ return _mm_set1_ps(s); }
+    static V add(V a, V b){ return _mm_add_ps(a, b); }
+    static V sub(V a, V b){ return _mm_sub_ps(a, b); }
+    static V mul(V a, V b){ return _mm_mul_ps(a, b); }
+    static V div(V a, V b){ return _mm_div_ps(a, b); }
+    static V sqrt(V a){ return _mm_sqrt_ps(a); }
+    static Mask less(V a, V b){ return _mm_cmplt_ps(a, b); }
+    static Mask equal(V a, V b){ return _mm_cmpeq_ps(a, b); }
+    static V select(Mask m, V a, V b){ return _mm_or_ps(_mm_and_ps(m, a), _mm_andnot_ps(m, b)); }
+};
+#define HAS_SIMD_LANES
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+struct SimdLanes {
+    typedef float32x4_t V;
+    typedef uint32x4_t Mask;
+    static const int width = 4;
+    static V load(const float *p){ return vld1q_f32(p); }
+    static void store(float *p, V v){ vst1q_f32(p, v); }
+    static V set(float s){ return vdupq_n_f32(s); }
+    static V add(V a, V b){ return vaddq_f32(a, b); }
+    static V sub(V a, V b){ return vsubq_f32(a, b); }
+    static V mul(V a, V b){ return vmulq_f32(a, b); }
+    static V div(V a, V b){ return vdivq_f32(a, b); }
+    static V sqrt(V a){ return vsqrtq_f32(a); }
+    static Mask less(V a, V b){ return vcltq_f32(a, b); }
+    static Mask equal(V a, V b){ return vceqq_f32(a, b); }
+    static V select(Mask m, V a, V b){ return vbslq_f32(m, a, b); }
+};
+#define HAS_SIMD_LANES
+#endif
+
+// polar factors of the matrices [m00[i] m01[i]; m10[i] m11[i]] for i in [begin,end)
+template <class L>
+inline int polarRotationKernel(int begin, int end, const float *m00, const float *m01, const float *m10, const float *m11,
+                               float *r00, float *r01, float *r10, float *r11){
+    const typename L::V zero = L::set(0.0f), one = L::set(1.0f);
+    int i = begin;
+    for(; i+L::width<=end; i+=L::width){
+        typename L::V a = L::load(m00+i), b = L::load(m01+i), c = L::load(m10+i), d = L::load(m11+i);
+        typename L::Mask reflect = L::less(L::sub(L::mul(a, d), L::mul(b, c)), zero);
+        typename L::V p = L::select(reflect, L::sub(a, d), L::add(a, d));
+        typename L::V q = L::select(reflect, L::add(b, c), L::sub(c, b));
+        typename L::V len2 = L::add(L::mul(p, p), L::mul(q, q));
+        typename L::Mask degenerate = L::equal(len2, zero);
+        p = L::select(degenerate, one, p);
+        q = L::select(degenerate, zero, q);
+        typename L::V len = L::select(degenerate, one, L::sqrt(len2));
+        p = L::div(p, len);
+        q = L::div(q, len);
+        typename L::V np = L::sub(zero, p), nq = L::sub(zero, q);
+        L::store(r00+i, p);
+        L::store(r01+i, L::select(reflect, q, nq));
+        L::store(r10+i, q);
+        L::store(r11+i, L::select(reflect, np, p));
+    }
+    return i;
+}
+
+inline void polarRotations(int n, const float *m00, const float *m01, const float *m10, const float *m11,
+                           float *r00, float *r01, float *r10, float *r11){
+    int i = 0;
+#ifdef HAS_SIMD_LANES
+    i = polarRotationKernel<SimdLanes>(0, n, m00, m01, m10, m11, r00, r01, r10, r11);
+#endif
+    polarRotationKernel<ScalarLanes>(i, n, m00, m01, m10, m11, r00, r01, r10, r11);
+}
+
+#endif /* PolarRotation_h */
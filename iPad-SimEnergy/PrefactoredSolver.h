@@ -0,0 +1,139 @@
+//
+//  PrefactoredSolver.h
+//  iPad-SimEnergy
+//
+//  Constraint-independent factorization of the energy matrix.
+//
+//  The unconstrained energy matrix K is factorised once per rest pose with a
+//  few "anchor" DOFs pinned so that the base matrix B is non-singular.
+//  Handle constraints are then imposed through a small bordered (KKT) system
+//  solved by its Schur complement, so changing the set of touched vertices
+//  costs #handles back-substitutions instead of a full factorisation.
+//
+//  The right-hand side follows the same convention as the identity-row
+//  systems in ViewController.cpp: rows of constrained DOFs hold the target
+//  values, all other rows hold the (possibly zero) load.
+//
+
+#ifndef PrefactoredSolver_h
+#define PrefactoredSolver_h
+
+#include "SolverBackend.h"
+
+class PrefactoredSolver {
+public:
+    PrefactoredSolver() : n(0), backend(SolverBackend::create(SolverBackend::LU)) {}
+
+    void setBackend(SolverBackend::Kind kind){
+        backend = SolverBackend::create(kind);
+        n = 0;
+    }
+    SolverBackend &getBackend(){ return *backend; }
+
+    // factorise the unconstrained matrix K with the given DOFs pinned
+    void factorize(const SpMat &K, const std::vector<int> &anchorDOFs){
+        n = (int)K.rows();
+        this->K = K;
+        isAnchor.assign(n, false);
+        anchors.clear();
+        for(int a : anchorDOFs){
+            if(!isAnchor[a]){
+                isAnchor[a] = true;
+                anchors.push_back(a);
+            }
+        }
+        // B: K with the anchor rows and columns replaced by identity (SPD)
+        backend->setConstraints(isAnchor);
+        backend->compute(eliminateConstraints(K, isAnchor));
+        handles.clear();
+        isHandle.assign(n, false);
+    }
+
+    // set the constrained DOFs; costs one back-substitution per bordered column
+    void setHandles(const std::vector<int> &handleDOFs){
+        isHandle.assign(n, false);
+        handles.clear();
+        for(int h : handleDOFs){
+            if(!isHandle[h]){
+                isHandle[h] = true;
+                handles.push_back(h);
+            }
+        }
+        // bordered columns: free anchors (coupling to K) and non-anchor handles (selectors)
+        borders.clear();
+        for(int a : anchors) if(!isHandle[a]) borders.push_back(a);
+        numFreeAnchors = (int)borders.size();
+        for(int h : handles) if(!isAnchor[h]) borders.push_back(h);
+        int m = (int)borders.size();
+        W = Eigen::MatrixXf::Zero(n, m);
+        Eigen::MatrixXf D = Eigen::MatrixXf::Zero(m, m);
+        for(int j=0;j<numFreeAnchors;j++){
+            int a = borders[j];
+            for(SpMat::InnerIterator it(K,a);it;++it){
+                if(!isAnchor[it.row()]){
+                    W(it.row(),j) = it.value();
+                }
+            }
+            for(int l=0;l<numFreeAnchors;l++){
+                D(l,j) = K.coeff(borders[l],a);
+            }
+        }
+        for(int j=numFreeAnchors;j<m;j++){
+            W(borders[j],j) = 1.0;
+        }
+        Z = backend->solve(W);
+        Eigen::MatrixXf S = D - W.transpose() * Z;
+        schur.compute(S);
+    }
+
+    // solve with the current handles; see the header comment for the layout of b.
+    // Uses member buffers only, so a drag frame does not allocate.
+    void solve(const Eigen::MatrixXf &b, Eigen::MatrixXf &x){
+        int c = (int)b.cols();
+        int m = (int)borders.size();
+        // load on the free DOFs, with constrained anchors moved to the right-hand side
+        r = b;
+        for(int h : handles) r.row(h).setZero();
+        for(int h : handles){
+            if(!isAnchor[h]) continue;
+            for(SpMat::InnerIterator it(K,h);it;++it){
+                if(!isHandle[it.row()]){
+                    r.row(it.row()) -= it.value() * b.row(h);
+                }
+            }
+        }
+        rhs.resize(m, c);
+        for(int j=0;j<numFreeAnchors;j++) rhs.row(j) = r.row(borders[j]);
+        for(int j=numFreeAnchors;j<m;j++) rhs.row(j) = b.row(borders[j]);
+        for(int a : anchors) r.row(a).setZero();
+        // pure Sim drags have no load at all: skip the back-substitution
+        if(r.isZero(0)){
+            x.setZero(n, c);
+        }else{
+            backend->solve(r, x);
+            for(int k=0;k<c;k++) rhs.col(k).noalias() -= W.transpose() * x.col(k);
+        }
+        y = schur.solve(rhs);
+        // column by column, so that the products stay matrix-vector and need no blocking workspace
+        for(int k=0;k<c;k++) x.col(k).noalias() -= Z * y.col(k);
+        for(int j=0;j<numFreeAnchors;j++) x.row(borders[j]) = y.row(j);
+        for(int h : handles) x.row(h) = b.row(h);
+    }
+
+    bool isFactorized() const { return n > 0; }
+    void invalidate(){ n = 0; }
+
+private:
+    int n, numFreeAnchors;
+    SpMat K;
+    std::unique_ptr<SolverBackend> backend;
+    std::vector<bool> isAnchor, isHandle;
+    std::vector<int> anchors, handles, borders;
+    // W: bordered columns, Z = B^{-1} W
+    Eigen::MatrixXf W, Z;
+    // per-frame buffers
+    Eigen::MatrixXf r, rhs, y;
+    Eigen::PartialPivLU<Eigen::MatrixXf> schur;
+};
+
+#endif /* PrefactoredSolver_h */
@@ -0,0 +1,235 @@
+//
+//  ShapeInterpolator.h
+//  iPad-SimEnergy
+//
+//  In-between frames of two poses of the same triangulation, after Kaji et al.
+//  (SCA2012): the affine map A of each triangle from the source to the target
+//  pose is split by its polar decomposition A = R S, and at time t the triangle
+//  should follow A(t) = R(t*angle) ((1-t) I + t S). The vertices minimise
+//  sum |B(t) - A(t)|^2 over the triangles, B(t) = V(t) Pinv, with one vertex
+//  moving linearly from the source to the target.
+//
+//  The matrix of that system is the ARAP energy of the source pose, so it is
+//  factorised once in setPoses(), together with the rotation angles (made
+//  consistent across neighbouring triangles) and the stretches. A frame then costs a right-hand side and one back-substitution;
+//  frames() computes them concurrently, each thread with its own buffers.
+//
+
+#ifndef ShapeInterpolator_h
+#define ShapeInterpolator_h
+
+#include "ArapWorkspace.h"
+#include "ParallelFor.h"
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <vector>
+
+class ShapeInterpolator {
+public:
+    int numVertices = 0, numTriangles = 0;
+
+    // the triangles and the poses are copied; false if the source pose is degenerate
+    bool setPoses(int nv, int nt, const int *triangles, const float *sx, const float *sy, const float *tx, const float *ty){
+        numVertices = nv;
+        numTriangles = nt;
+        this->triangles.assign(triangles, triangles+3*nt);
+        arap.resize(nv, nt);
+        arap.computePinv(sx, sy, triangles);
+        // anchor: the vertex of a triangle nearest to the centroid, which keeps the round-off of the solve small
+        float cx = 0, cy = 0;
+        for(int i=0;i<nv;i++){ cx += sx[i]; cy += sy[i]; }
+        cx /= std::max(nv, 1); cy /= std::max(nv, 1);
+        anchor = 0;
+        float nearest = INFINITY;
+        for(int k=0;k<3*nt;k++){
+            int i = triangles[k];
+            float d2 = (sx[i]-cx)*(sx[i]-cx) + (sy[i]-cy)*(sy[i]-cy);
+            if(d2<nearest){ nearest = d2; anchor = i; }
+        }
+        anchorSource[0] = sx[anchor]; anchorSource[1] = sy[anchor];
+        anchorTarget[0] = tx[anchor]; anchorTarget[1] = ty[anchor];
+
+        // polar decomposition of the local map of each triangle
+        angle.resize(nt);
+        for(int k=0;k<4;k++) S[k].resize(nt);
+        const std::vector<float> *P = arap.P;
+        for(int i=0;i<nt;i++){
+            int p0=triangles[3*i], p1=triangles[3*i+1], p2=triangles[3*i+2];
+            float a = tx[p0]*P[0][i] + tx[p1]*P[2][i] + tx[p2]*P[4][i];
+            float b = tx[p0]*P[1][i] + tx[p1]*P[3][i] + tx[p2]*P[5][i];
+            float c = ty[p0]*P[0][i] + ty[p1]*P[2][i] + ty[p2]*P[4][i];
+            float d = ty[p0]*P[1][i] + ty[p1]*P[3][i] + ty[p2]*P[5][i];
+            // the closest rotation [p -q; q p]/|(p,q)|, even for a flipped triangle
+            float p = a+d, q = c-b;
+            angle[i] = std::atan2(q, p);
+            float len = std::sqrt(p*p+q*q);
+            float co = len>0 ? p/len : 1.0f, si = len>0 ? q/len : 0.0f;
+            // S = R^T A, so that the last frame reproduces A exactly
+            S[0][i] = co*a + si*c;
+            S[1][i] = co*b + si*d;
+            S[2][i] = -si*a + co*c;
+            S[3][i] = -si*b + co*d;
+        }
+        unwrapAngles();
+
+        std::vector<T> tripletList;
+        tripletList.reserve(9*nt);
+        arap.energyTriplets(triangles, tripletList);
+        K.resize(nv, nv);
+        K.setFromTriplets(tripletList.begin(), tripletList.end());
+        isFixed.assign(nv, false);
+        isFixed[anchor] = true;
+        fixed.assign(1, anchor);
+        G = eliminateConstraints(K, isFixed);
+        auto start = std::chrono::steady_clock::now();
+        solver.compute(G);
+        factorizeTime = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+        return solver.info()==Eigen::Success;
+    }
+
+    // count in-between frames at t = (k+1)/(count+1); frame k is x[k*numVertices + i], y[...]
+    void frames(int count, float *x, float *y){
+        parallelFor(0, count, 1, [&](int lo, int hi){
+            Buffers buffers;
+            buffers.resize(numVertices, numTriangles);
+            for(int k=lo;k<hi;k++){
+                frame((float)(k+1)/(count+1), x+(size_t)k*numVertices, y+(size_t)k*numVertices, buffers);
+            }
+        });
+    }
+
+    // a single frame at time t; t=0 is the source and t=1 the target pose (up to round-off)
+    void frame(float t, float *x, float *y){
+        Buffers buffers;
+        buffers.resize(numVertices, numTriangles);
+        frame(t, x, y, buffers);
+    }
+
+    // steps of iterative refinement per frame, each one more back-substitution
+    int refinement = 0;
+    // milliseconds spent in the factorization of the last setPoses()
+    double factorizeTime = 0;
+
+private:
+    // atan2 picks each angle in (-pi, pi] on its own, so neighbours turned by about pi could rotate
+    // in opposite directions and tear the in-between frames; instead each triangle takes the branch
+    // angle + 2 pi k nearest to the triangle it is reached from, over the edges of each component
+    void unwrapAngles(){
+        // the edges (lower vertex, higher vertex, triangle), sorted so that shared edges are adjacent
+        std::vector<std::array<int,3>> edges;
+        edges.reserve(3*numTriangles);
+        for(int i=0;i<numTriangles;i++){
+            for(int k=0;k<3;k++){
+                int a = triangles[3*i+k], b = triangles[3*i+(k+1)%3];
+                edges.push_back({std::min(a, b), std::max(a, b), i});
+            }
+        }
+        std::sort(edges.begin(), edges.end());
+        // neighbours of triangle i are neighbour[neighbourStart[i]..neighbourStart[i+1])
+        std::vector<int> neighbourStart(numTriangles+1, 0), neighbour;
+        for(int pass=0;pass<2;pass++){
+            std::vector<int> fill(neighbourStart.begin(), neighbourStart.end()-1);
+            for(size_t e=0;e+1<edges.size();e++){
+                if(edges[e][0]!=edges[e+1][0] || edges[e][1]!=edges[e+1][1]) continue;
+                int i = edges[e][2], j = edges[e+1][2];
+                if(pass==0){
+                    neighbourStart[i+1]++;
+                    neighbourStart[j+1]++;
+                }else{
+                    neighbour[fill[i]++] = j;
+                    neighbour[fill[j]++] = i;
+                }
+            }
+            if(pass==0){
+                for(int i=0;i<numTriangles;i++) neighbourStart[i+1] += neighbourStart[i];
+                neighbour.resize(neighbourStart[numTriangles]);
+            }
+        }
+        // breadth first from the first triangle of each component, which keeps its principal angle
+        const float twoPi = 6.28318531f;
+        std::vector<bool> reached(numTriangles, false);
+        std::vector<int> queue;
+        queue.reserve(numTriangles);
+        for(int seed=0;seed<numTriangles;seed++){
+            if(reached[seed]) continue;
+            reached[seed] = true;
+            queue.assign(1, seed);
+            for(size_t q=0;q<queue.size();q++){
+                int i = queue[q];
+                for(int e=neighbourStart[i];e<neighbourStart[i+1];e++){
+                    int j = neighbour[e];
+                    if(reached[j]) continue;
+                    reached[j] = true;
+                    angle[j] += twoPi*std::round((angle[i]-angle[j])/twoPi);
+                    queue.push_back(j);
+                }
+            }
+        }
+    }
+
+    // per-thread storage of a frame
+    struct Buffers {
+        std::vector<float> A[4];
+        Eigen::MatrixXf U, Sol, tmp, residual, correction;
+        void resize(int nv, int nt){
+            for(int k=0;k<4;k++) A[k].resize(nt);
+            U.resize(nv, 2);
+            Sol.resize(nv, 2);
+        }
+    };
+
+    void frame(float t, float *x, float *y, Buffers &buffers){
+        const std::vector<float> *P = arap.P;
+        std::vector<float> *A = buffers.A;
+        // A(t) = R(t*angle) ((1-t) I + t S)
+        for(int i=0;i<numTriangles;i++){
+            float co = std::cos(t*angle[i]), si = std::sin(t*angle[i]);
+            float m00 = 1-t + t*S[0][i], m01 = t*S[1][i];
+            float m10 = t*S[2][i], m11 = 1-t + t*S[3][i];
+            A[0][i] = co*m00 - si*m10;
+            A[1][i] = co*m01 - si*m11;
+            A[2][i] = si*m00 + co*m10;
+            A[3][i] = si*m01 + co*m11;
+        }
+        // right-hand side Pinv * A(t)^T, with the anchor row holding its position
+        Eigen::MatrixXf &U = buffers.U;
+        U.setZero();
+        for(int i=0;i<numTriangles;i++){
+            for(int k=0;k<3;k++){
+                int pos=triangles[3*i+k];
+                U(pos,0) += P[2*k][i]*A[0][i] + P[2*k+1][i]*A[1][i];
+                U(pos,1) += P[2*k][i]*A[2][i] + P[2*k+1][i]*A[3][i];
+            }
+        }
+        U.row(anchor) << (1-t)*anchorSource[0] + t*anchorTarget[0], (1-t)*anchorSource[1] + t*anchorTarget[1];
+        moveConstraintsToRHS(K, fixed, isFixed, U);
+        // the factorization is only read, so frames can be solved concurrently
+        solveInto(solver, U, buffers.Sol, buffers.tmp);
+        // the float factorization loses digits on large meshes; each step of refinement recovers some
+        for(int r=0;r<refinement;r++){
+            buffers.residual.noalias() = U - G*buffers.Sol;
+            solveInto(solver, buffers.residual, buffers.correction, buffers.tmp);
+            buffers.Sol += buffers.correction;
+        }
+        for(int i=0;i<numVertices;i++){
+            x[i] = buffers.Sol(i,0);
+            y[i] = buffers.Sol(i,1);
+        }
+    }
+
+    std::vector<int> triangles;
+    // inverted mesh matrices of the source pose
+    ArapWorkspace arap;
+    // rotation angle and stretch S[2*j+l] of each triangle
+    std::vector<float> angle, S[4];
+    int anchor = 0;
+    float anchorSource[2], anchorTarget[2];
+    // the energy, and the factorised matrix with the anchor eliminated
+    SpMat K, G;
+    std::vector<bool> isFixed;
+    std::vector<int> fixed;
+    SimplicialFactor<Eigen::SimplicialLDLT<SpMat>> solver;
+};
+
+#endif /* ShapeInterpolator_h */
@@ -0,0 +1,174 @@
+//
+//  SimAssembly.h
+//  iPad-SimEnergy
+//
+//  Assembly of the similarity invariant energy with a fixed sparsity pattern.
+//
+//  The pattern only depends on the triangulation, so it is built once by
+//  analyze(), together with a scatter map from every per-triangle
+//  contribution to its slot in the compressed storage of the matrix. Since
+//  the matrix is symmetric, its column-major storage is also its CSR form.
+//  assemble() then only evaluates the triangles and sums the contributions
+//  of each slot, both in parallel, without sorting or allocating.
+//  The entries are evaluated and summed in double, which matters for small
+//  triangles or large coordinates (they are divided by a squared area); the
+//  float matrix is rounded from the double one, which is kept for iterative
+//  refinement. The triangles are evaluated in batches of SIM_ENERGY_BATCH.
+//
+
+#ifndef SimAssembly_h
+#define SimAssembly_h
+
+#include "SolverBackend.h"
+#include "ParallelFor.h"
+
+// local DOFs of a triangle (x0,y0,x1,y1,x2,y2) of the non-zero entries of its 6x6 block
+static const int simEnergyEntryDOFs[30][2] = {
+    {0,0},{0,2},{0,3},{0,4},{0,5}, {1,1},{1,2},{1,3},{1,4},{1,5},
+    {2,0},{2,1},{2,2},{2,4},{2,5}, {3,0},{3,1},{3,3},{3,4},{3,5},
+    {4,0},{4,1},{4,2},{4,3},{4,4}, {5,0},{5,1},{5,2},{5,3},{5,5}
+};
+
+// partial derivative of the energy |B|^2 - 2 det(B), where B=VP^{-1}, for W rest triangles at once.
+// The Maple output of SimEnergyComputation.mw, with its common subexpressions taken out: every entry
+// is a dot product of two edges of the triangle, or +-det, over det^2 (det: twice the signed area).
+// The coordinates come in structure-of-arrays form (triangle l is (a[l],b[l]), (c[l],d[l]), (e[l],f[l]));
+// the entries of triangle l go to v[30*l..30*l+29] in the order of simEnergyEntryDOFs.
+// The loop over the triangles has no branches, so the compiler vectorizes it for float and double.
+template <class S, int W>
+inline void simEnergyBatch(const S *a, const S *b, const S *c, const S *d, const S *e, const S *f, S *v){
+    // squared edge lengths opposite each vertex, dot products of the edges at each vertex, and 1/det
+    S k00[W], k11[W], k22[W], k01[W], k02[W], k12[W], r[W];
+    for(int l=0;l<W;l++){
+        // p0-p1, p0-p2, p1-p2
+        S qx = a[l]-c[l], qy = b[l]-d[l];
+        S sx = a[l]-e[l], sy = b[l]-f[l];
+        S ux = c[l]-e[l], uy = d[l]-f[l];
+        S inv = 1/(sx*uy-sy*ux);
+        S inv2 = inv*inv;
+        k00[l] = (ux*ux+uy*uy)*inv2;
+        k11[l] = (sx*sx+sy*sy)*inv2;
+        k22[l] = (qx*qx+qy*qy)*inv2;
+        k01[l] = -(sx*ux+sy*uy)*inv2;
+        k02[l] = (qx*ux+qy*uy)*inv2;
+        k12[l] = -(qx*sx+qy*sy)*inv2;
+        r[l] = inv;
+    }
+    for(int l=0;l<W;l++){
+        S *o = v+30*l;
+        // partial by x and y
+        o[0] = k00[l]; o[1] = k01[l]; o[2] = -r[l]; o[3] = k02[l]; o[4] = r[l];
+        o[5] = k00[l]; o[6] = r[l]; o[7] = k01[l]; o[8] = -r[l]; o[9] = k02[l];
+        // partial by z and w
+        o[10] = k01[l]; o[11] = r[l]; o[12] = k11[l]; o[13] = k12[l]; o[14] = -r[l];
+        o[15] = -r[l]; o[16] = k01[l]; o[17] = k11[l]; o[18] = r[l]; o[19] = k12[l];
+        // partial by s and t
+        o[20] = k02[l]; o[21] = -r[l]; o[22] = k12[l]; o[23] = r[l]; o[24] = k22[l];
+        o[25] = r[l]; o[26] = k02[l]; o[27] = -r[l]; o[28] = k12[l]; o[29] = k22[l];
+    }
+}
+
+// the entries of a single triangle
+template <class S>
+inline void simEnergyEntries(S a, S b, S c, S d, S e, S f, S *v){
+    simEnergyBatch<S, 1>(&a, &b, &c, &d, &e, &f, v);
+}
+
+// triangles per call of simEnergyBatch in the assembly; the fastest width in benchmark --kernels
+static const int SIM_ENERGY_BATCH = 8;
+
+class SimAssembly {
+public:
+    // symbolic phase: pattern of the 2n x 2n matrix and the scatter map
+    void analyze(int numVertices, int numTriangles, const int *triangles){
+        this->numVertices = numVertices;
+        this->numTriangles = numTriangles;
+        tri.assign(triangles, triangles+3*numTriangles);
+        int n = 2*numVertices;
+        std::vector<T> tripletList;
+        tripletList.reserve(30*numTriangles);
+        for(int i=0;i<numTriangles;i++){
+            for(int k=0;k<30;k++){
+                tripletList.push_back(T(dof(i,simEnergyEntryDOFs[k][0]), dof(i,simEnergyEntryDOFs[k][1]), 0.0f));
+            }
+        }
+        K = SpMat(n, n);
+        K.setFromTriplets(tripletList.begin(), tripletList.end());
+        K.makeCompressed();
+        Kd = K.cast<double>();
+        // slot of every contribution, then the contributions of every slot
+        std::vector<int> slot(30*numTriangles);
+        contribStart.assign(K.nonZeros()+1, 0);
+        for(int i=0;i<numTriangles;i++){
+            for(int k=0;k<30;k++){
+                int row = dof(i,simEnergyEntryDOFs[k][0]);
+                int col = dof(i,simEnergyEntryDOFs[k][1]);
+                const int *begin = K.innerIndexPtr()+K.outerIndexPtr()[col];
+                const int *end = K.innerIndexPtr()+K.outerIndexPtr()[col+1];
+                slot[30*i+k] = (int)(std::lower_bound(begin, end, row)-K.innerIndexPtr());
+                contribStart[slot[30*i+k]+1]++;
+            }
+        }
+        for(int s=0;s<K.nonZeros();s++) contribStart[s+1] += contribStart[s];
+        contribIndex.resize(30*numTriangles);
+        std::vector<int> fill(contribStart.begin(), contribStart.end()-1);
+        for(int c=0;c<30*numTriangles;c++) contribIndex[fill[slot[c]]++] = c;
+        contrib.resize(30*numTriangles);
+    }
+
+    bool isAnalyzed() const { return numVertices>0; }
+    // to be called when the triangulation changes
+    void invalidate(){ numVertices = 0; }
+
+    // numeric phase for the rest pose (ix, iy)
+    void assemble(const float *ix, const float *iy){
+        const int W = SIM_ENERGY_BATCH;
+        parallelFor(0, (numTriangles+W-1)/W, 256/W, [&](int lo, int hi){
+            double a[W], b[W], c[W], d[W], e[W], f[W], v[30*W];
+            for(int batch=lo;batch<hi;batch++){
+                int first = batch*W, count = std::min(W, numTriangles-first);
+                // gather the rest pose of the batch; the last one is padded with its first triangle
+                for(int l=0;l<W;l++){
+                    const int *t = &tri[3*(first + (l<count ? l : 0))];
+                    a[l] = ix[t[0]]; b[l] = iy[t[0]];
+                    c[l] = ix[t[1]]; d[l] = iy[t[1]];
+                    e[l] = ix[t[2]]; f[l] = iy[t[2]];
+                }
+                if(count==W){
+                    simEnergyBatch<double, W>(a, b, c, d, e, f, &contrib[30*first]);
+                }else{
+                    simEnergyBatch<double, W>(a, b, c, d, e, f, v);
+                    std::copy(v, v+30*count, &contrib[30*first]);
+                }
+            }
+        });
+        float *values = K.valuePtr();
+        double *preciseValues = Kd.valuePtr();
+        parallelFor(0, (int)K.nonZeros(), 1024, [&](int lo, int hi){
+            for(int s=lo;s<hi;s++){
+                double sum = 0;
+                for(int c=contribStart[s];c<contribStart[s+1];c++) sum += contrib[contribIndex[c]];
+                preciseValues[s] = sum;
+                values[s] = (float)sum;
+            }
+        });
+    }
+
+    const SpMat &matrix() const { return K; }
+    // the same matrix before rounding to float
+    const SpMatD &preciseMatrix() const { return Kd; }
+
+private:
+    // global DOF of local DOF l of triangle i: x block then y block
+    int dof(int i, int l) const { return tri[3*i+l/2] + (l%2)*numVertices; }
+
+    int numVertices = 0, numTriangles = 0;
+    std::vector<int> tri;
+    SpMat K;
+    SpMatD Kd;
+    // contribIndex[contribStart[s]..contribStart[s+1]) are the contributions to slot s
+    std::vector<int> contribStart, contribIndex;
+    std::vector<double> contrib;
+};
+
+#endif /* SimAssembly_h */
@@ -0,0 +1,191 @@
+//
+//  SimEnergyCore.cpp
+//  iPad-SimEnergy
+//
+//  C interface to DeformationEngine; see SimEnergyCore.h.
+//  No C++ exception crosses the interface.
+//
+
+#include "SimEnergyCore.h"
+#include "DeformationEngine.h"
+#include "MeshSpatialIndex.h"
+#include <new>
+
+struct SimEnergyEngine {
+    DeformationEngine engine;
+    // over the caller's vertices; refitted lazily on the next query
+    MeshSpatialIndex spatialIndex;
+    bool hasMesh = false;
+    // the mode, backend or prefactoring changed since the handles were set, so the factorization
+    // does not match the system solve() would use; the next solve rebuilds it
+    bool handlesStale = false;
+};
+
+// runs f, turning the exceptions of the C++ core into status codes
+template <class F>
+static SimEnergyStatus guarded(SimEnergyEngine *engine, const F &f){
+    if(!engine) return SIMENERGY_INVALID_ARGUMENT;
+    try{
+        return f();
+    }catch(const std::bad_alloc &){
+        return SIMENERGY_OUT_OF_MEMORY;
+    }catch(...){
+        return SIMENERGY_INVALID_ARGUMENT;
+    }
+}
+
+int simenergy_abi_version(void){
+    return SIMENERGY_ABI_VERSION;
+}
+
+SimEnergyEngine *simenergy_create(void){
+    return new (std::nothrow) SimEnergyEngine();
+}
+
+void simenergy_destroy(SimEnergyEngine *engine){
+    delete engine;
+}
+
+SimEnergyStatus simenergy_set_mesh(SimEnergyEngine *engine, const SimEnergyMesh *mesh){
+    return guarded(engine, [&]{
+        if(!mesh || mesh->numVertices<=0 || mesh->numTriangles<=0 || !mesh->x || !mesh->y
+           || !mesh->ix || !mesh->iy || !mesh->triangles || !mesh->selected){
+            return SIMENERGY_INVALID_ARGUMENT;
+        }
+        DeformationMesh m;
+        m.horizontalDivisions = mesh->horizontalDivisions;
+        m.verticalDivisions = mesh->verticalDivisions;
+        m.numVertices = mesh->numVertices;
+        m.numTriangles = mesh->numTriangles;
+        m.x = mesh->x;
+        m.y = mesh->y;
+        m.ix = mesh->ix;
+        m.iy = mesh->iy;
+        m.triangles = mesh->triangles;
+        m.selected = mesh->selected;
+        m.numSelected = 0;
+        engine->hasMesh = false;
+        engine->engine.setMesh(m);
+        engine->spatialIndex.build(m.numVertices, m.numTriangles, m.x, m.y, m.triangles);
+        engine->hasMesh = true;
+        return SIMENERGY_OK;
+    });
+}
+
+SimEnergyStatus simenergy_set_mode(SimEnergyEngine *engine, SimEnergyMode mode){
+    return guarded(engine, [&]{
+        if(mode!=SIMENERGY_SIM && mode!=SIMENERGY_ARAP) return SIMENERGY_INVALID_ARGUMENT;
+        if(engine->engine.mode!=mode){
+            engine->engine.mode = mode;
+            engine->engine.invalidate();
+            engine->handlesStale = true;
+        }
+        return SIMENERGY_OK;
+    });
+}
+
+SimEnergyStatus simenergy_set_iterations(SimEnergyEngine *engine, int iterations){
+    return guarded(engine, [&]{
+        if(iterations<1) return SIMENERGY_INVALID_ARGUMENT;
+        engine->engine.iteration = iterations;
+        return SIMENERGY_OK;
+    });
+}
+
+SimEnergyStatus simenergy_set_arap_budget(SimEnergyEngine *engine, double milliseconds, double tolerance){
+    return guarded(engine, [&]{
+        if(!(milliseconds>=0) || !(tolerance>=0)) return SIMENERGY_INVALID_ARGUMENT;
+        engine->engine.arapBudget = milliseconds;
+        engine->engine.arapTolerance = tolerance;
+        return SIMENERGY_OK;
+    });
+}
+
+SimEnergyStatus simenergy_arap_progress(SimEnergyEngine *engine, int *iterations, double *energy, double *rotationChange){
+    return guarded(engine, [&]{
+        const DeformationEngine::ArapProgress &progress = engine->engine.arapProgress();
+        if(iterations) *iterations = progress.iterations;
+        if(energy) *energy = progress.energy;
+        if(rotationChange) *rotationChange = progress.rotationChange;
+        return SIMENERGY_OK;
+    });
+}
+
+SimEnergyStatus simenergy_set_prefactored(SimEnergyEngine *engine, int prefactored){
+    return guarded(engine, [&]{
+        if(engine->engine.prefactored!=(prefactored!=0)){
+            engine->engine.prefactored = prefactored!=0;
+            engine->handlesStale = true;
+        }
+        return SIMENERGY_OK;
+    });
+}
+
+SimEnergyStatus simenergy_set_backend(SimEnergyEngine *engine, SimEnergyBackend backend){
+    return guarded(engine, [&]{
+        if(backend<SIMENERGY_BACKEND_LU || backend>SIMENERGY_BACKEND_BLOCK_LDLT) return SIMENERGY_INVALID_ARGUMENT;
+        engine->engine.setSolverBackend((SolverBackend::Kind)backend);
+        engine->handlesStale = true;
+        return SIMENERGY_OK;
+    });
+}
+
+SimEnergyStatus simenergy_set_refinement(SimEnergyEngine *engine, int steps){
+    return guarded(engine, [&]{
+        if(steps<0) return SIMENERGY_INVALID_ARGUMENT;
+        engine->engine.refinementSteps = steps;
+        return SIMENERGY_OK;
+    });
+}
+
+double simenergy_refinement_error_bound(SimEnergyEngine *engine){
+    return engine ? engine->engine.refinement().errorBound : 0;
+}
+
+SimEnergyStatus simenergy_set_handle_basis(SimEnergyEngine *engine, int enabled){
+    return guarded(engine, [&]{
+        engine->engine.handleBasis = enabled!=0;
+        return SIMENERGY_OK;
+    });
+}
+
+SimEnergyStatus simenergy_set_handles(SimEnergyEngine *engine, int numSelected){
+    return guarded(engine, [&]{
+        if(!engine->hasMesh || numSelected<0 || numSelected>engine->engine.getMesh().numVertices){
+            return SIMENERGY_INVALID_ARGUMENT;
+        }
+        engine->engine.setNumSelected(numSelected);
+        engine->engine.formEnergy();
+        engine->handlesStale = false;
+        if(numSelected>0 && !engine->engine.backend().succeeded()) return SIMENERGY_FACTORIZATION_FAILED;
+        return SIMENERGY_OK;
+    });
+}
+
+SimEnergyStatus simenergy_solve(SimEnergyEngine *engine){
+    return guarded(engine, [&]{
+        if(!engine->hasMesh) return SIMENERGY_INVALID_ARGUMENT;
+        if(engine->handlesStale){
+            engine->engine.formEnergy();
+            engine->handlesStale = false;
+        }
+        if(engine->engine.getMesh().numSelected>0 && !engine->engine.backend().succeeded()){
+            return SIMENERGY_FACTORIZATION_FAILED;
+        }
+        engine->engine.solve();
+        return SIMENERGY_OK;
+    });
+}
+
+SimEnergyStatus simenergy_invalidate(SimEnergyEngine *engine){
+    return guarded(engine, [&]{
+        engine->engine.invalidate();
+        return SIMENERGY_OK;
+    });
+}
+
+int simenergy_nearest_vertex(SimEnergyEngine *engine, float px, float py, float maxDistance2, int firstVertex){
+    if(!engine || !engine->hasMesh) return -1;
+    engine->spatialIndex.refit();
+    return engine->spatialIndex.nearestVertex(px, py, maxDistance2, firstVertex);
+}
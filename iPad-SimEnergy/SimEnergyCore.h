@@ -0,0 +1,113 @@
+//
+//  SimEnergyCore.h
+//  iPad-SimEnergy
+//
+//  Plain C interface to the deformation core (DeformationEngine), for
+//  callers that cannot use C++ directly, such as the Swift front end.
+//
+//  The engine works on the caller's arrays in place: the vertex, rest pose,
+//  triangle and selection arrays passed to simenergy_set_mesh() are neither
+//  copied nor freed, and must stay valid until the next simenergy_set_mesh()
+//  or simenergy_destroy(). Solves write the vertex positions into x and y.
+//
+//  The layout of the arrays is that of ImageMesh; the structures and
+//  enumerations below only use fixed C types, so the ABI stays stable
+//  across versions of the C++ code.
+//
+
+#ifndef SimEnergyCore_h
+#define SimEnergyCore_h
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// bumped on any incompatible change of the functions or structures below
+#define SIMENERGY_ABI_VERSION 1
+
+typedef struct SimEnergyEngine SimEnergyEngine;
+
+typedef struct SimEnergyMesh {
+    // grid structure, used by the geometric solvers (0 for a general mesh)
+    int horizontalDivisions, verticalDivisions;
+    int numVertices, numTriangles;
+    // current vertex coordinates (read and written)
+    float *x, *y;
+    // initial vertex coordinates
+    float *ix, *iy;
+    // vertex indices of the triangles (3*numTriangles)
+    const int *triangles;
+    // indices of the selected vertices (room for numVertices)
+    const int *selected;
+} SimEnergyMesh;
+
+typedef enum SimEnergyMode {
+    SIMENERGY_SIM = 0,
+    SIMENERGY_ARAP = 1
+} SimEnergyMode;
+
+// the values of SolverBackend::Kind
+typedef enum SimEnergyBackend {
+    SIMENERGY_BACKEND_LU = 0,
+    SIMENERGY_BACKEND_LDLT = 1,
+    SIMENERGY_BACKEND_CHOLESKY = 2,
+    SIMENERGY_BACKEND_SUPERNODAL_CHOLESKY = 3,
+    SIMENERGY_BACKEND_MULTIGRID = 4,
+    SIMENERGY_BACKEND_BANDED_LAPACK = 5,
+    SIMENERGY_BACKEND_MATRIX_FREE_CG = 6,
+    SIMENERGY_BACKEND_BLOCK_LDLT = 7
+} SimEnergyBackend;
+
+typedef enum SimEnergyStatus {
+    SIMENERGY_OK = 0,
+    SIMENERGY_INVALID_ARGUMENT = 1,
+    // the energy is singular for the current handles
+    SIMENERGY_FACTORIZATION_FAILED = 2,
+    SIMENERGY_OUT_OF_MEMORY = 3
+} SimEnergyStatus;
+
+int simenergy_abi_version(void);
+
+// NULL if out of memory
+SimEnergyEngine *simenergy_create(void);
+void simenergy_destroy(SimEnergyEngine *engine);
+
+// zero-copy: the engine keeps the pointers (see above) and allocates its workspaces
+SimEnergyStatus simenergy_set_mesh(SimEnergyEngine *engine, const SimEnergyMesh *mesh);
+
+SimEnergyStatus simenergy_set_mode(SimEnergyEngine *engine, SimEnergyMode mode);
+// local/global iterations of ARAP per solve
+SimEnergyStatus simenergy_set_iterations(SimEnergyEngine *engine, int iterations);
+// ARAP: instead of the iteration count, rounds until the rotations change less than tolerance
+// or the milliseconds are spent, continuing in the next solve (0 milliseconds: the iteration count)
+SimEnergyStatus simenergy_set_arap_budget(SimEnergyEngine *engine, double milliseconds, double tolerance);
+// ARAP rounds of the last solve, with the energy and the rotation change (RMS) of its last local step; any pointer may be NULL
+SimEnergyStatus simenergy_arap_progress(SimEnergyEngine *engine, int *iterations, double *energy, double *rotationChange);
+// factorise the energy once per rest pose and move the handles through a Schur complement
+SimEnergyStatus simenergy_set_prefactored(SimEnergyEngine *engine, int prefactored);
+SimEnergyStatus simenergy_set_backend(SimEnergyEngine *engine, SimEnergyBackend backend);
+// mixed precision: steps of iterative refinement per solve, with residuals in double (0: float only)
+SimEnergyStatus simenergy_set_refinement(SimEnergyEngine *engine, int steps);
+// bound on the relative error left by the refinement in the last solve (0 without refinement)
+double simenergy_refinement_error_bound(SimEnergyEngine *engine);
+// Sim: solve for every handle at simenergy_set_handles, and evaluate each drag as a dense product with that basis
+SimEnergyStatus simenergy_set_handle_basis(SimEnergyEngine *engine, int enabled);
+
+// touch down/up: the first numSelected entries of the mesh's selected array are the handles.
+// Rebuilds and factorises the energy; call it whenever the selection or the mode changes.
+SimEnergyStatus simenergy_set_handles(SimEnergyEngine *engine, int numSelected);
+// drag: positions of the free vertices for the handle positions in x and y. After a change of the
+// mode, backend or prefactoring without simenergy_set_handles, it first rebuilds the energy itself.
+SimEnergyStatus simenergy_solve(SimEnergyEngine *engine);
+// the rest pose changed (or the mesh was reset), so a kept factorization is stale
+SimEnergyStatus simenergy_invalidate(SimEnergyEngine *engine);
+
+// vertex nearest to (px, py) with a squared distance below maxDistance2, skipping the
+// vertices before firstVertex; -1 if there is none
+int simenergy_nearest_vertex(SimEnergyEngine *engine, float px, float py, float maxDistance2, int firstVertex);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* SimEnergyCore_h */
@@ -0,0 +1,297 @@
+//
+//  SolverBackend.h
+//  iPad-SimEnergy
+//
+//  Sparse direct solvers selectable at runtime, and the symmetric elimination
+//  of constrained DOFs that keeps the energy matrix SPD.
+//
+//  Constraints are imposed by replacing both the row and the column of a
+//  constrained DOF with identity and moving the column to the right-hand side.
+//  The right-hand side follows the convention of the identity-row systems:
+//  rows of constrained DOFs hold the target values, other rows hold the load.
+//
+
+#ifndef SolverBackend_h
+#define SolverBackend_h
+
+#include "AllocationCounter.h"
+#include "Eigen/Sparse"
+#include "Eigen/Dense"
+#if defined(__APPLE__) && __has_include("Eigen/AccelerateSupport")
+#include "Eigen/AccelerateSupport"
+#define HAS_ACCELERATE_SPARSE
+#endif
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <memory>
+#include <vector>
+
+typedef Eigen::SparseMatrix<float> SpMat;
+typedef Eigen::Triplet<float> T;
+// the energy in double, for the residuals of the iterative refinement
+typedef Eigen::SparseMatrix<double> SpMatD;
+typedef Eigen::Triplet<double> TD;
+
+class SolverBackend {
+public:
+    enum Kind { LU, LDLT, Cholesky, SupernodalCholesky, Multigrid, BandedLAPACK, MatrixFreeCG, BlockLDLT };
+
+    virtual ~SolverBackend() {}
+    virtual const char *name() const = 0;
+    // symbolic phase; only depends on the sparsity pattern
+    virtual void analyzePattern(const SpMat &G) = 0;
+    // numeric phase
+    virtual void factorize(const SpMat &G) = 0;
+    virtual bool succeeded() const = 0;
+    // x must not alias b; the simplicial Cholesky backends do not allocate once x has its size.
+    // Iterative backends take x as the initial guess.
+    virtual void solve(const Eigen::MatrixXf &b, Eigen::MatrixXf &x) = 0;
+    // structure of the mesh, used by the geometric backends
+    virtual void setGrid(int /*horizontalDivisions*/, int /*verticalDivisions*/) {}
+    // triangles and rest pose of the mesh, used by the matrix-free backends (read at factorization)
+    virtual void setTriangles(int /*numVertices*/, int /*numTriangles*/, const int * /*triangles*/, const float * /*ix*/, const float * /*iy*/) {}
+    // the DOFs that factorize() will find eliminated (identity rows and columns)
+    virtual void setConstraints(const std::vector<bool> & /*isFixed*/) {}
+    // entries of the factors as one matrix (L+U, or L+D+L^T) after factorize(); 0 where they are not exposed
+    virtual long factorNonZeros() const { return 0; }
+
+    Eigen::MatrixXf solve(const Eigen::MatrixXf &b){
+        Eigen::MatrixXf x;
+        solve(b, x);
+        return x;
+    }
+
+    void compute(const SpMat &G){
+        analyzePattern(G);
+        factorize(G);
+    }
+
+    // timings in milliseconds, for comparing the backends on the same mesh
+    double factorizeTime = 0, solveTime = 0;
+    int numSolves = 0;
+    void resetTimings(){ factorizeTime = solveTime = 0; numSolves = 0; }
+
+    static std::unique_ptr<SolverBackend> create(Kind kind);
+    // the Kind spelled as its enumerator ("LDLT", "MatrixFreeCG", ...); false for an unknown name
+    static bool parse(const char *name, Kind &kind);
+};
+
+// generic solve; Eigen's in-place permutations allocate a mask
+template <class Solver>
+inline void solveInto(Solver &solver, const Eigen::MatrixXf &b, Eigen::MatrixXf &x, Eigen::MatrixXf &){
+    x = solver.solve(b);
+}
+// a simplicial Cholesky whose factors are applied by hand through a preallocated buffer
+template <class Base>
+class SimplicialFactor : public Base {
+public:
+    // vectorD() returns a copy
+    const typename Base::VectorType &diagonal() const { return this->m_diag; }
+};
+template <class Base>
+inline void solveInto(SimplicialFactor<Base> &solver, const Eigen::MatrixXf &b, Eigen::MatrixXf &x, Eigen::MatrixXf &tmp){
+    if(solver.permutationP().size()>0){
+        tmp.noalias() = solver.permutationP() * b;
+    }else{
+        tmp = b;
+    }
+    solver.matrixL().solveInPlace(tmp);
+    if(solver.diagonal().size()>0){
+        tmp.array().colwise() /= solver.diagonal().array();
+    }
+    solver.matrixU().solveInPlace(tmp);
+    if(solver.permutationPinv().size()>0){
+        x.noalias() = solver.permutationPinv() * tmp;
+    }else{
+        x = tmp;
+    }
+}
+
+// entries of the factors of an Eigen solver, as counted by SolverBackend::factorNonZeros()
+template <class Solver>
+inline long factorEntries(const Solver &){ return 0; }
+template <class Base>
+inline long factorEntries(const SimplicialFactor<Base> &solver){
+    // L holds the diagonal for LLT, D for LDLT
+    long l = (long)solver.matrixL().nestedExpression().nonZeros(), n = (long)solver.rows();
+    return solver.diagonal().size()>0 ? 2*l+n : 2*l-n;
+}
+template <class Ordering>
+inline long factorEntries(const Eigen::SparseLU<SpMat, Ordering> &solver){
+    // both count the diagonal
+    return (long)(solver.nnzL() + solver.nnzU()) - (long)solver.rows();
+}
+
+template <class Solver>
+class EigenBackend : public SolverBackend {
+public:
+    explicit EigenBackend(const char *name) : backendName(name) {}
+    const char *name() const { return backendName; }
+    void analyzePattern(const SpMat &G){
+        solver.analyzePattern(G);
+    }
+    void factorize(const SpMat &G){
+        auto start = std::chrono::steady_clock::now();
+        solver.factorize(G);
+        factorizeTime += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    }
+    bool succeeded() const { return solver.info() == Eigen::Success; }
+    long factorNonZeros() const { return succeeded() ? factorEntries(solver) : 0; }
+    using SolverBackend::solve;
+    void solve(const Eigen::MatrixXf &b, Eigen::MatrixXf &x){
+        auto start = std::chrono::steady_clock::now();
+        solveInto(solver, b, x, tmp);
+        solveTime += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+        numSolves++;
+    }
+private:
+    const char *backendName;
+    Solver solver;
+    Eigen::MatrixXf tmp;
+};
+
+#include "Multigrid.h"
+#include "MatrixFreeCG.h"
+#include "LapackBackend.h"
+#include "BlockLDLT.h"
+
+inline std::unique_ptr<SolverBackend> SolverBackend::create(Kind kind){
+    switch(kind){
+        case Multigrid:
+            return std::unique_ptr<SolverBackend>(new MultigridBackend());
+        case MatrixFreeCG:
+            return std::unique_ptr<SolverBackend>(new MatrixFreeCGBackend());
+        case BlockLDLT:
+            return std::unique_ptr<SolverBackend>(new BlockLDLTBackend());
+        case BandedLAPACK:
+#ifdef HAS_LAPACK
+            return std::unique_ptr<SolverBackend>(new LapackBackend());
+#else
+            // built without LAPACK; fall back to the sparse LU
+            return std::unique_ptr<SolverBackend>(new EigenBackend<Eigen::SparseLU<SpMat, Eigen::COLAMDOrdering<int>>>("SparseLU"));
+#endif
+        case LDLT:
+            return std::unique_ptr<SolverBackend>(new EigenBackend<SimplicialFactor<Eigen::SimplicialLDLT<SpMat>>>("SimplicialLDLT"));
+        case Cholesky:
+            return std::unique_ptr<SolverBackend>(new EigenBackend<SimplicialFactor<Eigen::SimplicialLLT<SpMat>>>("SimplicialLLT"));
+        case SupernodalCholesky:
+#ifdef HAS_ACCELERATE_SPARSE
+            return std::unique_ptr<SolverBackend>(new EigenBackend<Eigen::AccelerateLLT<SpMat>>("AccelerateLLT"));
+#else
+            // no supernodal factorisation available; fall back to the simplicial one
+            return std::unique_ptr<SolverBackend>(new EigenBackend<SimplicialFactor<Eigen::SimplicialLLT<SpMat>>>("SimplicialLLT"));
+#endif
+        case LU:
+        default:
+            return std::unique_ptr<SolverBackend>(new EigenBackend<Eigen::SparseLU<SpMat, Eigen::COLAMDOrdering<int>>>("SparseLU"));
+    }
+}
+
+inline bool SolverBackend::parse(const char *name, Kind &kind){
+    static const struct { const char *name; Kind kind; } table[] = {
+        {"LU", LU}, {"LDLT", LDLT}, {"Cholesky", Cholesky}, {"SupernodalCholesky", SupernodalCholesky},
+        {"Multigrid", Multigrid}, {"BandedLAPACK", BandedLAPACK}, {"MatrixFreeCG", MatrixFreeCG}, {"BlockLDLT", BlockLDLT},
+    };
+    for(const auto &entry : table){
+        if(std::strcmp(name, entry.name)==0){
+            kind = entry.kind;
+            return true;
+        }
+    }
+    return false;
+}
+
+// K with the rows and columns of fixed DOFs replaced by identity.
+// The pattern of K is kept (with explicit zeros), so that the symbolic analysis
+// of a backend stays valid for any set of constraints; every DOF of the
+// energy has a diagonal entry.
+inline SpMat eliminateConstraints(const SpMat &K, const std::vector<bool> &isFixed){
+    SpMat G = K;
+    G.makeCompressed();
+    for(int k=0;k<G.outerSize();k++){
+        for(SpMat::InnerIterator it(G,k);it;++it){
+            if(isFixed[it.row()] || isFixed[it.col()]){
+                it.valueRef() = (it.row()==it.col()) ? 1.0f : 0.0f;
+            }
+        }
+    }
+    return G;
+}
+
+// entries of the factors that are zero in G, the matrix they factorise
+inline long fillIn(const SolverBackend &backend, const SpMat &G){
+    long entries = backend.factorNonZeros();
+    return entries>0 ? std::max(0L, entries-(long)G.nonZeros()) : 0;
+}
+
+inline bool samePattern(const SpMat &A, const SpMat &B){
+    return A.isCompressed() && B.isCompressed() && A.rows()==B.rows() && A.cols()==B.cols()
+        && A.nonZeros()==B.nonZeros()
+        && std::equal(A.outerIndexPtr(), A.outerIndexPtr()+A.outerSize()+1, B.outerIndexPtr())
+        && std::equal(A.innerIndexPtr(), A.innerIndexPtr()+A.nonZeros(), B.innerIndexPtr());
+}
+
+// move the columns of the fixed DOFs to the right-hand side
+inline void moveConstraintsToRHS(const SpMat &K, const std::vector<int> &fixed, const std::vector<bool> &isFixed, Eigen::MatrixXf &b){
+    for(int h : fixed){
+        for(SpMat::InnerIterator it(K,h);it;++it){
+            if(!isFixed[it.row()]){
+                b.row(it.row()) -= it.value() * b.row(h);
+            }
+        }
+    }
+}
+
+// the energy with Dirichlet constraints, factorised once per constraint set
+class ConstrainedSolver {
+public:
+    ConstrainedSolver() : backend(SolverBackend::create(SolverBackend::LU)) {}
+
+    void setBackend(SolverBackend::Kind kind){
+        backend = SolverBackend::create(kind);
+        analyzed = false;
+    }
+    SolverBackend &getBackend(){ return *backend; }
+    const SpMat &energy() const { return K; }
+
+    // the symbolic analysis is kept as long as the sparsity pattern does not change
+    void setEnergy(const SpMat &K){
+        analyzed = analyzed && samePattern(this->K, K);
+        this->K = K;
+    }
+
+    void setConstraints(const std::vector<int> &fixedDOFs){
+        isFixed.assign(K.rows(), false);
+        fixed.clear();
+        for(int i : fixedDOFs){
+            if(!isFixed[i]){
+                isFixed[i] = true;
+                fixed.push_back(i);
+            }
+        }
+        SpMat G = eliminateConstraints(K, isFixed);
+        backend->setConstraints(isFixed);
+        if(!analyzed){
+            backend->analyzePattern(G);
+            analyzed = true;
+        }
+        backend->factorize(G);
+    }
+
+    void solve(const Eigen::MatrixXf &b, Eigen::MatrixXf &x){
+        r = b;
+        moveConstraintsToRHS(K, fixed, isFixed, r);
+        backend->solve(r, x);
+    }
+
+private:
+    std::unique_ptr<SolverBackend> backend;
+    bool analyzed = false;
+    SpMat K;
+    std::vector<bool> isFixed;
+    std::vector<int> fixed;
+    Eigen::MatrixXf r;
+};
+
+#endif /* SolverBackend_h */
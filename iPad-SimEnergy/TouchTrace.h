@@ -0,0 +1,200 @@
+//
+//  TouchTrace.h
+//  iPad-SimEnergy
+//
+//  Compact append-only binary trace of what the solver was asked to do,
+//  for reproducing performance problems offline (see benchmark/replay.cpp).
+//
+//  AsyncSolver writes a record for every request it processes (touch down/up,
+//  mode and iteration changes, drags with the handle positions and the ARAP
+//  rounds a frame with a time budget took), every mesh, reset and backend
+//  change, with the time since the start of the recording.
+//  Drags that were superseded before being solved are not in the trace, so a
+//  replay runs exactly the solves of the recorded session. Checkpoint records
+//  hold the published vertices at the end of each gesture, for a bit-for-bit
+//  comparison.
+//
+//  Layout: the 8-byte file header, then records of a 16-byte RecordHeader
+//  followed by `size` bytes of payload, all in the byte order of the recording
+//  device (little-endian on every supported platform). Payloads are arrays of
+//  int32, float32 and float64, listed with each RecordType. Readers skip
+//  unknown types, and values missing at the end of a record read as 0.
+//
+
+#ifndef TouchTrace_h
+#define TouchTrace_h
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <initializer_list>
+#include <vector>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace TouchTrace {
+
+enum RecordType : uint32_t {
+    // H, V, numVertices, numTriangles; x, y, ix, iy; triangles
+    Mesh = 1,
+    // numVertices; x, y, ix, iy
+    Reset = 2,
+    // SolverBackend::Kind, multigridCycles, refinementSteps, handleBasis; ARAP budget, tolerance (float64)
+    Backend = 3,
+    // mode, iteration, prefactored, invalidate, numSelected; selected
+    Structural = 4,
+    // mode, iteration, prefactored, numSelected; selected; x, y of the handles; ARAP rounds and whether
+    // they converged (0 without a budget)
+    Drag = 5,
+    // numVertices; x, y
+    Checkpoint = 6,
+};
+
+static const char MAGIC[4] = {'S', 'E', 'T', 'R'};
+static const uint32_t VERSION = 1;
+
+struct RecordHeader {
+    uint32_t type;
+    // bytes of payload after the header
+    uint32_t size;
+    // seconds since the start of the recording
+    double time;
+};
+static_assert(sizeof(RecordHeader) == 16, "RecordHeader must be packed");
+
+// buffered writer; records are flushed with flush() or when the buffer fills up
+class Writer {
+public:
+    ~Writer(){ close(); }
+
+    bool open(const char *path){
+        close();
+        file = std::fopen(path, "wb");
+        if(!file) return false;
+        std::fwrite(MAGIC, 1, 4, file);
+        std::fwrite(&VERSION, sizeof(VERSION), 1, file);
+        return true;
+    }
+    void close(){
+        if(file) std::fclose(file);
+        file = nullptr;
+    }
+    bool isOpen() const { return file != nullptr; }
+    void flush(){ if(file) std::fflush(file); }
+
+    // a record is begun, filled with ints() and floats(), and ended
+    void begin(RecordType type, double time){
+        payload.clear();
+        header.type = type;
+        header.time = time;
+    }
+    void ints(const int *values, size_t count){ append(values, count*sizeof(int32_t)); }
+    void ints(std::initializer_list<int> values){ for(int v : values) ints(&v, 1); }
+    void floats(const float *values, size_t count){ append(values, count*sizeof(float)); }
+    void doubles(std::initializer_list<double> values){ for(double v : values) append(&v, sizeof(v)); }
+    void end(){
+        if(!file) return;
+        header.size = (uint32_t)payload.size();
+        std::fwrite(&header, sizeof(header), 1, file);
+        std::fwrite(payload.data(), 1, payload.size(), file);
+    }
+
+private:
+    static_assert(sizeof(int) == sizeof(int32_t), "int must be 32 bits");
+    void append(const void *data, size_t bytes){
+        size_t offset = payload.size();
+        payload.resize(offset+bytes);
+        if(bytes>0) std::memcpy(payload.data()+offset, data, bytes);
+    }
+
+    std::FILE *file = nullptr;
+    RecordHeader header;
+    // kept across records, so recording does not allocate once it has grown
+    std::vector<uint8_t> payload;
+};
+
+// a record of a mapped trace; the payload is read in order with nextInts()/nextFloats()
+struct Record {
+    RecordType type;
+    double time;
+    const uint8_t *payload;
+    uint32_t size;
+    uint32_t offset = 0;
+
+    // the next count values; nullptr if the record is too short
+    const int32_t *nextInts(size_t count){ return (const int32_t *)next(count*sizeof(int32_t)); }
+    const float *nextFloats(size_t count){ return (const float *)next(count*sizeof(float)); }
+    int nextInt(){ const int32_t *v = nextInts(1); return v ? *v : 0; }
+    // (copied, since a double in the payload need not be aligned)
+    double nextDouble(){
+        double value = 0;
+        if(const void *p = next(sizeof(double))) std::memcpy(&value, p, sizeof(double));
+        return value;
+    }
+
+private:
+    const void *next(size_t bytes){
+        if(offset+bytes>size) return nullptr;
+        const void *p = payload+offset;
+        offset += (uint32_t)bytes;
+        return p;
+    }
+};
+
+// memory-mapped trace, read sequentially with next()
+class Reader {
+public:
+    ~Reader(){ close(); }
+
+    bool open(const char *path){
+        close();
+        int fd = ::open(path, O_RDONLY);
+        if(fd<0) return false;
+        struct stat st;
+        if(fstat(fd, &st)==0 && st.st_size>=8){
+            length = (size_t)st.st_size;
+            void *p = mmap(nullptr, length, PROT_READ, MAP_PRIVATE, fd, 0);
+            data = p==MAP_FAILED ? nullptr : (const uint8_t *)p;
+        }
+        ::close(fd);
+        uint32_t version = 0;
+        if(data) std::memcpy(&version, data+4, sizeof(version));
+        if(!data || std::memcmp(data, MAGIC, 4)!=0 || version!=VERSION){
+            close();
+            return false;
+        }
+        position = 8;
+        return true;
+    }
+    void close(){
+        if(data) munmap((void *)data, length);
+        data = nullptr;
+        length = position = 0;
+    }
+
+    // false at the end of the trace (a record cut short by a crash ends it too)
+    bool next(Record &record){
+        if(position+sizeof(RecordHeader)>length) return false;
+        RecordHeader header;
+        std::memcpy(&header, data+position, sizeof(header));
+        if(header.size>length-position-sizeof(header)) return false;
+        record.type = (RecordType)header.type;
+        record.time = header.time;
+        record.payload = data+position+sizeof(header);
+        record.size = header.size;
+        record.offset = 0;
+        position += sizeof(header)+header.size;
+        return true;
+    }
+    void rewind(){ position = data ? 8 : 0; }
+
+private:
+    const uint8_t *data = nullptr;
+    size_t length = 0, position = 0;
+};
+
+}
+
+#endif /* TouchTrace_h */
@@ -0,0 +1,44 @@
+//
+//  TripleBuffer.h
+//  iPad-SimEnergy
+//
+//  Lock-free single-producer single-consumer triple buffer: the writer fills
+//  back() and publishes it, the reader picks up the most recent published
+//  slot with update() and reads front(). Neither side ever waits, and the
+//  reader never sees a slot that is being written.
+//
+
+#ifndef TripleBuffer_h
+#define TripleBuffer_h
+
+#include <atomic>
+
+template <class T>
+class TripleBuffer {
+public:
+    // writer side
+    T &back(){ return slots[backIndex]; }
+    void publish(){
+        backIndex = middle.exchange(backIndex | FRESH, std::memory_order_acq_rel) & INDEX;
+    }
+
+    // reader side: true if a slot was published since the last call
+    bool update(){
+        if(!(middle.load(std::memory_order_acquire) & FRESH)) return false;
+        frontIndex = middle.exchange(frontIndex, std::memory_order_acq_rel) & INDEX;
+        return true;
+    }
+    const T &front() const { return slots[frontIndex]; }
+
+    // all slots, for sizing them while neither side is active
+    T &slot(int k){ return slots[k]; }
+
+private:
+    enum { INDEX = 3, FRESH = 4 };
+    T slots[3];
+    int backIndex = 0, frontIndex = 1;
+    // index of the middle slot, with FRESH set while the reader has not taken it
+    std::atomic<int> middle{2};
+};
+
+#endif /* TripleBuffer_h */
@@ -24,20 +24,47 @@
 
 
 #import "ViewController.h"
+#import <ImageIO/ImageIO.h>
+// counts heap allocations per drag frame when DEBUG_ALLOCATIONS is defined; must precede Eigen
+#define ALLOCATION_COUNTER_IMPLEMENTATION
+#include "AllocationCounter.h"
 #include "../third-party/eigen/Eigen/Sparse"
 #include "../third-party/eigen/Eigen/Dense"
 #include <vector>
+#include <chrono>
+#include "AsyncSolver.h"
+#include "MeshSpatialIndex.h"
+#include "ImageRasterizer.h"
+#include "AdaptiveMesh.h"
 using namespace Eigen;
 
 /// threshold for being zero
 #define EPSILON 10e-6
 //
 #define MAX_TOUCHES 5
-// the numbers of horizontal and vertical grids
+// the default numbers of horizontal and vertical grids (see setMeshDivisionsHorizontal:Vertical:)
 #define HDIV 15
 #define VDIV 15
-// size of the linear system: two-times (x and y coordinates) the number of vertices
-#define N 2*(HDIV+1)*(VDIV+1)
+// define to mesh the foreground of each image by its content (AdaptiveMesh.h) instead of the HDIV x VDIV grid
+//#define ADAPTIVE_MESH
+// cell sizes of the adaptive mesh in pixels: along the outline and edges, and in flat areas
+#define ADAPTIVE_MIN_CELL 8
+#define ADAPTIVE_MAX_CELL 64
+// budget of V-cycles per solve of the Multigrid backend
+#define MG_CYCLES 20
+// mixed-precision refinement steps per solve, for very fine or large meshes (0: float only)
+#define REFINEMENT_STEPS 0
+// keep the rest pose of the image and factorise its energy once; putting down or lifting a finger then only
+// updates a small Schur complement, but every gesture pulls the image back toward its undeformed shape
+// (0: every touch down takes the current shape as the rest pose and refactorises, so gestures accumulate)
+#define PREFACTORED 0
+// Sim: precompute the response to every handle at touch down, so that a drag is a dense product
+#define HANDLE_BASIS 0
+// ARAP: milliseconds of local/global rounds per frame, carried over between frames; half a 60 Hz frame leaves
+// the other half to the renderer (0: a fixed number of rounds, set with the iteration slider)
+#define ARAP_FRAME_BUDGET 8
+// ARAP with a budget: rounds stop once the rotations change less than this
+#define ARAP_TOLERANCE 1e-4
 #define DEFAULTIMAGE @"Default.png"
 
 @interface ViewController ()
@@ -50,15 +77,12 @@ using namespace Eigen;
 @implementation ViewController
 @synthesize effect;
 
-// for Eigen
-typedef SparseMatrix<float> SpMat;
-typedef SparseLU<SpMat, COLAMDOrdering<int>> SpSolver;
-typedef Triplet<float> T;
-SpSolver solver;
-MatrixXf U;
-std::vector<MatrixXf> Pinv;
-// local transformations
-std::vector<Matrix2f> A;
+// energies and solvers (platform-neutral, see DeformationEngine.h), run on a worker thread
+AsyncSolver asyncSolver;
+// picking on the deformed mesh
+MeshSpatialIndex spatialIndex;
+// positions of the touched vertices while a solved frame is copied into the mesh
+std::vector<float> handleX, handleY;
 
 
 - (void)viewDidLoad
@@ -81,23 +105,58 @@ std::vector<Matrix2f> A;
     touchedPts = CFDictionaryCreateMutable(NULL, MAX_TOUCHES, &kCFTypeDictionaryKeyCallBacks,NULL);
     // load default image
     UIImage *pImage = [ UIImage imageNamed:DEFAULTIMAGE ];
-    mainImage = [[ImageMesh alloc] initWithUIImage:pImage VerticalDivisions:VDIV HorizontalDivisions:HDIV];
+    horizontalDivisions = HDIV;
+    verticalDivisions = VDIV;
+#ifdef ADAPTIVE_MESH
+    mainImage = [self adaptiveMeshForImage:pImage];
+#else
+    mainImage = [[ImageMesh alloc] initWithUIImage:pImage VerticalDivisions:verticalDivisions HorizontalDivisions:horizontalDivisions];
+#endif
     [self loadTexture:pImage];
-    
-    Pinv.resize(mainImage.numTriangles);
-    for(int i=0;i<mainImage.numTriangles;i++){
-        Pinv[i] = MatrixXf::Zero(3, 2);
-    }
-    A.resize(mainImage.numTriangles);
-    
+    [self allocateMeshStorage];
+#ifdef DEBUG_ALLOCATIONS
+    // from now on Eigen's dense allocations are reported to AllocationCounter
+    Eigen::internal::set_is_malloc_allowed(false);
+#endif
+
     // UI Setup
     mode = 0;
     iteration = 1;
+    // keep the rest pose and factorise the energy only once (handles via Schur complement)
+    prefactored = PREFACTORED;
+    // solver for the (SPD) energy: sparse direct LU, LDLT, Cholesky, SupernodalCholesky, Multigrid, MatrixFreeCG, or BlockLDLT
+    [self setSolverBackend:SolverBackend::LDLT];
+    // (the trace records the rounds each frame took, so a recorded session still replays bit for bit)
+    asyncSolver.setArapBudget(ARAP_FRAME_BUDGET, ARAP_TOLERANCE);
+    if(ARAP_FRAME_BUDGET>0){
+        // the budget takes the place of the iteration slider
+        iterationSlider.enabled = NO;
+        iterationLabel.text = [NSString stringWithFormat:@"%g ms/frame", (double)ARAP_FRAME_BUDGET];
+    }
+#ifdef RECORD_TOUCH_TRACE
+    // everything the solver does from now on, for benchmark/replay.cpp (retrieved through file sharing)
+    NSString *documents = NSSearchPathForDirectoriesInDomains(NSDocumentDirectory, NSUserDomainMask, YES).firstObject;
+    NSString *tracePath = [documents stringByAppendingPathComponent:@"touch-trace.setr"];
+    if(!asyncSolver.startRecording(tracePath.fileSystemRepresentation)){
+        NSLog(@"cannot record the touch trace to %@", tracePath);
+    }
+#endif
         
     [self setupGL];
 }
 
 - (void)dealloc{    
+#ifdef RECORD_TOUCH_TRACE
+    asyncSolver.stopRecording();
+#endif
+#ifdef PROFILE_FRAMES
+    // the stages of the last frames of every thread, for chrome://tracing (retrieved through file sharing)
+    asyncSolver.finish();
+    NSString *profilePath = [NSSearchPathForDirectoriesInDomains(NSDocumentDirectory, NSUserDomainMask, YES).firstObject
+                             stringByAppendingPathComponent:@"frame-profile.json"];
+    FrameProfiler::writeChromeTrace(profilePath.fileSystemRepresentation);
+    FrameProfiler::printSummary(stderr);
+#endif
     [self tearDownGL];
     if ([EAGLContext currentContext] == self.context) {
         [EAGLContext setCurrentContext:nil];
@@ -123,6 +182,8 @@ std::vector<Matrix2f> A;
 }
 
 - (void)loadTexture:(UIImage *)pImage{
+    // kept for exports at the original resolution
+    sourceImage = pImage;
     NSError *error;
     NSDictionary* options = @{GLKTextureLoaderOriginBottomLeft: @YES};
     UIImage *image = [UIImage imageWithData:UIImagePNGRepresentation(pImage)];
@@ -170,6 +231,27 @@ std::vector<Matrix2f> A;
 
 - (void)update
 {
+    // pick up the latest result of the solver without waiting for it
+    if(asyncSolver.acquire()){
+        PROFILE_STAGE(Deform);
+        const AsyncSolver::Frame &frame = asyncSolver.frame();
+        // the touched vertices stay under the fingers: the frame may have been solved for older targets,
+        // and the next drag posts these positions again
+        int numHandles = mainImage.numSelected;
+        handleX.resize(numHandles);
+        handleY.resize(numHandles);
+        for(int k=0;k<numHandles;k++){
+            handleX[k] = mainImage.x[mainImage.selected[k]];
+            handleY[k] = mainImage.y[mainImage.selected[k]];
+        }
+        std::copy(frame.x.begin(), frame.x.end(), mainImage.x);
+        std::copy(frame.y.begin(), frame.y.end(), mainImage.y);
+        for(int k=0;k<numHandles;k++){
+            mainImage.x[mainImage.selected[k]] = handleX[k];
+            mainImage.y[mainImage.selected[k]] = handleY[k];
+        }
+        [mainImage deform];
+    }
 }
 
 - (void)glkView:(GLKView *)view drawInRect:(CGRect)rect
@@ -191,8 +273,13 @@ std::vector<Matrix2f> A;
     glVertexAttribPointer(GLKVertexAttribPosition, 2, GL_FLOAT, GL_FALSE, sizeof(float) * 2, mainImage.verticesArr);
     glVertexAttribPointer(GLKVertexAttribTexCoord0, 2, GL_FLOAT, GL_FALSE, sizeof(float) * 2, mainImage.textureCoordsArr);
     
-    for (int i=0; i<mainImage.verticalDivisions; i++) {
-        glDrawArrays(GL_TRIANGLE_STRIP, i*(mainImage.horizontalDivisions*2+2), mainImage.horizontalDivisions*2+2);
+    if (mainImage.horizontalDivisions == 0) {
+        // general mesh: separate triangles
+        glDrawArrays(GL_TRIANGLES, 0, mainImage.indexArrsize);
+    } else {
+        for (int i=0; i<mainImage.verticalDivisions; i++) {
+            glDrawArrays(GL_TRIANGLE_STRIP, i*(mainImage.horizontalDivisions*2+2), mainImage.horizontalDivisions*2+2);
+        }
     }
 }
 
@@ -201,6 +288,8 @@ std::vector<Matrix2f> A;
  */
 - (void)touchesBegan:(NSSet *)touches withEvent:(UIEvent *)event {
     if ([touches count] > 0){
+        // catch up with the deformations since the last touch; only vertices that changed cells are re-bucketed
+        spatialIndex.refit();
         for (UITouch *touch in touches) {
             int *point = (int *)CFDictionaryGetValue(touchedPts, (__bridge void*)touch);
             // touched location in OpenGL coordinates
@@ -208,18 +297,10 @@ std::vector<Matrix2f> A;
             p.x = (p.x - screen.width/2.0)*ratio_width;
             p.y = (screen.height/2.0 - p.y)*ratio_height;
             // nearest point will be selected
-            int closest_vertex = 0;
-            float min_dist = mainImage.radius;
             // !! the lower left corner is kept unselectable; it is reserved for the case when there's not enough constraint.
-            for(int i=1;i<mainImage.numVertices;i++){
-                float dist = (p.x-mainImage.x[i])*(p.x-mainImage.x[i])+(p.y-mainImage.y[i])*(p.y-mainImage.y[i]);
-                if(dist<min_dist){
-                    min_dist = dist;
-                    closest_vertex = i;
-                }
-            }
+            int closest_vertex = spatialIndex.nearestVertex(p.x, p.y, mainImage.radius, 1);
             // if the nearest vertex is not too far from the touched point
-            if(min_dist<mainImage.radius){
+            if(closest_vertex>=0){
                 if (point == NULL) {
                     point = (int *)malloc(sizeof(*point));
                     CFDictionarySetValue(touchedPts, (__bridge void*)touch, point);
@@ -246,78 +327,13 @@ std::vector<Matrix2f> A;
             mainImage.y[*point] = p.y;
         }
     }
-    if(mode==1){
-        [self solve_vertices_ARAP];
-    }else if(mode==0){
-        [self solve_vertices_Sim];
-    }
-    [mainImage deform];
-}
-
-// determine the location of un-constraint vertices by solving a linear system using Eigen
-- (void)solve_vertices_Sim{
-    VectorXf V = VectorXf::Zero(N);
-    if(mainImage.numSelected==1){
-        int index=mainImage.selected[0];
-        mainImage.x[0] = mainImage.ix[0] + mainImage.x[index]-mainImage.ix[index];
-        mainImage.y[0] = mainImage.iy[0] + mainImage.y[index]-mainImage.iy[index];
-        V(0) = mainImage.x[0];
-        V(mainImage.numVertices) = mainImage.y[0];
-    }
-    for(int k=0;k<mainImage.numSelected;k++){
-        int i=mainImage.selected[k];
-        int j=i+mainImage.numVertices;
-        V(i) = mainImage.x[i];
-        V(j) = mainImage.y[i];
-    }
-    VectorXf Sol = solver.solve(V);
-//    VectorXf Sol = MatrixXf(G).householderQr().solve(V);
-    for(int i=0;i<mainImage.numVertices;i++){
-        mainImage.x[i] = Sol(i);
-        mainImage.y[i] = Sol(i+mainImage.numVertices);
-    }
-}
-
-- (void)solve_vertices_ARAP{
-    [self formArapRHS:A];
-    MatrixXf Sol = solver.solve(U);
-    // iterative refinement
-    for(int iter=1;iter<iteration;iter++){
-        std::vector<Matrix2f> A(mainImage.numTriangles);
-        for(int i=0;i<mainImage.numTriangles;i++){
-            int posx=mainImage.triangles[3*i];
-            int posz=mainImage.triangles[3*i+1];
-            int poss=mainImage.triangles[3*i+2];
-            MatrixXf B(2,3);
-            B << Sol(posx,0),Sol(posz,0),Sol(poss,0), Sol(posx,1),Sol(posz,1),Sol(poss,1);
-            A[i] = [self Rotation:B*Pinv[i]];
-        }
-        [self formArapRHS:A];
-        Sol = solver.solve(U);
-    }
-    // set coordinates
-    for(int i=0;i<mainImage.numVertices;i++){
-        mainImage.x[i] = Sol(i,0);
-        mainImage.y[i] = Sol(i,1);
-    }
-}
-
-// Rotation part of a matrix (Higham's algorithm)
-- (Matrix2f)Rotation:(Matrix2f) X{
-    Matrix2f Curr = X;
-    Matrix2f Prev;
-    do {
-        Matrix2f Ad = Curr.inverse().transpose();
-        double nad = Ad.array().abs().colwise().sum().maxCoeff() * Ad.array().abs().rowwise().sum().maxCoeff();
-        double na = Curr.array().abs().colwise().sum().maxCoeff() * Curr.array().abs().rowwise().sum().maxCoeff();
-        double gamma = sqrt(sqrt(nad / na));
-        Prev = Curr;
-        Curr = (0.5*gamma)*Curr + (0.5/gamma) *Ad;
-    } while ((Prev-Curr).lpNorm<1>() > EPSILON*Prev.lpNorm<1>());
-    return Curr;
+    // solved on the worker; a newer drag supersedes this one if it has not started yet
+    asyncSolver.post([self settings], mainImage.selected, mainImage.numSelected, mainImage.x, mainImage.y);
+#ifdef DEBUG_ALLOCATIONS
+    NSLog(@"heap allocations in the last solve: %ld", asyncSolver.statistics().allocations);
+#endif
 }
 
-
 - (void)touchesEnded:(NSSet *)touches withEvent:(UIEvent *)event {
     for (UITouch *touch in touches) {
         int *point = (int *)CFDictionaryGetValue(touchedPts, (__bridge void*)touch);
@@ -343,205 +359,110 @@ std::vector<Matrix2f> A;
     [self formEnergy];
 }
 
-// prepare the energy matrix
+// prepare the energy matrix (on the worker, after the pending drags)
 - (void)formEnergy{
-    if(mainImage.numSelected==0){
-        return;
-    }
-    // all starting points are updated
-    for(int j=0;j<mainImage.numVertices;j++){
-        mainImage.ix[j] = mainImage.x[j];
-        mainImage.iy[j] = mainImage.y[j];
-    }
-    if(mode==1){
-        [self formEnergy_ARAP];
-        // clear local transformation
-        for(int i=0;i<mainImage.numTriangles;i++){
-            A[i] = Matrix2f::Identity();
+    // statistics of the previous touch
+    AsyncSolver::Statistics stats = asyncSolver.statistics();
+    if(stats.numSolves>0){
+        NSLog(@"%s: factorization %.2f ms, %.3f ms per solve, latency %.2f ms (max %.2f ms), %ld of %ld drags dropped",
+              stats.backend, stats.factorizeTime, stats.solveTime/stats.numSolves, stats.latency, stats.maxLatency, stats.dropped, stats.posted);
+        if(stats.cycles>0){
+            NSLog(@"%s: %d iterations, relative residual %.2e in the last solve", stats.backend, stats.cycles, stats.residual);
         }
-    }else if(mode==0){
-        [self formEnergy_Sim];
-    }
-}
-
-// Similarity invariant energy
-- (void)formEnergy_Sim{
-    SpMat G(N, N);
-    std::vector<T> tripletListMat(0);
-    tripletListMat.reserve(mainImage.numTriangles*30);
-    // incorporate constraints
-    bool avoid[mainImage.numVertices];
-    for(int i=0;i<mainImage.numVertices;i++) avoid[i]=false;
-    if(mainImage.numSelected==1){
-        avoid[0]=true;
-        tripletListMat.push_back(T(0,0,1.0));
-        tripletListMat.push_back(T(mainImage.numVertices,mainImage.numVertices,1.0));
-    }
-    for(int s=0;s<mainImage.numSelected;s++){
-        int i=mainImage.selected[s];
-        int j=i+mainImage.numVertices;
-        avoid[i]=true;
-        tripletListMat.push_back(T(i,i,1.0));
-        tripletListMat.push_back(T(j,j,1.0));
-    }
-    
-    // compute the energy derivation matrix
-    for(int i=0;i<mainImage.numTriangles;i++){
-        int posx=mainImage.triangles[3*i];
-        int posy=posx+mainImage.numVertices;
-        int posz=mainImage.triangles[3*i+1];
-        int posw=posz+mainImage.numVertices;
-        int poss=mainImage.triangles[3*i+2];
-        int post=poss+mainImage.numVertices;
-        float a = mainImage.ix[posx];
-        float b = mainImage.iy[posx];
-        float c = mainImage.ix[posz];
-        float d = mainImage.iy[posz];
-        float e = mainImage.ix[poss];
-        float f = mainImage.iy[poss];
-        float detA2 = (a*d-a*f-b*c+b*e+c*f-d*e)*(a*d-a*f-b*c+b*e+c*f-d*e);
-        // partial derivative of the energy |B|^2 - 2 det(B), where B=VP^{-1}
-        // partial by x and y
-        if(!avoid[posx]){
-            tripletListMat.push_back(T(posx,posx,(c*c-2*c*e+d*d-2*d*f+e*e+f*f)/detA2));
-            tripletListMat.push_back(T(posx,posz,(-a*c+a*e-b*d+b*f+c*e+d*f-e*e-f*f)/detA2));
-            tripletListMat.push_back(T(posx,posw,(-a*d+a*f+b*c-b*e-c*f+d*e)/detA2));
-            tripletListMat.push_back(T(posx,poss,(a*c-a*e+b*d-b*f-c*c+c*e-d*d+d*f)/detA2));
-            tripletListMat.push_back(T(posx,post,(a*d-a*f-b*c+b*e+c*f-d*e)/detA2));
-            tripletListMat.push_back(T(posy,posy,(c*c-2*c*e+d*d-2*d*f+e*e+f*f)/detA2));
-            tripletListMat.push_back(T(posy,posz,(a*d-a*f-b*c+b*e+c*f-d*e)/detA2));
-            tripletListMat.push_back(T(posy,posw,(-a*c+a*e-b*d+b*f+c*e+d*f-e*e-f*f)/detA2));
-            tripletListMat.push_back(T(posy,poss,(-a*d+a*f+b*c-b*e-c*f+d*e)/detA2));
-            tripletListMat.push_back(T(posy,post,(a*c-a*e+b*d-b*f-c*c+c*e-d*d+d*f)/detA2));
+        if(stats.refinementSteps>0){
+            NSLog(@"refinement: %d steps, relative error below %.2e in the last solve", stats.refinementSteps, stats.refinementBound);
         }
-        // partial by z and w
-        if(!avoid[posz]){
-            tripletListMat.push_back(T(posz,posx,(-a*c+a*e-b*d+b*f+c*e+d*f-e*e-f*f)/detA2));
-            tripletListMat.push_back(T(posz,posy,(a*d-a*f-b*c+b*e+c*f-d*e)/detA2));
-            tripletListMat.push_back(T(posz,posz,(a*a-2*a*e+b*b-2*b*f+e*e+f*f)/detA2));
-            tripletListMat.push_back(T(posz,poss,(-a*a+a*c+a*e-b*b+b*d+b*f-c*e-d*f)/detA2));
-            tripletListMat.push_back(T(posz,post,(-a*d+a*f+b*c-b*e-c*f+d*e)/detA2));
-            tripletListMat.push_back(T(posw,posx,(-a*d+a*f+b*c-b*e-c*f+d*e)/detA2));
-            tripletListMat.push_back(T(posw,posy,(-a*c+a*e-b*d+b*f+c*e+d*f-e*e-f*f)/detA2));
-            tripletListMat.push_back(T(posw,posw,(a*a-2*a*e+b*b-2*b*f+e*e+f*f)/detA2));
-            tripletListMat.push_back(T(posw,poss,(a*d-a*f-b*c+b*e+c*f-d*e)/detA2));
-            tripletListMat.push_back(T(posw,post,(-a*a+a*c+a*e-b*b+b*d+b*f-c*e-d*f)/detA2));
-        }
-        // partial by s and t
-        if(!avoid[poss]){
-            tripletListMat.push_back(T(poss,posx,(a*c-a*e+b*d-b*f-c*c+c*e-d*d+d*f)/detA2));
-            tripletListMat.push_back(T(poss,posy,(-a*d+a*f+b*c-b*e-c*f+d*e)/detA2));
-            tripletListMat.push_back(T(poss,posz,(-a*a+a*c+a*e-b*b+b*d+b*f-c*e-d*f)/detA2));
-            tripletListMat.push_back(T(poss,posw,(a*d-a*f-b*c+b*e+c*f-d*e)/detA2));
-            tripletListMat.push_back(T(poss,poss,(a*a-2*a*c+b*b-2*b*d+c*c+d*d)/detA2));
-            tripletListMat.push_back(T(post,posx,(a*d-a*f-b*c+b*e+c*f-d*e)/detA2));
-            tripletListMat.push_back(T(post,posy,(a*c-a*e+b*d-b*f-c*c+c*e-d*d+d*f)/detA2));
-            tripletListMat.push_back(T(post,posz,(-a*d+a*f+b*c-b*e-c*f+d*e)/detA2));
-            tripletListMat.push_back(T(post,posw,(-a*a+a*c+a*e-b*b+b*d+b*f-c*e-d*f)/detA2));
-            tripletListMat.push_back(T(post,post,(a*a-2*a*c+b*b-2*b*d+c*c+d*d)/detA2));
-        }
-    }
-    G.setFromTriplets(tripletListMat.begin(), tripletListMat.end());
-    solver.compute(G);
-    return;
-}
-
-// inverted mesh matrix
-- (void)inverted_mesh_matrix{
-    for(int i=0;i<mainImage.numTriangles;i++){
-        int posx=mainImage.triangles[3*i];
-        int posz=mainImage.triangles[3*i+1];
-        int poss=mainImage.triangles[3*i+2];
-        float a = mainImage.ix[posx];
-        float b = mainImage.iy[posx];
-        float c = mainImage.ix[posz];
-        float d = mainImage.iy[posz];
-        float e = mainImage.ix[poss];
-        float f = mainImage.iy[poss];
-        float detA = (a*d-a*f-b*c+b*e+c*f-d*e);
-        Pinv[i] << d-f,-c+e, -b+f,a-e, b-d,-a+c;
-        Pinv[i] /= detA;
-    }
-}
-
-// ARAP energy
-- (void)formEnergy_ARAP{
-    [self inverted_mesh_matrix];
-    int n=mainImage.numVertices;
-    SpMat G(n, n);
-    U = MatrixXf::Zero(n,2);
-    std::vector<T> tripletListMat(0);
-    tripletListMat.reserve(mainImage.numTriangles*9);
-    // incorporate constraints
-    bool avoid[mainImage.numVertices];
-    for(int i=0;i<mainImage.numVertices;i++) avoid[i]=false;
-    for(int s=0;s<mainImage.numSelected;s++){
-        int i=mainImage.selected[s];
-        avoid[i]=true;
-        tripletListMat.push_back(T(i,i,1.0));
-    }
-    Matrix3f LHS;
-    // compute the energy derivation matrix
-    for(int i=0;i<mainImage.numTriangles;i++){
-        int posx=mainImage.triangles[3*i];
-        int posz=mainImage.triangles[3*i+1];
-        int poss=mainImage.triangles[3*i+2];
-        LHS = Pinv[i] * Pinv[i].transpose();
-        // partial derivative of the energy |B-I|^2, where B=VP^{-1}
-        // partial by x
-        if(!avoid[posx]){
-            tripletListMat.push_back(T(posx,posx,LHS(0,0)));
-            tripletListMat.push_back(T(posx,posz,LHS(0,1)));
-            tripletListMat.push_back(T(posx,poss,LHS(0,2)));
-        }
-        // partial by z
-        if(!avoid[posz]){
-            tripletListMat.push_back(T(posz,posx,LHS(1,0)));
-            tripletListMat.push_back(T(posz,posz,LHS(1,1)));
-            tripletListMat.push_back(T(posz,poss,LHS(1,2)));
-        }
-        // partial by s
-        if(!avoid[poss]){
-            tripletListMat.push_back(T(poss,posx,LHS(2,0)));
-            tripletListMat.push_back(T(poss,posz,LHS(2,1)));
-            tripletListMat.push_back(T(poss,poss,LHS(2,2)));
-        }
-    }
-    G.setFromTriplets(tripletListMat.begin(), tripletListMat.end());
-    solver.compute(G);
-    return;
-}
-
-- (void)formArapRHS:(std::vector<Matrix2f>) A{
-    U.setZero();
-    for(int k=0;k<mainImage.numSelected;k++){
-        int i=mainImage.selected[k];
-        U.row(i) << mainImage.x[i], mainImage.y[i];
-    }
-    MatrixXf RHS(3,2);
-    bool avoid[mainImage.numVertices];
-    for(int i=0;i<mainImage.numVertices;i++) avoid[i]=false;
-    for(int s=0;s<mainImage.numSelected;s++){
-        avoid[mainImage.selected[s]]=true;
-    }
-    for(int i=0;i<mainImage.numTriangles;i++){
-        int posx=mainImage.triangles[3*i];
-        int posz=mainImage.triangles[3*i+1];
-        int poss=mainImage.triangles[3*i+2];
-        RHS = Pinv[i] * A[i].transpose();
-        if(!avoid[posx]){
-            U(posx,0) += RHS(0,0);
-            U(posx,1) += RHS(0,1);
-        }
-        if(!avoid[posz]){
-            U(posz,0) += RHS(1,0);
-            U(posz,1) += RHS(1,1);
-        }
-        if(!avoid[poss]){
-            U(poss,0) += RHS(2,0);
-            U(poss,1) += RHS(2,1);
+        if(mode==DeformationEngine::ARAP && stats.arapIterations>0){
+            NSLog(@"ARAP: %d rounds in the last drag, energy %.4g, rotation change %.2e%s", stats.arapIterations,
+                  stats.arapEnergy, stats.arapRotationChange, stats.arapConverged ? " (converged)" : "");
         }
     }
+    asyncSolver.postStructural([self settings], mainImage.selected, mainImage.numSelected);
+}
+
+// the UI state the worker applies with each request
+- (AsyncSolver::Settings)settings{
+    AsyncSolver::Settings settings;
+    settings.mode = mode;
+    settings.iteration = iteration;
+    settings.prefactored = prefactored;
+    return settings;
+}
+
+// choose the linear solver
+- (void)setSolverBackend:(SolverBackend::Kind)kind{
+    // V-cycles per solve for Multigrid; the previous frame is the initial guess
+    asyncSolver.setSolverBackend(kind, MG_CYCLES, REFINEMENT_STEPS, HANDLE_BASIS);
+}
+
+// the arrays of mainImage
+- (DeformationMesh)meshArrays{
+    DeformationMesh mesh;
+    mesh.horizontalDivisions = horizontalDivisions;
+    mesh.verticalDivisions = verticalDivisions;
+    mesh.numVertices = mainImage.numVertices;
+    mesh.numTriangles = mainImage.numTriangles;
+    mesh.x = mainImage.x;
+    mesh.y = mainImage.y;
+    mesh.ix = mainImage.ix;
+    mesh.iy = mainImage.iy;
+    mesh.triangles = mainImage.triangles;
+    mesh.selected = mainImage.selected;
+    mesh.numSelected = mainImage.numSelected;
+    return mesh;
+}
+
+// all per-frame storage is allocated here, once per mesh
+- (void)allocateMeshStorage{
+    // the solver keeps its own copy of the vertices
+    asyncSolver.setMesh([self meshArrays]);
+    spatialIndex.build(mainImage.numVertices, mainImage.numTriangles, mainImage.x, mainImage.y, mainImage.triangles);
+}
+
+static void freeTouch(const void *key, const void *value, void *context){
+    free((void *)value);
+}
+
+// change the grid resolution at runtime
+- (void)setMeshDivisionsHorizontal:(int)h Vertical:(int)v{
+    // the touched vertices refer to the old mesh
+    CFDictionaryApplyFunction(touchedPts, freeTouch, NULL);
+    CFDictionaryRemoveAllValues(touchedPts);
+    horizontalDivisions = h;
+    verticalDivisions = v;
+    ImageMesh *mesh = [[ImageMesh alloc] initWithWidth:mainImage.image_width Height:mainImage.image_height VerticalDivisions:verticalDivisions HorizontalDivisions:horizontalDivisions];
+    mesh.texture = mainImage.texture;
+    mainImage = mesh;
+    [self allocateMeshStorage];
+    NSLog(@"mesh: %d x %d grid, %d vertices", horizontalDivisions, verticalDivisions, mainImage.numVertices);
+}
+
+// a mesh of the image's foreground, dense along its outline and edges (see AdaptiveMesh.h)
+- (ImageMesh *)adaptiveMeshForImage:(UIImage *)pImage{
+    CGImageRef source = pImage.CGImage;
+    size_t pw = CGImageGetWidth(source), ph = CGImageGetHeight(source);
+    // decoded pixels (premultiplied RGBA, top row first)
+    std::vector<uint8_t> pixels(4*pw*ph);
+    CGColorSpaceRef colorSpace = CGColorSpaceCreateDeviceRGB();
+    CGContextRef context = CGBitmapContextCreate(pixels.data(), pw, ph, 8, 4*pw, colorSpace, kCGImageAlphaPremultipliedLast);
+    CGContextDrawImage(context, CGRectMake(0, 0, pw, ph), source);
+    CGContextRelease(context);
+    CGColorSpaceRelease(colorSpace);
+    ImageRasterizer::Image image;
+    image.pixels = pixels.data();
+    image.width = (int)pw;
+    image.height = (int)ph;
+    image.stride = 4*pw;
+    AdaptiveMesh::Options options;
+    options.minCell = ADAPTIVE_MIN_CELL;
+    options.maxCell = ADAPTIVE_MAX_CELL;
+    AdaptiveMesh mesh(image, (float)pImage.size.width, (float)pImage.size.height, options);
+    // no grid structure (the geometric solvers fall back to a direct solve)
+    horizontalDivisions = 0;
+    verticalDivisions = 0;
+    NSLog(@"mesh: adaptive, %d vertices, %d triangles", mesh.numVertices, mesh.numTriangles);
+    return [[ImageMesh alloc] initWithWidth:mesh.width Height:mesh.height NumVertices:mesh.numVertices U:mesh.u.data() V:mesh.v.data()
+                               NumTriangles:mesh.numTriangles Triangles:mesh.triangles.data() Radius:mesh.maxEdge];
 }
 
 /**
@@ -552,13 +473,149 @@ std::vector<Matrix2f> A;
 - (IBAction)pushButton_Initialize:(UIBarButtonItem *)sender {
     NSLog(@"Initialize");
     [mainImage initialize];
+    asyncSolver.reset([self meshArrays]);
 }
 
 // snapshot
+// rows of the export are produced on demand while ImageIO encodes them
+struct ExportStream {
+    const ImageRasterizer *rasterizer;
+    CGImageRef source;
+    std::vector<uint8_t> chunk, band;
+    size_t offset, size;
+    int nextRow;
+};
+// decodes source rows [top, top+rows) into band (premultiplied RGBA, top row first)
+static void decodeSourceRows(CGImageRef source, int top, int rows, std::vector<uint8_t> &band){
+    size_t pw = CGImageGetWidth(source);
+    band.resize(4*pw*rows);
+    CGImageRef part = CGImageCreateWithImageInRect(source, CGRectMake(0, top, pw, rows));
+    CGColorSpaceRef colorSpace = CGColorSpaceCreateDeviceRGB();
+    CGContextRef context = CGBitmapContextCreate(band.data(), pw, rows, 8, 4*pw, colorSpace, kCGImageAlphaPremultipliedLast);
+    CGContextDrawImage(context, CGRectMake(0, 0, pw, rows), part);
+    CGContextRelease(context);
+    CGColorSpaceRelease(colorSpace);
+    CGImageRelease(part);
+}
+// next chunk of rows; false at the end of the image
+static bool nextExportChunk(ExportStream *stream){
+    const ImageRasterizer &r = *stream->rasterizer;
+    if(stream->nextRow>=r.getHeight()) return false;
+    int rows = std::min(4*ImageRasterizer::TILE_ROWS, r.getHeight()-stream->nextRow);
+    size_t stride = 4*(size_t)r.getWidth();
+    stream->chunk.resize(stride*4*ImageRasterizer::TILE_ROWS);
+    // only the source rows these output rows sample are decoded
+    ImageRasterizer::Image band;
+    band.width = (int)CGImageGetWidth(stream->source);
+    band.height = (int)CGImageGetHeight(stream->source);
+    band.stride = 4*(size_t)band.width;
+    int lo, hi;
+    if(r.sourceRows(stream->nextRow, rows, lo, hi)){
+        decodeSourceRows(stream->source, lo, hi-lo, stream->band);
+        band.pixels = stream->band.data();
+        band.top = lo;
+    }
+    r.renderRows(stream->nextRow, rows, stream->chunk.data(), stride, band);
+    stream->nextRow += rows;
+    stream->offset = 0;
+    stream->size = stride*rows;
+    return true;
+}
+static size_t exportGetBytes(void *info, void *buffer, size_t count){
+    ExportStream *stream = (ExportStream *)info;
+    size_t copied = 0;
+    while(copied<count){
+        if(stream->offset==stream->size && !nextExportChunk(stream)) break;
+        size_t n = std::min(count-copied, stream->size-stream->offset);
+        memcpy((uint8_t *)buffer+copied, stream->chunk.data()+stream->offset, n);
+        stream->offset += n;
+        copied += n;
+    }
+    return copied;
+}
+static off_t exportSkipForward(void *info, off_t count){
+    ExportStream *stream = (ExportStream *)info;
+    off_t skipped = 0;
+    while(skipped<count){
+        if(stream->offset==stream->size && !nextExportChunk(stream)) break;
+        size_t n = std::min((size_t)(count-skipped), stream->size-stream->offset);
+        stream->offset += n;
+        skipped += n;
+    }
+    return skipped;
+}
+static void exportRewind(void *info){
+    ExportStream *stream = (ExportStream *)info;
+    stream->nextRow = 0;
+    stream->offset = stream->size = 0;
+}
+
+// Rasterizes the deformed mesh over the source image at the source's pixel size and writes a PNG.
+// The output is pulled by the encoder a few tiles at a time, so it never exists as a whole; the source
+// is decoded per chunk, only in the band of rows that chunk samples (ImageRasterizer::sourceRows).
+static bool exportDeformedImage(CGImageRef source, const std::vector<float> &x, const std::vector<float> &y,
+                                const std::vector<float> &u, const std::vector<float> &v, const std::vector<int> &triangles,
+                                float width, float height, CFURLRef url){
+    size_t pw = CGImageGetWidth(source), ph = CGImageGetHeight(source);
+    CGColorSpaceRef colorSpace = CGColorSpaceCreateDeviceRGB();
+    // the size of the source only; its pixels come in bands from nextExportChunk
+    ImageRasterizer::Image image;
+    image.width = (int)pw;
+    image.height = (int)ph;
+    image.stride = 4*pw;
+    ImageRasterizer rasterizer;
+    rasterizer.setup(image, (int)x.size(), (int)triangles.size()/3, x.data(), y.data(), u.data(), v.data(), triangles.data(),
+                     (int)pw, (int)ph, -width/2, width/2, -height/2, height/2);
+
+    ExportStream stream = {&rasterizer, source, std::vector<uint8_t>(), std::vector<uint8_t>(), 0, 0, 0};
+    CGDataProviderSequentialCallbacks callbacks = {0, exportGetBytes, exportSkipForward, exportRewind, NULL};
+    CGDataProviderRef provider = CGDataProviderCreateSequential(&stream, &callbacks);
+    CGImageRef output = CGImageCreate(pw, ph, 8, 32, 4*pw, colorSpace, kCGImageAlphaPremultipliedLast,
+                                      provider, NULL, false, kCGRenderingIntentDefault);
+    CGImageDestinationRef destination = CGImageDestinationCreateWithURL(url, CFSTR("public.png"), 1, NULL);
+    bool written = false;
+    if(destination){
+        CGImageDestinationAddImage(destination, output, NULL);
+        written = CGImageDestinationFinalize(destination);
+        CFRelease(destination);
+    }
+    CGImageRelease(output);
+    CGDataProviderRelease(provider);
+    CGColorSpaceRelease(colorSpace);
+    return written;
+}
+
+// the deformed image at the resolution of the photo, rendered offscreen (see exportDeformedImage)
 - (IBAction)pushSaveImg:(UIBarButtonItem *)sender{
     NSLog(@"saving image");
-    UIImage* image = [(GLKView*)self.view snapshot];
-    UIImageWriteToSavedPhotosAlbum(image, self, @selector(savingImageIsFinished:didFinishSavingWithError:contextInfo:), nil);
+    CGImageRef source = CGImageRetain(sourceImage.CGImage);
+    // the mesh as it is shown
+    int nv = mainImage.numVertices, nt = mainImage.numTriangles;
+    std::vector<float> x(mainImage.x, mainImage.x+nv), y(mainImage.y, mainImage.y+nv);
+    std::vector<float> u(nv), v(nv);
+    if(mainImage.horizontalDivisions==0){
+        std::copy(mainImage.u, mainImage.u+nv, u.begin());
+        std::copy(mainImage.v, mainImage.v+nv, v.begin());
+    }else{
+        ImageRasterizer::gridTextureCoordinates(mainImage.horizontalDivisions, mainImage.verticalDivisions, u.data(), v.data());
+    }
+    std::vector<int> triangles(mainImage.triangles, mainImage.triangles+3*nt);
+    float width = mainImage.image_width, height = mainImage.image_height;
+    NSURL *url = [NSURL fileURLWithPath:[NSTemporaryDirectory() stringByAppendingPathComponent:@"SimEnergy-export.png"]];
+    dispatch_async(dispatch_get_global_queue(QOS_CLASS_USER_INITIATED, 0), ^{
+        auto start = std::chrono::steady_clock::now();
+        bool written = exportDeformedImage(source, x, y, u, v, triangles, width, height, (__bridge CFURLRef)url);
+        CGImageRelease(source);
+        NSLog(@"export: %.0f ms", std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count());
+        dispatch_async(dispatch_get_main_queue(), ^{
+            UIImage *image = written ? [UIImage imageWithContentsOfFile:url.path] : nil;
+            if(image){
+                UIImageWriteToSavedPhotosAlbum(image, self, @selector(savingImageIsFinished:didFinishSavingWithError:contextInfo:), nil);
+            }else{
+                [self savingImageIsFinished:nil didFinishSavingWithError:[NSError errorWithDomain:@"SimEnergy" code:1 userInfo:nil] contextInfo:NULL];
+            }
+        });
+    });
 }
 - (void) savingImageIsFinished:(UIImage *)_image didFinishSavingWithError:(NSError *)_error contextInfo:(void *)_contextInfo{
     NSMutableString *title = [NSMutableString string];
@@ -592,7 +649,8 @@ std::vector<Matrix2f> A;
 // mode change
 -(IBAction)pushSeg:(UISegmentedControl *)sender{
     mode = (int)sender.selectedSegmentIndex;
-    [self formEnergy];
+    // the kept factorization belongs to the other energy
+    asyncSolver.postStructural([self settings], mainImage.selected, mainImage.numSelected, true);
 }
 
 
@@ -616,8 +674,16 @@ std::vector<Matrix2f> A;
     GLuint name = mainImage.texture.name;
     glDeleteTextures(1, &name);
     UIImage *pImage = [info objectForKey: UIImagePickerControllerOriginalImage];
+#ifdef ADAPTIVE_MESH
+    // the mesh follows the content, so each image gets its own
+    CFDictionaryApplyFunction(touchedPts, freeTouch, NULL);
+    CFDictionaryRemoveAllValues(touchedPts);
+    mainImage = [self adaptiveMeshForImage:pImage];
+    [self allocateMeshStorage];
+#else
     mainImage.image_width = (float)pImage.size.width;
     mainImage.image_height = (float)pImage.size.height;
+#endif
     [self loadTexture:pImage];
     [self setupScreen];
     [self dismissViewControllerAnimated:YES completion:nil];
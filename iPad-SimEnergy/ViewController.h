@@ -45,6 +45,11 @@
     CGSize screen;
     
     int mode, iteration;
+    BOOL prefactored;
+    // mesh resolution
+    int horizontalDivisions, verticalDivisions;
+    // the image being deformed, at its original resolution
+    UIImage *sourceImage;
 }
 
 - (IBAction)pushButton_ReadImage:(UIBarButtonItem *)sender;
@@ -54,4 +59,7 @@
 - (IBAction)iterationSliderChanged:(UISlider *)sender;
 - (IBAction)pushSaveImg:(UIBarButtonItem *)sender;
 
+// rebuild the mesh with the given grid resolution, keeping the current image
+- (void)setMeshDivisionsHorizontal:(int)h Vertical:(int)v;
+
 @end
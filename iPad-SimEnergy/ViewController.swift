@@ -34,8 +34,12 @@ class ViewController: GLKViewController {
     private var screenSize: CGSize = .zero
     
     // State
-    private var mode: Int = 0
-    private var iteration: Int = 1
+    private var mode: Int = 0 {
+        didSet { mathEngine?.mode = mode }
+    }
+    private var iteration: Int = 1 {
+        didSet { mathEngine?.iteration = iteration }
+    }
     
     // Constants
     private let hDiv = 15
@@ -90,7 +94,7 @@ class ViewController: GLKViewController {
         }
         
         mainImage = ImageMesh(uiImage: image, verticalDivisions: GLuint(vDiv), horizontalDivisions: GLuint(hDiv))
-        mathEngine = MathematicalEngine(imageMesh: mainImage)
+        makeMathEngine()
         loadTexture(image)
     }
     
@@ -146,6 +150,7 @@ class ViewController: GLKViewController {
         for touch in touches {
             handleTouchBegan(touch)
         }
+        formEnergy()
     }
     
     override func touchesMoved(_ touches: Set<UITouch>, with event: UIEvent?) {
@@ -184,24 +189,9 @@ class ViewController: GLKViewController {
     private func handleTouchBegan(_ touch: UITouch) {
         let point = convertTouchToOpenGLCoordinates(touch)
         
-        // Find nearest vertex
-        var closestVertex = 0
-        var minDistance = mainImage.radius
-        
-        // Skip vertex 0 (lower left corner) - reserved for constraint handling
-        for i in 1..<Int(mainImage.numVertices) {
-            let dx = point.x - mainImage.x[i]
-            let dy = point.y - mainImage.y[i]
-            let distance = dx * dx + dy * dy
-            
-            if distance < minDistance {
-                minDistance = distance
-                closestVertex = i
-            }
-        }
-        
-        // If nearest vertex is close enough, select it
-        if minDistance < mainImage.radius {
+        // Find nearest vertex through the core's spatial index
+        // (radius bounds the squared distance, as in ViewController.cpp; vertex 0 is skipped)
+        if let closestVertex = mathEngine.findNearestVertex(to: point, maxDistance: sqrt(mainImage.radius)) {
             touchedPoints[touch] = closestVertex
             mainImage.selected[Int(mainImage.numSelected)] = Int32(closestVertex)
             mainImage.numSelected += 1
@@ -227,20 +217,16 @@ class ViewController: GLKViewController {
     
     // MARK: - Mathematical Operations
     
-    private func performDeformation() {
-        if mode == 1 {
-            // ARAP (As-Rigid-As-Possible) deformation
-            solveVerticesARAP()
-        } else {
-            // Similarity deformation
-            mathEngine.performDeformation()
-        }
+    // the core works on mainImage's arrays in place
+    private func makeMathEngine() {
+        mathEngine = MathematicalEngine(imageMesh: mainImage)
+        mathEngine.mode = mode
+        mathEngine.iteration = iteration
     }
     
-    private func solveVerticesARAP() {
-        // Placeholder for ARAP implementation
-        // This would integrate with the existing C++ Eigen-based ARAP solver
-        print("ARAP deformation not yet implemented in Swift version")
+    private func performDeformation() {
+        // Similarity or ARAP (As-Rigid-As-Possible) deformation, depending on mathEngine.mode
+        mathEngine.performDeformation()
     }
     
     private func formEnergy() {
@@ -255,6 +241,7 @@ class ViewController: GLKViewController {
     
     @IBAction func initializeTapped(_ sender: UIBarButtonItem) {
         mainImage.initialize()
+        mathEngine.reset()
     }
     
     @IBAction func howToUseTapped(_ sender: UIBarButtonItem) {
@@ -263,6 +250,8 @@ class ViewController: GLKViewController {
     
     @IBAction func modeSegmentChanged(_ sender: UISegmentedControl) {
         mode = sender.selectedSegmentIndex
+        // the energy of the new mode, for the vertices that are still held
+        formEnergy()
     }
     
     @IBAction func iterationSliderChanged(_ sender: UISlider) {
@@ -369,7 +358,7 @@ extension ViewController: UIImagePickerControllerDelegate, UINavigationControlle
         
         // Reload mesh with new image
         mainImage = ImageMesh(uiImage: image, verticalDivisions: GLuint(vDiv), horizontalDivisions: GLuint(hDiv))
-        mathEngine = MathematicalEngine(imageMesh: mainImage)
+        makeMathEngine()
         loadTexture(image)
     }
     
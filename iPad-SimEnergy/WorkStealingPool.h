@@ -0,0 +1,94 @@
+//
+//  WorkStealingPool.h
+//  iPad-SimEnergy
+//
+//  Thread pool for coarse, independent tasks (the jobs of a batch run). Every
+//  worker has its own queue: it takes its tasks from the front, in the order
+//  they were pushed, and when its queue is empty it steals from the back of
+//  the others. Tasks that should run one after the other on the same thread
+//  (sharing a cache) are pushed to the same queue; stealing then only breaks
+//  up the tails of those runs once a worker is idle.
+//
+//  The workers are marked with parallelForSerial(), so the parallel loops
+//  inside a task run on its thread instead of oversubscribing the cores.
+//
+
+#ifndef WorkStealingPool_h
+#define WorkStealingPool_h
+
+#include "ParallelFor.h"
+#include <atomic>
+#include <deque>
+#include <functional>
+#include <mutex>
+
+class WorkStealingPool {
+public:
+    // task(worker): worker is the index of the thread that runs it
+    typedef std::function<void(int)> Task;
+
+    explicit WorkStealingPool(int threads = parallelConcurrency()) : queues(std::max(threads, 1)){}
+
+    int size() const { return (int)queues.size(); }
+
+    // queue a task on the given worker (modulo the pool size); before run() only
+    void push(int worker, Task task){
+        queues[worker%size()].tasks.push_back(std::move(task));
+    }
+
+    // runs all the queued tasks and returns when they are done; the calling thread is worker 0
+    void run(){
+        steals = 0;
+        std::vector<std::thread> threads;
+        threads.reserve(size()-1);
+        for(int w=1;w<size();w++) threads.emplace_back([this, w](){ work(w); });
+        work(0);
+        for(std::thread &t : threads) t.join();
+    }
+
+    // tasks taken from another worker's queue during the last run()
+    int numSteals() const { return steals; }
+
+private:
+    struct Queue {
+        std::mutex mutex;
+        std::deque<Task> tasks;
+    };
+
+    void work(int w){
+        bool serial = parallelForSerial();
+        parallelForSerial() = true;
+        Task task;
+        // no task is pushed while running, so all queues empty means done
+        while(pop(w, task) || steal(w, task)){
+            task(w);
+        }
+        parallelForSerial() = serial;
+    }
+
+    bool pop(int w, Task &task){
+        std::lock_guard<std::mutex> lock(queues[w].mutex);
+        if(queues[w].tasks.empty()) return false;
+        task = std::move(queues[w].tasks.front());
+        queues[w].tasks.pop_front();
+        return true;
+    }
+
+    bool steal(int w, Task &task){
+        for(int k=1;k<size();k++){
+            Queue &victim = queues[(w+k)%size()];
+            std::lock_guard<std::mutex> lock(victim.mutex);
+            if(victim.tasks.empty()) continue;
+            task = std::move(victim.tasks.back());
+            victim.tasks.pop_back();
+            steals++;
+            return true;
+        }
+        return false;
+    }
+
+    std::vector<Queue> queues;
+    std::atomic<int> steals{0};
+};
+
+#endif /* WorkStealingPool_h */
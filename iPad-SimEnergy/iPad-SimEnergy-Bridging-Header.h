@@ -20,11 +20,8 @@
 // Import custom Objective-C classes
 #import "ImageMesh.h"
 
-// Define constants used in mathematical computations
-// N should be defined based on the maximum number of vertices
-#ifndef N
-#define N 2000  // Adjust based on maximum mesh resolution needs
-#endif
+// C interface to the C++ deformation core (used by MathematicalEngine.swift)
+#import "SimEnergyCore.h"
 
 // C++ Eigen includes (for mixed C++/Swift compatibility)
 #ifdef __cplusplus